@@ -2,6 +2,35 @@
 
 #include "sio/stt.h"
 
+#include <stddef.h>
+#include <string.h>
+
+// sio_stt_tokens() exposes sio::TokenAlignment arrays as is
+#define SIO_SAME_FIELD(x, y) (offsetof(struct sio_stt_token, x) == offsetof(sio::TokenAlignment, y))
+static_assert(sizeof(struct sio_stt_token) == sizeof(sio::TokenAlignment), "sio_stt_token layout");
+static_assert(
+    SIO_SAME_FIELD(text, text) && SIO_SAME_FIELD(token, token) &&
+    SIO_SAME_FIELD(begin_frame, begin_frame) && SIO_SAME_FIELD(end_frame, end_frame) &&
+    SIO_SAME_FIELD(begin_time, begin_time) && SIO_SAME_FIELD(end_time, end_time) &&
+    SIO_SAME_FIELD(am_score, am_score) && SIO_SAME_FIELD(lm_score, lm_score) &&
+    SIO_SAME_FIELD(confidence, confidence),
+    "sio_stt_token layout"
+);
+#undef SIO_SAME_FIELD
+
+// sio_stt_search_stats() copies sio::SearchStats as is
+#define SIO_SAME_FIELD(x) (offsetof(struct sio_stt_search_stats, x) == offsetof(sio::SearchStats, x))
+static_assert(sizeof(struct sio_stt_search_stats) == sizeof(sio::SearchStats), "sio_stt_search_stats layout");
+static_assert(
+    SIO_SAME_FIELD(token_sets) && SIO_SAME_FIELD(tokens) && SIO_SAME_FIELD(beam_pruned) &&
+    SIO_SAME_FIELD(max_active_pruned) && SIO_SAME_FIELD(recombined) && SIO_SAME_FIELD(eps_reexpansions) &&
+    SIO_SAME_FIELD(lm_queries) && SIO_SAME_FIELD(lm_cache_hits) && SIO_SAME_FIELD(lm_cache_misses) &&
+    SIO_SAME_FIELD(arena_high_water),
+    "sio_stt_search_stats layout"
+);
+static_assert(SIO_STT_STATS_BINS == sio::SearchStats::kNumBins, "sio_stt_search_stats histogram bins");
+#undef SIO_SAME_FIELD
+
 int sio_init(const char* path, struct sio_package* pkg) {
     SIO_CHECK(pkg != nullptr);
     SIO_CHECK(pkg->stt_module == nullptr);
@@ -54,10 +83,40 @@ int sio_stt_deinit(struct sio_stt* stt) {
     return 0;
 }
 
+int sio_stt_set_context(struct sio_stt stt, const char* phrases) {
+    return ((sio::SpeechToText*)stt.handle)->SetContext(phrases);
+}
+
 int sio_stt_speech(struct sio_stt stt, const float* samples, int n, float sample_rate) {
     return ((sio::SpeechToText*)stt.handle)->Speech(samples, n, sample_rate);
 }
 
+const char* sio_stt_partial_text(struct sio_stt stt) {
+    return ((sio::SpeechToText*)stt.handle)->PartialText();
+}
+
+int sio_stt_num_segments(struct sio_stt stt) {
+    return ((sio::SpeechToText*)stt.handle)->NumSegments();
+}
+
+const char* sio_stt_segment_text(struct sio_stt stt, int i) {
+    return ((sio::SpeechToText*)stt.handle)->SegmentText(i);
+}
+
+int sio_stt_num_degradations(struct sio_stt stt) {
+    return ((sio::SpeechToText*)stt.handle)->NumDegradations();
+}
+
+struct sio_stt_degradation sio_stt_degradation(struct sio_stt stt, int i) {
+    const sio::DegradationEvent& e = ((sio::SpeechToText*)stt.handle)->Degradation(i);
+
+    struct sio_stt_degradation d;
+    d.time = e.time;
+    d.level = e.level;
+    d.lag = e.lag;
+    return d;
+}
+
 int sio_stt_to(struct sio_stt stt) {
     return ((sio::SpeechToText*)stt.handle)->To();
 }
@@ -66,7 +125,49 @@ const char* sio_stt_text(struct sio_stt stt) {
     return ((sio::SpeechToText*)stt.handle)->Text();
 }
 
+int sio_stt_num_tokens(struct sio_stt stt) {
+    return ((sio::SpeechToText*)stt.handle)->Alignment().size();
+}
+
+const struct sio_stt_token* sio_stt_tokens(struct sio_stt stt) {
+    return reinterpret_cast<const struct sio_stt_token*>(((sio::SpeechToText*)stt.handle)->Alignment().data());
+}
+
 int sio_stt_clear(struct sio_stt stt) {
     return ((sio::SpeechToText*)stt.handle)->Clear();
 }
 
+int sio_stt_search_stats(struct sio_stt stt,
+    struct sio_stt_search_stats* session,
+    struct sio_stt_search_stats* last_frame,
+    struct sio_stt_search_stats* frame_histogram)
+{
+    const sio::SpeechToText* s = (sio::SpeechToText*)stt.handle;
+    if (session != nullptr) {
+        memcpy(session, &s->SessionStats(), sizeof(*session));
+    }
+    if (last_frame != nullptr) {
+        memcpy(last_frame, &s->FrameStats(), sizeof(*last_frame));
+    }
+    if (frame_histogram != nullptr) {
+        const sio::vec<sio::SearchStats>& h = s->FrameStatsHistogram();
+        memset(frame_histogram, 0, sizeof(*frame_histogram) * SIO_STT_STATS_BINS); // empty if stats are off
+        memcpy(frame_histogram, h.data(), sizeof(*frame_histogram) * h.size());
+    }
+    return 0;
+}
+
+int sio_stt_snapshot(struct sio_stt stt, const char** blob, int* size) {
+    SIO_CHECK(blob != nullptr && size != nullptr);
+
+    const sio::str* s = nullptr;
+    int err = ((sio::SpeechToText*)stt.handle)->Snapshot(&s);
+    *blob = s->data();
+    *size = s->size();
+    return err;
+}
+
+int sio_stt_restore(struct sio_stt stt, const char* blob, int size) {
+    return ((sio::SpeechToText*)stt.handle)->Restore(blob, size);
+}
+
@@ -14,17 +14,78 @@ struct sio_stt {
     void* handle;
 };
 
+// output token of best path with its time span & scores
+struct sio_stt_token {
+    const char* text;
+    int token;
+    int begin_frame;
+    int end_frame; // exclusive
+    float begin_time; // seconds
+    float end_time;
+    float am_score;
+    float lm_score;
+    float confidence;
+};
+
+// decoder degradation level change under RTF budget
+struct sio_stt_degradation {
+    float time; // seconds of audio into session
+    int level; // 0: fully restored
+    float lag; // seconds behind budget
+};
+
+// beam search counters, collected with "beam_search.stats" config
+struct sio_stt_search_stats {
+    long long token_sets; // created
+    long long tokens; // created
+    long long beam_pruned;
+    long long max_active_pruned; // token sets
+    long long recombined;
+    long long eps_reexpansions;
+    long long lm_queries;
+    long long lm_cache_hits;
+    long long lm_cache_misses;
+    long long arena_high_water; // max tokens alive
+};
+
+// bins of per-frame counter histograms: bin 0 counts frames of value 0, bin b counts [2^(b-1), 2^b), last one is open
+#define SIO_STT_STATS_BINS 24
+
 int sio_init(const char* path, struct sio_package*);
 int sio_deinit(struct sio_package*);
 
 int sio_stt_init(struct sio_package, struct sio_stt*);
 int sio_stt_deinit(struct sio_stt*);
 
+// Hot phrases of following sessions(one per line, tokens separated by spaces, optional "\t<bonus>"),
+// NULL reverts to package's "context" config. Needs "beam_search.context_biasing".
+int sio_stt_set_context(struct sio_stt, const char* phrases);
+
 int sio_stt_speech(struct sio_stt, const float* samples, int n, float sample_rate);
+const char* sio_stt_partial_text(struct sio_stt);
+int sio_stt_num_segments(struct sio_stt);
+const char* sio_stt_segment_text(struct sio_stt, int i);
+int sio_stt_num_degradations(struct sio_stt);
+struct sio_stt_degradation sio_stt_degradation(struct sio_stt, int i);
 int sio_stt_to(struct sio_stt);
 const char* sio_stt_text(struct sio_stt);
+int sio_stt_num_tokens(struct sio_stt);
+const struct sio_stt_token* sio_stt_tokens(struct sio_stt); // zero-copy, valid until sio_stt_clear()
 int sio_stt_clear(struct sio_stt);
 
+// Counters of current session, available during sio_stt_speech() calls and after sio_stt_to(), any output can be NULL.
+// frame_histogram: SIO_STT_STATS_BINS entries, each field counts frames.
+int sio_stt_search_stats(struct sio_stt,
+    struct sio_stt_search_stats* session,
+    struct sio_stt_search_stats* last_frame,
+    struct sio_stt_search_stats* frame_histogram
+);
+
+// Session migration: snapshot an in-flight session(between sio_stt_speech() calls),
+// and resume it by an idle stt of a package loaded with the same config, possibly in another process.
+int sio_stt_snapshot(struct sio_stt, const char** blob, int* size); // blob is owned by stt, valid until next snapshot
+int sio_stt_restore(struct sio_stt, const char* blob, int size);
+
 #ifdef __cplusplus
 }
 #endif
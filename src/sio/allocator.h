@@ -1,6 +1,10 @@
 #ifndef SIO_ALLOCATOR_H
 #define SIO_ALLOCATOR_H
 
+#include <algorithm>
+#include <limits>
+
+#include "sio/type.h"
 #include "sio/ptr.h"
 #include "sio/check.h"
 #include "sio/vec.h"
@@ -18,19 +22,24 @@ namespace sio {
 //          ...
 //
 //  1. A slab caches a 2D matrix of elements, allocated by operating system all at once.
-//  2. Each Alloc() yields a row by returning a T* to the beginning of the row.
+//  2. Each Alloc() yields a row by returning a 32-bit handle of the row, Get() maps handle to T*.
 //  3. Each Free() reclaims a row back to internal free list.
+//
+//  Handles are half the size of pointers, they are 1-based row indexes across slabs, 0 means null.
+//  size2(allocs per slab) needs to be power of 2, so Get() is a shift & mask.
+using SlabHandle = u32;
+
 template <typename T>
 class SlabAllocator {
-    struct FreeNode;
-
-    // A slab is a blob of raw memory with size0_ * size1_ * sizeof(T) bytes.
+    // A slab is a blob of raw memory with size0_ * size1_ * size2_ bytes.
     size_t size0_ = 0; // num of bytes per element
     size_t size1_ = 0; // num of elements per alloc
     size_t size2_ = 0; // num of allocs per slab
+    int shift_ = 0; // log2(size2_)
+    size_t row_bytes_ = 0; // size0_ * size1_
 
     vec<vec<char>> slabs_;
-    Nullable<FreeNode*> free_list_ = nullptr;
+    SlabHandle free_list_ = 0; // free rows are linked via a handle stored at their beginning
 
     size_t num_used_ = 0;
     size_t num_free_ = 0;
@@ -39,46 +48,69 @@ public:
 
     void SetSize(size_t size2, size_t size1 = 1, size_t size0 = sizeof(T)) {
         SIO_CHECK(slabs_.empty());
-        SIO_CHECK_GE(size0 * size1, sizeof(FreeNode*)); // each allocation should be at least as large as a pointer.
+        SIO_CHECK_GE(size0 * size1, sizeof(SlabHandle)); // each allocation should be at least as large as a handle.
         SIO_CHECK_GE(size2, 1);
+        SIO_CHECK_EQ(size2 & (size2 - 1), 0); // power of 2
 
         size0_ = size0;
         size1_ = size1;
         size2_ = size2;
+        for (shift_ = 0; (size_t(1) << shift_) != size2_; shift_++) { }
+        row_bytes_ = size0_ * size1_;
     }
 
 
-    inline T* Alloc() {
-        if (free_list_ == nullptr) {
+    inline SlabHandle Alloc() {
+        if (free_list_ == 0) {
+            SIO_CHECK_LT(Capacity() + size2_, std::numeric_limits<SlabHandle>::max());
             slabs_.emplace_back();
             vec<char>& slab = slabs_.back();
-            slab.resize(size0_ * size1_ * size2_);
+            slab.resize(row_bytes_ * size2_);
 
-            char* p = slab.data();
-            for (size_t i = 0; i < size2_; i++) {
-                FreeListPush((FreeNode*)p);
-                p += size0_ * size1_;
+            // push in reverse, so rows are popped in address order
+            SlabHandle base = (slabs_.size() - 1) << shift_;
+            for (size_t i = size2_; i != 0; i--) {
+                FreeListPush(base + i);
             }
         }
 
         num_used_++;
-        return (T*) FreeListPop();
+        return FreeListPop();
     }
 
 
-    inline void Free(T* p) {
+    inline void Free(SlabHandle h) {
         num_used_--;
-        FreeListPush( (FreeNode*)p );
+        FreeListPush(h);
+    }
+
+
+    inline T* Get(SlabHandle h) const {
+        SlabHandle i = h - 1;
+        return (T*) (slabs_[i >> shift_].data() + (i & (size2_ - 1)) * row_bytes_);
     }
 
 
     size_t NumUsed() const { return num_used_; }
     size_t NumFree() const { return num_free_; }
 
+    // handles are within [1, Capacity()]
+    size_t Capacity() const { return slabs_.size() << shift_; }
+
+
+    // Visits every row of every slab, including rows sitting in free list,
+    // so the caller needs its own way to tell a live element from a free one.
+    template <typename F>
+    void ForEachSlot(F&& f) {
+        for (SlabHandle h = 1; h <= Capacity(); h++) {
+            f(h, Get(h));
+        }
+    }
+
 
     void Clear() {
         slabs_.clear();
-        free_list_ = nullptr;
+        free_list_ = 0;
 
         num_used_ = 0;
         num_free_ = 0;
@@ -86,26 +118,170 @@ public:
 
 private:
 
-    struct FreeNode {
-        Nullable<FreeNode*> next = nullptr;
-    };
-
-
-    inline void FreeListPush(FreeNode* p) {
-        p->next = free_list_;
-        free_list_ = p;
+    inline void FreeListPush(SlabHandle h) {
+        *(SlabHandle*)Get(h) = free_list_;
+        free_list_ = h;
         ++num_free_;
     }
 
 
-    inline FreeNode* FreeListPop() {
-        SIO_CHECK(free_list_ != nullptr); // slabs should grow outside Pop(), in Alloc()
-        FreeNode* p = free_list_;
-        free_list_ = free_list_->next;
+    inline SlabHandle FreeListPop() {
+        SIO_CHECK(free_list_ != 0); // slabs should grow outside Pop(), in Alloc()
+        SlabHandle h = free_list_;
+        free_list_ = *(SlabHandle*)Get(h);
         --num_free_;
-        return p;
+        return h;
     }
 
 }; // class SlabAllocator
+
+
+//   chunk0: [frame0|frame1|frame2|  unused  ]
+//   chunk1: [frame3|frame4|  ...
+//
+//  FrameArena is a queue of variable-length frames: frames are appended at back & released from front.
+//  1. Elements of a frame are contiguous within a chunk, a frame that doesn't fit starts a new chunk.
+//  2. A chunk goes to an internal free list once all of its frames are released.
+//  3. Clear() releases everything but keeps chunks, so the arena is reused across sessions.
+//
+//  So appending a frame is a copy & an offset bump, without heap allocation in steady state.
+//  Elements stay in place until their frame is released, frames can only shrink in place.
+template <typename T>
+class FrameArena {
+    static constexpr u32 kNoChunk = std::numeric_limits<u32>::max();
+
+    struct FrameRange {
+        T* data;
+        size_t size;
+        u32 chunk;
+    };
+
+    size_t chunk_size_ = 0; // elements per chunk, larger frames get a chunk of their own size
+    vec<vec<T>> chunks_;
+    vec<u32> free_chunks_;
+    u32 cur_chunk_ = kNoChunk; // chunk of back frame
+    size_t cur_offset_ = 0; // used elements of current chunk
+
+    vec<FrameRange> frames_; // [frames_begin_, end) are live
+    size_t frames_begin_ = 0;
+
+public:
+
+    // View of a frame's elements
+    class Span {
+        T* data_;
+        size_t size_;
+    public:
+        Span(T* data, size_t size) : data_(data), size_(size) { }
+        T* begin() const { return data_; }
+        T* end() const { return data_ + size_; }
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+        T& operator[](size_t i) const { return data_[i]; }
+    };
+
+
+    void SetSize(size_t chunk_size) {
+        SIO_CHECK(chunks_.empty());
+        SIO_CHECK_GE(chunk_size, 1);
+        chunk_size_ = chunk_size;
+    }
+
+
+    void Push(const T* data, size_t n) {
+        SIO_CHECK_GE(chunk_size_, 1);
+        if (cur_chunk_ == kNoChunk || cur_offset_ + n > chunks_[cur_chunk_].size()) {
+            if (cur_chunk_ != kNoChunk && Size() == 0) {
+                free_chunks_.push_back(cur_chunk_);
+            }
+            cur_chunk_ = AcquireChunk(n);
+            cur_offset_ = 0;
+        }
+
+        T* dst = chunks_[cur_chunk_].data() + cur_offset_;
+        std::copy(data, data + n, dst);
+        cur_offset_ += n;
+        frames_.push_back({dst, n, cur_chunk_});
+    }
+
+
+    void Push(const vec<T>& frame) {
+        Push(frame.data(), frame.size());
+    }
+
+
+    // Releases n frames from front
+    void PopFront(size_t n) {
+        SIO_CHECK_LE(n, Size());
+        for (size_t i = frames_begin_; i != frames_begin_ + n; i++) {
+            if (i + 1 != frames_.size() && frames_[i + 1].chunk != frames_[i].chunk) {
+                free_chunks_.push_back(frames_[i].chunk);
+            }
+        }
+        frames_begin_ += n;
+
+        if (frames_begin_ == frames_.size()) {
+            frames_.clear();
+            frames_begin_ = 0;
+            cur_offset_ = 0; // current chunk is empty now
+        } else if (frames_begin_ * 2 > frames_.size()) { // amortized compaction, capacity is kept
+            frames_.erase(frames_.begin(), frames_.begin() + frames_begin_);
+            frames_begin_ = 0;
+        }
+    }
+
+
+    // Drops trailing elements of frame i
+    void Shrink(size_t i, size_t n) {
+        FrameRange& f = frames_[frames_begin_ + i];
+        SIO_CHECK_LE(n, f.size);
+        f.size = n;
+    }
+
+
+    Span operator[](size_t i) const {
+        const FrameRange& f = frames_[frames_begin_ + i];
+        return Span(f.data, f.size);
+    }
+
+
+    Span Back() const {
+        SIO_CHECK_GT(Size(), 0);
+        return (*this)[Size() - 1];
+    }
+
+
+    size_t Size() const { return frames_.size() - frames_begin_; }
+    size_t NumChunks() const { return chunks_.size(); }
+
+
+    void Clear() {
+        free_chunks_.clear();
+        for (u32 c = 0; c != chunks_.size(); c++) {
+            free_chunks_.push_back(c);
+        }
+        cur_chunk_ = kNoChunk;
+        cur_offset_ = 0;
+
+        frames_.clear();
+        frames_begin_ = 0;
+    }
+
+private:
+
+    u32 AcquireChunk(size_t n) {
+        for (size_t i = free_chunks_.size(); i != 0; i--) {
+            u32 c = free_chunks_[i - 1];
+            if (chunks_[c].size() >= n) {
+                free_chunks_.erase(free_chunks_.begin() + (i - 1));
+                return c;
+            }
+        }
+        SIO_CHECK_LT(chunks_.size(), kNoChunk);
+        chunks_.emplace_back(std::max(chunk_size_, n));
+        return chunks_.size() - 1;
+    }
+
+}; // class FrameArena
 } // namespace sio
 #endif
@@ -17,22 +17,28 @@ TEST(Allocator, SlabAllocator) {
     EXPECT_EQ(pool.NumUsed(), 0);
     EXPECT_EQ(pool.NumFree(), 0);
 
-    S* s1 = pool.Alloc();
+    SlabHandle s1 = pool.Alloc();
+    EXPECT_NE(s1, 0);
     EXPECT_EQ(pool.NumUsed(), 1);
     EXPECT_EQ(pool.NumFree(), 1);
 
-    S* s2 = pool.Alloc();
+    SlabHandle s2 = pool.Alloc();
     EXPECT_EQ(pool.NumUsed(), 2);
     EXPECT_EQ(pool.NumFree(), 0);
+    EXPECT_EQ(pool.Get(s2) - pool.Get(s1), 1); // rows of a slab are contiguous
 
+    pool.Get(s1)->i = 1;
     pool.Free(s2);
     EXPECT_EQ(pool.NumUsed(), 1);
     EXPECT_EQ(pool.NumFree(), 1);
 
-    S* s3 = pool.Alloc();
-    S* s4 = pool.Alloc(); // trigger another slab growth
+    SlabHandle s3 = pool.Alloc();
+    SlabHandle s4 = pool.Alloc(); // trigger another slab growth
     EXPECT_EQ(pool.NumUsed(), 3);
     EXPECT_EQ(pool.NumFree(), 1);
+    EXPECT_EQ(pool.Capacity(), 4);
+    EXPECT_EQ(pool.Get(s1)->i, 1); // growth doesn't move existing rows
+    pool.Get(s4)->i = 4;
 
     pool.Free(s1);
     pool.Free(s3);
@@ -42,14 +48,82 @@ TEST(Allocator, SlabAllocator) {
     EXPECT_EQ(pool.NumUsed(), 0);
     EXPECT_EQ(pool.NumFree(), 0);
 
-    S* s5 = pool.Alloc();
-    S* s6 = pool.Alloc();
-    S* s7 = pool.Alloc();
+    pool.Alloc();
+    pool.Alloc();
+    pool.Alloc();
     EXPECT_EQ(pool.NumUsed(), 3);
     EXPECT_EQ(pool.NumFree(), 1);
 
-    // s5, s6, s7 will not leak, 
+    // rows will not leak, 
     // pool cleanup itself on destruction
 }
 
+
+TEST(Allocator, ForEachSlot) {
+    SlabAllocator<int64_t> pool;
+    pool.SetSize(4);
+
+    SlabHandle x = pool.Alloc();
+    SlabHandle y = pool.Alloc();
+    *pool.Get(x) = 1;
+    *pool.Get(y) = 2;
+
+    int n = 0;
+    int64_t sum = 0;
+    pool.ForEachSlot([&](SlabHandle h, int64_t* p) {
+        n++;
+        if (h == x || h == y) sum += *p;
+    });
+    EXPECT_EQ(n, 4); // free slots are visited too
+    EXPECT_EQ(sum, 3);
+
+    for (int i = 0; i != 3; i++) {
+        pool.Alloc(); // trigger another slab growth
+    }
+    n = 0;
+    pool.ForEachSlot([&](SlabHandle h, int64_t* p) { n++; });
+    EXPECT_EQ(n, 8);
+}
+
+TEST(Allocator, FrameArena) {
+    FrameArena<int> arena;
+    arena.SetSize(4);
+
+    vec<int> a = {1, 2, 3};
+    vec<int> b = {4, 5};
+    arena.Push(a);
+    arena.Push(b); // doesn't fit, starts another chunk
+    arena.Push(nullptr, 0);
+    EXPECT_EQ(arena.Size(), 3);
+    EXPECT_EQ(arena.NumChunks(), 2);
+    EXPECT_EQ(arena[0][2], 3);
+    EXPECT_EQ(arena[1][1], 5);
+    EXPECT_TRUE(arena.Back().empty());
+
+    arena.Shrink(1, 1);
+    EXPECT_EQ(arena[1].size(), 1);
+
+    arena.PopFront(1); // first chunk is free
+    arena.Push(a);
+    EXPECT_EQ(arena.NumChunks(), 2); // reused
+    EXPECT_EQ(arena.Back()[0], 1);
+    EXPECT_EQ(arena[0][0], 4); // earlier frames stay in place
+
+    vec<int> big(10, 7);
+    arena.Push(big); // larger than chunk size
+    EXPECT_EQ(arena.NumChunks(), 3);
+    EXPECT_EQ(arena.Back().size(), 10);
+
+    arena.Clear();
+    EXPECT_EQ(arena.Size(), 0);
+    for (int i = 0; i != 100; i++) {
+        arena.Push(b);
+        if (arena.Size() > 3) {
+            arena.PopFront(2);
+        }
+    }
+    EXPECT_EQ(arena.NumChunks(), 3); // steady state without growth
+    EXPECT_EQ(arena.Back()[1], 5);
+}
+
 } // namespace sio
@@ -2,44 +2,130 @@
 #define SIO_BEAM_SEARCH_H
 
 #include <string.h>
+#include <cmath>
 #include <limits>
+#include <algorithm>
+#include <array>
+#include <tuple>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <torch/torch.h>
 
 #include "sio/base.h"
+#include "sio/struct_loader.h"
 #include "sio/allocator.h"
+#include "sio/binary_io.h"
 #include "sio/tokenizer.h"
 #include "sio/finite_state_transducer.h"
 #include "sio/language_model.h"
+#include "sio/thread_pool.h"
+#include "sio/beam_search_itf.h"
+#include "sio/ctc_prefix_beam_search.h"
+#include "sio/transducer_beam_search.h"
 
 namespace sio {
 
 struct BeamSearchConfig {
     bool debug = false;
+    bool stats = false; // collect SearchStats per frame & session
 
     f32 beam = 16.0;
     i32 max_active = 12;
+    bool histogram_pruning = false; // approximate max_active cutoff via score histogram instead of nth_element
+    i32 histogram_bins = 128;
     f32 token_set_size = 1;
+    // token sets of current frame keep their tokens in contiguous sorted arrays of fixed capacity during expansion,
+    // so recombination & insertion scan adjacent memory instead of chasing token links.
+    // Arrays are linked into token lists once a frame is expanded, results are identical to lists.
+    // Pays off for crowded token sets, e.g. token topology with token_set_size >= 8.
+    bool token_arrays = false;
 
     i32 nbest = 1;
 
+    // tokens carry a context LM biasing towards hot phrases, phrases are attached per session via AttachContextGraph()
+    bool context_biasing = false;
+
+    // lattice n-best: hypotheses recombined into a token are kept as its alternative links,
+    // unique outputs are then extracted by A* over the lattice instead of from final token set only.
+    bool lattice_nbest = false;
+    i32 nbest_max_pops = 10000; // A* effort limit
+
     f32 insertion_penalty = 0.0;
+    // token passing stops at source tokens whose LM score upper bounds already miss the beam, before querying LMs.
+    // KenLm bounds come from ARPA models only, binary models bound every token by 0, i.e. insertion penalty alone.
+    bool lm_lookahead = true;
     bool apply_score_offsets = true;  // for numerical stability of long audio scores
 
     i32 token_allocator_slab_size = 4096;
+    i32 lattice_chunk_size = 16384; // token sets per chunk of lattice arena
+    i32 gc_interval = 25; // frames between two lattice garbage collections, <= 0 disables it
+    i32 lattice_max_frames = 250; // hypotheses diverged from best path earlier than this are dropped by gc
+
+    // frame skipping: a skipped frame only expands arcs of its dominant label
+    f32 blank_skip_threshold = 0.0; // skip frames whose blank posterior exceeds this, <= 0 disables it
+    bool repeat_skip = false; // skip frames whose argmax repeats previous frame's non-blank argmax
+
+    // main graph states are mapped to frontier via a direct-indexed array if graph is not larger than this, 0 disables it
+    i32 dense_frontier_map_max_states = 1 << 24;
+
+    // epsilon closure expands token sets best first, so a set is rarely expanded again after its score improves.
+    // false: LIFO order
+    bool best_first_eps = true;
+
+    // > 1: emitting expansion of general graphs is partitioned across threads, results are identical to 1 thread.
+    // LMs carried by tokens need to be thread-safe, with non-positive scores(prefix tree LM is both)
+    i32 num_expansion_threads = 1;
+
+    // adaptive beam: effective beam is steered within [min_beam, max_beam] every frame by a PI controller,
+    // so that token sets per frame track target_active. <= 0 disables it, beam is then static.
+    i32 target_active = 0;
+    f32 min_beam = 8.0;
+    f32 max_beam = 24.0;
+    f32 beam_kp = 2.0; // beam change per unit of log(target_active / active token sets)
+    f32 beam_ki = 0.2;
 
 
     Error Register(StructLoader* loader, const std::string module = "") {
         loader->AddEntry(module + ".debug", &debug);
+        loader->AddEntry(module + ".stats", &stats);
 
         loader->AddEntry(module + ".beam", &beam);
         loader->AddEntry(module + ".max_active", &max_active);
+        loader->AddEntry(module + ".histogram_pruning", &histogram_pruning);
+        loader->AddEntry(module + ".histogram_bins", &histogram_bins);
         loader->AddEntry(module + ".token_set_size", &token_set_size);
+        loader->AddEntry(module + ".token_arrays", &token_arrays);
 
         loader->AddEntry(module + ".nbest", &nbest);
+        loader->AddEntry(module + ".context_biasing", &context_biasing);
+        loader->AddEntry(module + ".lattice_nbest", &lattice_nbest);
+        loader->AddEntry(module + ".nbest_max_pops", &nbest_max_pops);
 
         loader->AddEntry(module + ".insertion_penalty", &insertion_penalty);
+        loader->AddEntry(module + ".lm_lookahead", &lm_lookahead);
         loader->AddEntry(module + ".apply_score_offsets", &apply_score_offsets);
 
         loader->AddEntry(module + ".token_allocator_slab_size", &token_allocator_slab_size);
+        loader->AddEntry(module + ".lattice_chunk_size", &lattice_chunk_size);
+        loader->AddEntry(module + ".gc_interval", &gc_interval);
+        loader->AddEntry(module + ".lattice_max_frames", &lattice_max_frames);
+
+        loader->AddEntry(module + ".blank_skip_threshold", &blank_skip_threshold);
+        loader->AddEntry(module + ".repeat_skip", &repeat_skip);
+
+        loader->AddEntry(module + ".dense_frontier_map_max_states", &dense_frontier_map_max_states);
+        loader->AddEntry(module + ".best_first_eps", &best_first_eps);
+
+        loader->AddEntry(module + ".num_expansion_threads", &num_expansion_threads);
+
+        loader->AddEntry(module + ".target_active", &target_active);
+        loader->AddEntry(module + ".min_beam", &min_beam);
+        loader->AddEntry(module + ".max_beam", &max_beam);
+        loader->AddEntry(module + ".beam_kp", &beam_kp);
+        loader->AddEntry(module + ".beam_ki", &beam_ki);
 
         return Error::OK;
     }
@@ -67,52 +153,166 @@ struct BeamSearchConfig {
  *       * TLG (CTC with lexicon & external LM)
  *       * HCLG (WFST)
  *
- *   For multi-graph decoding: say StateHandle = 64-bits(32 + 32) integer:
- *       1st 32 bits represent a Fst
- *       2nd 32 bits represent a state inside that Fst
+ *   For multi-graph decoding: StateHandle = 64-bits(32 + 32) integer:
+ *       1st 32 bits represent a graph context: (class graph, return stack)
+ *       2nd 32 bits represent a state inside that graph
+ *   context 0 is the main graph at top level, so single-graph handles are plain FstStateIds.
  */
-using StateHandle = FstStateId;
-//using StateHandle = u64;
+using StateHandle = u64;
 
-static inline StateHandle ComposeStateHandle(int graph, FstStateId state) {
-    return state;
-    //return (static_cast<StateHandle>(graph) << 32) + static_cast<StateHandle>(state);
+static inline StateHandle ComposeStateHandle(u32 context, FstStateId state) {
+    return (static_cast<StateHandle>(context) << 32) + static_cast<StateHandle>(static_cast<u32>(state));
 }
-static inline int HandleToGraph(StateHandle h) {
-    return 0;
-    //return static_cast<int>(static_cast<u32>(h >> 32));
+static inline u32 HandleToContext(StateHandle h) {
+    return static_cast<u32>(h >> 32);
 }
 static inline FstStateId HandleToState(StateHandle h) {
-    return h;
-    //return static_cast<FstStateId>(static_cast<u32>(h))
+    return static_cast<FstStateId>(static_cast<u32>(h));
 }
 
 
-struct Token;
-struct TokenSet;
+// Nesting limit of class graphs, guards against recursive class references.
+#define SIO_MAX_GRAPH_DEPTH 8
 
-struct TraceBack {
-    Token* token = nullptr;
-    FstArc arc;
-    f32 score = 0.0;
-    LmScore lm_scores[SIO_MAX_LM] = {}; // zero initialized to 0.0
+// GraphContext is a node of class graph return stack,
+// interned per session so that a whole stack is identified by one 32-bit context id.
+struct GraphContext {
+    int graph = -1; // index of attached class graph, -1 for main graph
+    FstStateId return_state = 0; // state to continue in parent context's graph
+    u32 parent = 0;
+    int depth = 0;
 };
 
 
+/*
+ * Survivor mask of emitting arc candidates in bulk:
+ *   bit i is set iff arcs[i] is an emitting arc and
+ *   (best_score + arcs[i].score) + (frame_score[arcs[i].ilabel] + score_offset) >= score_min
+ * n <= SIO_ARC_BLOCK, with AVX2 full blocks are gathered & compared in one pass, tails go scalar.
+ */
+#define SIO_ARC_BLOCK 8
+
+// special symbols(kFstEps, nonterminals, kFstInputEnd) are negative, so emitting iff ilabel > kFstInputEnd
+static inline u32 EmittingArcMaskScalar(const FstArc* arcs, int n, const float* frame_score, f32 best_score, f32 score_offset, f32 score_min) {
+    u32 mask = 0;
+    for (int i = 0; i != n; i++) {
+        const FstArc& arc = arcs[i];
+        if (arc.ilabel > kFstInputEnd) {
+            if (best_score + arc.score + (frame_score[arc.ilabel] + score_offset) >= score_min) {
+                mask |= (1u << i);
+            }
+        }
+    }
+    return mask;
+}
+
+
+static inline u32 EmittingArcMask(const FstArc* arcs, int n, const float* frame_score, f32 best_score, f32 score_offset, f32 score_min) {
+#ifdef __AVX2__
+    if (n == SIO_ARC_BLOCK) {
+        static_assert(sizeof(FstArc) % sizeof(i32) == 0, "FstArc fields need to be 4-bytes gatherable");
+        constexpr int stride = sizeof(FstArc) / sizeof(i32);
+        const __m256i index = _mm256_setr_epi32(0, stride, 2 * stride, 3 * stride, 4 * stride, 5 * stride, 6 * stride, 7 * stride);
+
+        const i32* base = reinterpret_cast<const i32*>(arcs);
+        __m256i ilabel = _mm256_i32gather_epi32(base + offsetof(FstArc, ilabel) / sizeof(i32), index, sizeof(i32));
+        __m256 arc_score = _mm256_i32gather_ps(reinterpret_cast<const f32*>(base + offsetof(FstArc, score) / sizeof(i32)), index, sizeof(f32));
+
+        // special symbols are masked out of acoustic score gathering
+        __m256 emitting = _mm256_castsi256_ps(_mm256_cmpgt_epi32(ilabel, _mm256_set1_epi32(kFstInputEnd)));
+        __m256 am_score = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), frame_score, ilabel, emitting, sizeof(f32));
+
+        __m256 score = _mm256_add_ps(
+            _mm256_add_ps(_mm256_set1_ps(best_score), arc_score),
+            _mm256_add_ps(am_score, _mm256_set1_ps(score_offset))
+        );
+        __m256 survive = _mm256_and_ps(emitting, _mm256_cmp_ps(score, _mm256_set1_ps(score_min), _CMP_GE_OQ));
+
+        return static_cast<u32>(_mm256_movemask_ps(survive));
+    }
+#endif
+    return EmittingArcMaskScalar(arcs, n, frame_score, best_score, score_offset, score_min);
+}
+
+
+/*
+ * Survivor mask of contiguous candidates(e.g. entering arcs of token topology, whose arc scores are 0):
+ *   bit i is set iff best_score + (score[i] + score_offset) >= score_min
+ * n <= SIO_ARC_BLOCK
+ */
+static inline u32 ScoreMaskScalar(const float* score, int n, f32 best_score, f32 score_offset, f32 score_min) {
+    u32 mask = 0;
+    for (int i = 0; i != n; i++) {
+        if (best_score + (score[i] + score_offset) >= score_min) {
+            mask |= (1u << i);
+        }
+    }
+    return mask;
+}
+
+
+static inline u32 ScoreMask(const float* score, int n, f32 best_score, f32 score_offset, f32 score_min) {
+#ifdef __AVX2__
+    if (n == SIO_ARC_BLOCK) {
+        __m256 x = _mm256_add_ps(
+            _mm256_set1_ps(best_score),
+            _mm256_add_ps(_mm256_loadu_ps(score), _mm256_set1_ps(score_offset))
+        );
+        return static_cast<u32>(_mm256_movemask_ps(_mm256_cmp_ps(x, _mm256_set1_ps(score_min), _CMP_GE_OQ)));
+    }
+#endif
+    return ScoreMaskScalar(score, n, best_score, score_offset, score_min);
+}
+
+
+// Token types are templated on number of LMs, so tokens only carry LM slots actually used.
+// Tokens live in a slab arena and refer to each other via 32-bit arena handles, 0 means null.
+using TokenHandle = SlabHandle;
+
+
+// Hot part of a token, touched by token passing, pruning & garbage collection.
+template <int NUM_LMS>
 struct Token {
-    Nullable<Token*> next = nullptr; // nullptr -> last token in a TokenSet
-    //TokenSet* master = nullptr;
+    TokenHandle next = 0; // 0 -> last token in a TokenSet
+    TokenHandle prev = 0; // trace back, 0 -> root of trace backs
 
     f32 total_score = 0.0;
-    LmStateId lm_states[SIO_MAX_LM] = {}; // zero initialized to 0 
-    TraceBack trace_back;
+    std::array<LmStateId, NUM_LMS> lm_states = {}; // zero initialized to 0
+
+    // 0: token is in free list (fresh slabs are zero filled)
+    // otherwise: epoch of its creation, or of the latest marking that reached it
+    u32 gc_stamp = 0;
+};
+
+
+// Cold part of a token, only read when tracing back outputs,
+// kept in a side table indexed by token handle.
+// Arc labels instead of arc id: arcs entering/leaving class graphs are rewritten during search.
+template <int NUM_LMS>
+struct TraceBack {
+    FstLabel ilabel = kFstEps;
+    FstLabel olabel = kFstEps;
+    f32 score = 0.0;
+    std::array<LmScore, NUM_LMS> lm_scores = {}; // zero initialized to 0.0
+    u32 alts = 0; // head of alternative links, 0 -> none
+};
+
+
+// Alternative link of a token: a hypothesis that was recombined into the token(same state & LM context),
+// so it shares the token's future and differs only in its own past, i.e. a lattice arc that lost Viterbi.
+struct AltLink {
+    TokenHandle prev = 0;
+    FstLabel olabel = kFstEps;
+    f32 total_score = 0.0; // score of the recombined hypothesis at the token
+    u32 next = 0;
 };
 
 
 // TokenSet represents a location(time, state handle) in beam search space (sometimes called trellis space),
 // Each TokenSet holds a list of tokens representing search hypotheses
+template <int NUM_LMS>
 struct TokenSet {
-    Nullable<Token*> head = nullptr; // nullptr -> TokenSet pruned or inactive
+    TokenHandle head = 0; // 0 -> TokenSet pruned or inactive
 
     f32 best_score = std::numeric_limits<f32>::lowest();
     int time = 0;
@@ -120,35 +320,215 @@ struct TokenSet {
 };
 
 
-class BeamSearch {
+/*
+ * BeamSearchImpl is specialized at compile time on:
+ *   NUM_LMS: number of LMs carried by tokens, loops over LMs are unrolled
+ *   TOKEN_TOPOLOGY: graph is built-in CTC topology T(no class graphs), multi-graph branches are compiled out
+ * BeamSearch below picks the instantiation at load time.
+ */
+template <int NUM_LMS, bool TOKEN_TOPOLOGY>
+class BeamSearchImpl : public BeamSearchItf {
+    static_assert(NUM_LMS >= 0 && NUM_LMS <= SIO_MAX_LM, "unsupported num of LMs");
+    using Token = sio::Token<NUM_LMS>;
+    using TraceBack = sio::TraceBack<NUM_LMS>;
+    using TokenSet = sio::TokenSet<NUM_LMS>;
+
     BeamSearchConfig config_;
     const Fst* graph_ = nullptr;
+
+    // token topology tables, see Fst::BuildImplicitTokenTopology()
+    vec<TokenId> topo_state_to_token_; // [0]: blk
+    vec<FstStateId> topo_token_to_state_; // 0 for tokens without a state(blk/unk/bos/eos)
+
+    // class graphs attached to current session, entered from nonterminal arcs
+    vec<const Fst*> class_graphs_;
+    hashtab<FstLabel, int> nonterminal_to_class_graph_;
+    vec<GraphContext> contexts_; // [0]: main graph
+    hashtab<std::tuple<int, FstStateId, u32>, u32> context_index_;
     const Tokenizer* tokenizer_ = nullptr;
     vec<LanguageModel> lms_;
+    int context_lm_ = -1; // index of context LM in lms_, -1: context biasing disabled
 
     str session_key_;
 
-    // lattice indexes: [time, token_set_index]
+    // lattice indexes: [time - committed_time_, token_set_index]
     // invariant of time & frame indexing:
     //   {time=k} --[frame=k]--> {time=k+1}
     //   where: k ~ [0, total_frames)
-    vec<vec<TokenSet>> lattice_;
+    // frames before committed_time_ are released by garbage collection.
+    // Token sets of all frames live in a chunked arena kept across sessions, so pinning down a frame doesn't allocate.
+    FrameArena<TokenSet> lattice_;
     SlabAllocator<Token> token_arena_;
+    vec<TraceBack> trace_backs_; // cold part of tokens, indexed by token handle
+    vec<AltLink> alt_links_; // [0]: null, only used by lattice n-best
+    vec<AltLink> alt_links_swap_;
+
+    // garbage collection
+    struct PathNode {
+        TokenHandle token;
+        int time;
+    };
+    u32 gc_epoch_ = 1; // stamp of tokens created in current frame, never reused by markings
+    bool expanding_eps_ = false;
+    vec<TokenHandle> eps_discarded_; // tokens dropped by epsilon closure, freed by FrontierPrune()
+    vec<PathNode> gc_path_;
+    hashtab<TokenHandle, int> gc_join_;
+    vec<TokenHandle> gc_walk_;
+    vec<TokenHandle> gc_alt_walk_;
+
+    int committed_time_ = 0;
+    vec<TokenId> committed_; // outputs shared by all surviving hypotheses, released from lattice
+    int committed_trailing_blank_ = 0; // trailing blank frames of committed path
+    bool committed_speech_ = false; // whether committed path contains non-blank frames
+
+    // best path alignment, committed part is kept by garbage collection, its last output may still grow
+    vec<OutputAlignment> committed_alignment_;
+    f32 committed_pending_score_ = 0.0; // am score of frames after last committed output's end
+    vec<PathNode> align_chain_;
+    vec<OutputAlignment> alignment_;
 
     // search frontier
     int cur_time_ = 0;  // frontier location on time axis
     vec<TokenSet> frontier_;
     hashtab<StateHandle, int> frontier_map_;  // search state handle -> token set index in frontier
+
+    // dense frontier map of main graph states, a slot is valid only if its stamp matches current frame's,
+    // so clearing is O(1). frontier_map_ above then only holds class graph handles.
+    struct DenseMapSlot {
+        u32 stamp = 0;
+        int k = 0;
+    };
+    vec<DenseMapSlot> dense_frontier_map_;
+    u32 dense_frontier_stamp_ = 1;
     vec<int> eps_queue_;
 
+    // token arrays of frontier, see BeamSearchConfig::token_arrays.
+    // Token set k owns slots [k * token_slot_capacity_, +token_slot_sizes_[k]), sorted best first,
+    // a slot mirrors the fields of its token read by token passing, so neither scan touches the token arena.
+    struct TokenSlot {
+        f32 total_score;
+        TokenHandle handle;
+        std::array<LmStateId, NUM_LMS> lm_states;
+    };
+    vec<TokenSlot> token_slots_;
+    vec<int> token_slot_sizes_; // by frontier index
+    int token_slot_capacity_ = 0;
+
+    // best-first epsilon closure: a heap entry is valid only if its version is the latest of its token set,
+    // so a set queued again with a better score keeps a single live entry.
+    struct EpsEntry {
+        f32 score;
+        int k;
+        u32 version;
+        bool operator<(const EpsEntry& other) const { return score < other.score; }
+    };
+    vec<EpsEntry> eps_heap_;
+    vec<u32> eps_version_; // by frontier index
+    vec<u32> eps_expansions_; // by frontier index
+
+    // parallel emitting expansion, see ParallelExpandEmitting()
+    struct ExpandEvent {
+        StateHandle handle = 0; // destination state
+        f32 score = 0.0; // arc probe: best score via arc, token probe: new token's total score
+        f32 prefix_max = 0.0; // max score of chunk's probes before this one
+        u32 seq = 0; // serial order within chunk
+        bool arc = false; // arc probe or token probe
+        Token token;
+        TraceBack trace_back;
+    };
+    struct StagedTokenSet {
+        StateHandle handle = 0;
+        u64 first_arc = 0; // (chunk, seq) of first surviving arc probe, i.e. serial creation order
+        int offset = 0; // into staged tokens
+        int size = 0;
+    };
+    struct StagedToken {
+        Token token;
+        TraceBack trace_back;
+    };
+    struct ExpandOwner { // destination states are owned by workers via hashing
+        hashtab<StateHandle, int> index;
+        vec<StagedTokenSet> sets;
+        vec<StagedToken> tokens;
+    };
+    Unique<ThreadPool*> expand_pool_;
+    vec<vec<vec<ExpandEvent>>> expand_events_; // [chunk][owner]
+    vec<f32> expand_chunk_max_;
+    vec<ExpandOwner> expand_owners_;
+    vec<std::tuple<u64, int, int>> expand_merge_; // (first_arc, owner, staged set)
+
     // beam range
     f32 score_max_ = 0.0;
     f32 score_min_ = 0.0;
-
-    vec<f32> score_offsets_;  // keep hypotheses scores in a good dynamic range
+    f32 score_beam_ = 0.0; // score_max_ - score_min_, kept while beam range is lifted
+
+    // adaptive beam
+    f32 beam_ = 0.0; // effective beam of next frame
+    f32 beam_integral_ = 0.0;
+    f64 beam_tightening_ = 0.0; // sum of (config beam - effective beam) over session frames
+
+    // degradation under RTF budget, see SetDegradation()
+    f32 beam_cap_ = std::numeric_limits<f32>::infinity();
+    i32 max_active_ = 0;
+    int dropped_lm_ = -1; // index of LM skipped by token passing under degradation(context LM), -1: none
+
+    vec<int> histogram_; // token set counts of score buckets, for histogram pruning
+
+    vec<f32> score_offsets_;  // keep hypotheses scores in a good dynamic range, indexed by time - committed_time_ like lattice_
+
+    // frame skipping
+    f32 blank_skip_score_ = 0.0; // log(blank_skip_threshold)
+    TokenId prev_argmax_ = -1;
+    int num_frames_ = 0; // session statistics
+    int num_skipped_frames_ = 0;
+    int frame_eps_reexpansions_ = 0; // token sets expanded more than once by epsilon closure of current frame
+    int num_eps_reexpansions_ = 0;
+
+    // search counters are bumped unconditionally(cheap), folded into reported stats at frame end if config_.stats
+    SearchStats frame_stats_; // of current frame, in progress
+    SearchStats last_frame_stats_;
+    SearchStats session_stats_;
+    vec<SearchStats> frame_stats_histogram_;
+    i64 lm_cache_hits_ = 0; // of LMs, at frame begin
+    i64 lm_cache_misses_ = 0;
 
     vec<vec<TokenId>> nbest_;
 
+    // lattice n-best, see TraceLatticeNBest()
+    struct NBestEntry {
+        f32 score; // total score of the whole path
+        TokenHandle token; // path follows token's trace back below here
+        u32 suffix; // outputs after token
+        bool operator<(const NBestEntry& other) const { return score < other.score; }
+    };
+    struct SuffixNode {
+        TokenId label;
+        u32 next; // later output, 0 -> none
+    };
+    vec<NBestEntry> nbest_queue_;
+    vec<SuffixNode> nbest_suffixes_;
+    hashtab<vec<TokenId>, int> nbest_index_;
+
+    // session snapshot, see Snapshot()
+    struct TokenRecord {
+        u32 prev; // index into records, 0 -> root
+        f32 total_score;
+        std::array<LmStateId, NUM_LMS> lm_states;
+        FstLabel ilabel;
+        FstLabel olabel;
+        f32 score;
+        std::array<LmScore, NUM_LMS> lm_scores;
+        u32 num_alts; // consecutive in alternative link records
+    };
+    struct TokenSetRecord {
+        int time;
+        StateHandle handle;
+        f32 best_score;
+        u32 num_tokens; // consecutive in token list
+    };
+    vec<TokenHandle> snapshot_tokens_; // [0]: null
+    hashtab<TokenHandle, u32> snapshot_index_;
+
 public:
 
     Error Load(const BeamSearchConfig& config, const Fst& graph, const Tokenizer& tokenizer) {
@@ -161,71 +541,145 @@ public:
         tokenizer_ = &tokenizer;
 
         SIO_CHECK(lms_.empty());
-        lms_.resize(1);
-        lms_[0].LoadPrefixTreeLm();
+        lms_.resize(NUM_LMS);
+        int num_lms = 0;
+        if (config_.token_set_size > 1) { // prefix tree LM distinguishes hypotheses of a token set by their output prefixes
+            lms_[num_lms++].LoadPrefixTreeLm();
+        }
+        if (config_.context_biasing) { // secondary, dropped first under degradation
+            context_lm_ = num_lms;
+            lms_[num_lms++].LoadContextLm();
+        }
+        SIO_CHECK_EQ(num_lms, NUM_LMS);
 
-        return Error::OK;
-    }
+        SIO_CHECK(contexts_.empty());
+        contexts_.resize(1);
 
+        lattice_.SetSize(std::max(config_.lattice_chunk_size, config_.max_active * 3));
 
-    Error InitSession(const char* session_key = "default_session") {
-        session_key_ = session_key;
+        if (config_.token_arrays) {
+            token_slot_capacity_ = static_cast<int>(std::ceil(config_.token_set_size)) + 2; // see InsertTokenSlot()
+        }
 
-        SIO_CHECK_EQ(token_arena_.NumUsed(), 0);
-        token_arena_.SetSize(config_.token_allocator_slab_size);
+        if (config_.blank_skip_threshold > 0.0) {
+            blank_skip_score_ = std::log(config_.blank_skip_threshold);
+        }
 
-        SIO_CHECK(lattice_.empty());
-        lattice_.reserve(25 * 30); // 25 frame_rates(subsample = 4) * 30 seconds
+        if (TOKEN_TOPOLOGY) {
+            topo_token_to_state_.resize(tokenizer_->Size(), 0);
+            topo_state_to_token_.push_back(tokenizer_->blk);
+            for (TokenId t = 0; t != tokenizer_->Size(); t++) {
+                if (t == tokenizer_->blk || t == tokenizer_->unk || t == tokenizer_->bos || t == tokenizer_->eos) continue;
+                topo_token_to_state_[t] = topo_state_to_token_.size();
+                topo_state_to_token_.push_back(t);
+            }
+            SIO_CHECK_EQ(graph_->final_state, topo_state_to_token_.size());
+            SIO_CHECK_EQ(graph_->num_states, topo_state_to_token_.size() + 1);
+        }
 
-        SIO_CHECK(frontier_.empty());
-        frontier_.reserve(config_.max_active * 3);
+        if (TOKEN_TOPOLOGY || graph_->num_states <= config_.dense_frontier_map_max_states) {
+            dense_frontier_map_.resize(graph_->num_states);
+        }
 
-        SIO_CHECK(frontier_map_.empty());
-        frontier_map_.reserve(frontier_.capacity() * 2); // presumably 50% load factoer
+        if (!TOKEN_TOPOLOGY && config_.num_expansion_threads > 1) {
+            // replaying serial pruning needs token scores bounded by their arc probes
+            SIO_CHECK_GE(config_.insertion_penalty, 0.0);
+            SIO_CHECK(!config_.context_biasing); // context LM scores can be positive
 
-        if (config_.apply_score_offsets) {
-            SIO_CHECK(score_offsets_.empty());
-            score_offsets_.push_back(0.0);
+            expand_pool_ = std::make_unique<ThreadPool>();
+            expand_pool_->Load(config_.num_expansion_threads);
+
+            int n = config_.num_expansion_threads;
+            expand_events_.assign(n, vec<vec<ExpandEvent>>(n));
+            expand_chunk_max_.resize(n);
+            expand_owners_.resize(n);
         }
 
-        Token* t = NewToken();
-        t->trace_back.arc.ilabel = kFstEps;
-        t->trace_back.arc.olabel = tokenizer_->bos;
+        if (config_.target_active > 0) {
+            SIO_CHECK_LE(config_.min_beam, config_.max_beam);
+        }
 
-        for (int i = 0; i != lms_.size(); i++) {
-            t->total_score += lms_[i].GetScore(lms_[i].NullState(), tokenizer_->bos, &t->lm_states[i]);
+        if (config_.lattice_nbest) {
+            SIO_CHECK(expand_pool_ == nullptr); // staged insertion of parallel expansion keeps no alternative links
         }
 
-        SIO_CHECK_EQ(cur_time_, 0);
-        int k = FindOrAddTokenSet(cur_time_, ComposeStateHandle(0, graph_->start_state));
-        SIO_CHECK_EQ(k, 0);
-        TokenSet& ts = frontier_[0];
+        max_active_ = config_.max_active;
 
-        SIO_CHECK(ts.head == nullptr);
-        ts.head = t;
-        ts.best_score = t->total_score;
+        return Error::OK;
+    }
 
-        score_max_ = ts.best_score;
-        score_min_ = score_max_ - config_.beam;
 
-        FrontierExpandEps();
-        FrontierPinDown();
+    // Attaches a class graph for current session, entered from main graph's nonterminal arcs.
+    // Graph ownership stays outside, it must outlive the session.
+    Error AttachClassGraph(FstLabel nonterminal, const Fst& graph) override {
+        SIO_CHECK(!TOKEN_TOPOLOGY); // token topology has no nonterminal arcs
+        SIO_CHECK(IsNonterminal(nonterminal));
+        SIO_CHECK(!graph.Empty());
+        SIO_CHECK(nonterminal_to_class_graph_.find(nonterminal) == nonterminal_to_class_graph_.end());
 
+        nonterminal_to_class_graph_[nonterminal] = class_graphs_.size();
+        class_graphs_.push_back(&graph);
+
+        return Error::OK;
+    }
+
+
+    Error AttachContextGraph(const ContextGraph& graph) override {
+        SIO_CHECK_GE(context_lm_, 0); // needs config.context_biasing
+        SIO_CHECK_EQ(lattice_.Size(), 0); // between sessions, LM states of tokens refer to graph states
+        return lms_[context_lm_].SetContextGraph(&graph);
+    }
+
+
+    Error InitSession(const char* session_key) override {
+        session_key_ = session_key;
+        num_frames_ = 0;
+        num_skipped_frames_ = 0;
+        num_eps_reexpansions_ = 0;
+
+        frame_stats_ = SearchStats();
+        last_frame_stats_ = SearchStats();
+        session_stats_ = SearchStats();
+        frame_stats_histogram_.assign(config_.stats ? SearchStats::kNumBins : 0, SearchStats());
+
+        beam_ = config_.beam;
+        beam_integral_ = 0.0;
+        beam_tightening_ = 0.0;
+
+        beam_cap_ = std::numeric_limits<f32>::infinity();
+        max_active_ = config_.max_active;
+        dropped_lm_ = -1;
+
+        InitSegment();
         OnSessionBegin();
 
         return Error::OK;
     }
 
 
-    Error Push(const torch::Tensor score) {
+    Error Push(const torch::Tensor score) override {
         SIO_CHECK_EQ(score.dim(), 1); // frame by frame
 
         OnFrameBegin();
         {
-            FrontierExpandEmitting(score.data_ptr<float>());
+            num_frames_++; // skipped frames included, they take a lattice time step too
+            const float* frame_score = score.data_ptr<float>();
+            FstLabel skip_label = SkipLabel(frame_score, score.size(0));
+            if (skip_label == kFstEps) {
+                FrontierExpandEmitting(frame_score);
+            } else {
+                FrontierExpandEmitting(frame_score, skip_label);
+                num_skipped_frames_++;
+            }
             FrontierExpandEps();
+            FrontierLinkTokens();
             FrontierPrune();
             FrontierPinDown();
+            AdaptBeam();
+
+            if (config_.gc_interval > 0 && cur_time_ % config_.gc_interval == 0) {
+                GarbageCollect();
+            }
         }
         OnFrameEnd();
 
@@ -233,313 +687,1716 @@ public:
     }
 
 
-    Error PushEos() {
+    Error PushEos() override {
         FrontierExpandEos();
+        FrontierLinkTokens();
         TraceBestPath();
+        AlignBestPath();
 
         return Error::OK;
     }
 
 
-    const vec<vec<TokenId>>& NBest() {
+    const vec<vec<TokenId>>& NBest() override {
         return nbest_;
     }
 
 
-    Error DeinitSession() {
-        OnSessionEnd();
+    // Alignment of NBest()[0], bos & eos excluded.
+    const vec<OutputAlignment>& BestAlignment() override {
+        return alignment_;
+    }
 
-        cur_time_ = 0;
-        frontier_.clear();
-        frontier_map_.clear();
 
-        lattice_.clear();
-        token_arena_.Clear();
+    // Outputs shared by all surviving hypotheses, they are stable and only grow during a session.
+    const vec<TokenId>& CommittedPath() const override {
+        return committed_;
+    }
 
-        if (config_.apply_score_offsets) {
-            score_offsets_.clear();
-        }
 
-        nbest_.clear();
+    // Outputs of current best hypothesis that follow CommittedPath(),
+    // trace back stops at the committed root, so cost doesn't grow with session length.
+    Error PartialPath(vec<TokenId>* path) const override {
+        SIO_CHECK(path != nullptr);
+        path->clear();
+
+        for (TokenHandle t = lattice_.Back()[0].head; t != 0; t = Tok(t).prev) {
+            if (Trace(t).olabel != kFstEps) {
+                path->push_back(Trace(t).olabel);
+            }
+        }
+        std::reverse(path->begin(), path->end());
 
         return Error::OK;
     }
 
-private:
 
-    inline Token* NewToken(const Token* copy_from = nullptr) {
-        Token* p = token_arena_.Alloc();
-        if (copy_from == nullptr) {
-            new (p) Token(); // placement new via default constructor
-        } else {
-            *p = *copy_from; // POD copy
-        }
-        return p;
+    // num of frames pushed in current session, and those of them skipped
+    int NumFrames() const override { return num_frames_; }
+    int NumSkippedFrames() const override { return num_skipped_frames_; }
+
+    // extra expansions of token sets already expanded by epsilon closure of the same frame, over session
+    int NumEpsReexpansions() const override { return num_eps_reexpansions_; }
+
+
+    // mean of (config beam - effective beam) over frames of session, negative if adaptive beam widened it.
+    // beam capped by degradation counts as tightened too
+    f32 BeamTightening() const override {
+        return num_frames_ == 0 ? 0.0 : beam_tightening_ / num_frames_;
     }
 
 
-    inline void DeleteToken(Token *p) {
-        //p->~Token();
-        token_arena_.Free(p);
+    // num of tokens held by token arena, including those in free list
+    size_t TokenArenaSize() const override {
+        return token_arena_.NumUsed() + token_arena_.NumFree();
     }
 
 
-    inline void ClearTokenSet(TokenSet *ts) {
-        Token* t = ts->head;
-        while (t != nullptr) {
-            Token* next = t->next;
-            DeleteToken(t);
-            t = next;
-        }
-        ts->head = nullptr;
+    // lattice & score offsets both hold frames since committed time
+    size_t NumLatticeFrames() const override {
+        return std::max<size_t>(lattice_.Size(), score_offsets_.size());
     }
 
 
-    inline int FindOrAddTokenSet(int t, StateHandle h) {
-        SIO_CHECK_EQ(cur_time_, t);
+    const SearchStats& FrameStats() const override { return last_frame_stats_; }
+    const SearchStats& SessionStats() const override { return session_stats_; }
+    const vec<SearchStats>& FrameStatsHistogram() const override { return frame_stats_histogram_; }
 
-        int k;
-        auto it = frontier_map_.find(h);
-        if (it == frontier_map_.end()) {
-            TokenSet ts;
-            ts.time = t;
-            ts.handle = h;
 
-            k = frontier_.size();
-            frontier_.push_back(ts);
-            frontier_map_.insert({h, k});
-        } else {
-            k = it->second;
+    // Whether current segment should end, see EndpointConfig for the rules.
+    bool EndpointDetected(const EndpointConfig& config) const override {
+        f32 relative_cost = FinalRelativeCost();
+        if (relative_cost == std::numeric_limits<f32>::infinity()) {
+            return false; // no hypothesis can end here
         }
 
-        return k;
-    }
+        if (cur_time_ >= config.max_segment_length) {
+            return true;
+        }
 
+        bool speech = false;
+        int trailing_blank = TrailingBlankFrames(&speech);
+        if (!speech) {
+            return trailing_blank >= config.max_silence;
+        }
 
-    inline bool ContextEqual(const Token& x, const Token& y) {
-        for (int i = 0; i != lms_.size(); i++) {
-            if (x.lm_states[i] != y.lm_states[i]) {
-                return false;
-            }
+        if (trailing_blank >= config.max_trailing_blank) {
+            return true;
         }
-        return true;
+
+        return trailing_blank >= config.min_trailing_blank && relative_cost <= config.max_relative_cost;
     }
 
 
-    bool TokenPassing(const TokenSet& src, const FstArc& arc, f32 score, TokenSet* dst) {
-        bool changed = false; // dst token set is changed
+    // Ends current segment and starts a new one in the same session:
+    // lattice & token arena are released, attached class graphs are kept.
+    // NBest() of ended segment should be consumed before this.
+    Error ResetSegment() override {
+        DeinitSegment();
+        InitSegment();
 
-        for (const Token* t = src.head; t != nullptr; t = t->next) {
-            // most tokens won't survive pruning and context recombination,
-            // here we use a "new token" on stack for probing, 
-            // and a heap-based copy is created only after its actual survival.
-            Token nt;
+        return Error::OK;
+    }
 
-            // 1. graph & AM score
-            nt.total_score = t->total_score + arc.score + score;
 
-            // 2. LM
-            if (arc.olabel == kFstEps) {
-                memcpy(nt.lm_states, t->lm_states, sizeof(LmStateId) * lms_.size());
-            } else {  /* word-end arc */
-                for (int i = 0; i != lms_.size(); i++) {
-                    LanguageModel& lm = lms_[i];
+    // Level 0 restores full search, see RtfBudgetConfig for what each level gives up.
+    // Takes effect from next frame, hypotheses already in lattice are kept.
+    Error SetDegradation(int level, const RtfBudgetConfig& config) override {
+        SIO_CHECK_GE(level, 0);
+        if (level == 0) {
+            beam_cap_ = std::numeric_limits<f32>::infinity();
+            max_active_ = config_.max_active;
+            dropped_lm_ = -1;
+            return Error::OK;
+        }
 
-                    LmScore& lm_score = nt.trace_back.lm_scores[i];
-                    lm_score = lm.GetScore(t->lm_states[i], arc.olabel, &nt.lm_states[i]);
-                    nt.total_score += lm_score;
-                }
-                nt.total_score -= config_.insertion_penalty;
-            }
+        beam_cap_ = config_.beam * std::pow(config.beam_scale, level);
+        if (config_.max_active > 0) {
+            max_active_ = std::max(1, static_cast<i32>(config_.max_active * std::pow(config.max_active_scale, level)));
+        }
+        // dropped by role: context LM may be the only one, while prefix tree LM is never dropped
+        dropped_lm_ = (level >= config.drop_lm_level) ? context_lm_ : -1;
 
-            // 3. trace back 
-            // this can be moved to back for optimization, keep it here for simplicity
-            nt.trace_back.token = const_cast<Token*>(t);
-            nt.trace_back.arc = arc;
-            nt.trace_back.score = score;
+        return Error::OK;
+    }
 
-            // beam pruning
-            if (nt.total_score < score_min_) {
-                continue;
-            } else if (nt.total_score > score_max_) {  // high enough to lift current beam range
-                score_min_ += (nt.total_score - score_max_);
-                score_max_ = nt.total_score;
-            }
-
-            // context recombination
-            bool survived = true;
-            {
-                int k;
-                Token** p;
-                for (k = 0, p = &dst->head; k < config_.token_set_size && *p != nullptr; k++, p = &(*p)->next) {
-                    if (ContextEqual(**p, nt)) {
-                        if ((*p)->total_score < nt.total_score) {  // existing token is worse, remove it
-                            Token *next = (*p)->next;
-                            DeleteToken(*p);
-                            *p = next;
-
-                            changed = true;
-                        } else {  // existing token is better, kill new token
-                            survived = false;
-                        }
 
-                        break;
-                    }
-                }
+    // Search only continues from the latest frame, so a snapshot holds its token sets and the trace backs
+    // reachable from them(pruned like GarbageCollect() does), token sets of earlier frames are dropped.
+    // Class graphs of the session must be attached in the same order before Restore().
+    // LM states are written as is: prefix tree LM states are hashes of outputs, valid across processes.
+    Error Snapshot(std::ostream& os) override {
+        SIO_CHECK(frontier_.empty()); // between frames
+        SIO_CHECK(nbest_.empty()); // before PushEos()
+
+        using kaldi::WriteToken;
+        using kaldi::WriteBasicType;
+
+        bool binary = true;
+
+        WriteToken(os, binary, "<BeamSearch>");
+        WriteBasicType(os, binary, NUM_LMS);
+        WriteBasicType(os, binary, TOKEN_TOPOLOGY);
+        WriteBasicType(os, binary, graph_->num_states);
+        WriteBasicType(os, binary, static_cast<i32>(class_graphs_.size()));
+        WriteString(os, session_key_);
+
+        WriteToken(os, binary, "<Session>");
+        WriteBasicType(os, binary, num_frames_);
+        WriteBasicType(os, binary, num_skipped_frames_);
+        WriteBasicType(os, binary, num_eps_reexpansions_);
+        WritePodVector(os, vec<SearchStats>{last_frame_stats_, session_stats_});
+        WritePodVector(os, frame_stats_histogram_);
+        WriteBasicType(os, binary, beam_);
+        WriteBasicType(os, binary, beam_integral_);
+        WriteBasicType(os, binary, beam_tightening_);
+        WriteBasicType(os, binary, beam_cap_);
+        WriteBasicType(os, binary, max_active_);
+        WriteBasicType(os, binary, dropped_lm_);
+
+        WriteToken(os, binary, "<Segment>");
+        WriteBasicType(os, binary, cur_time_);
+        WriteBasicType(os, binary, committed_time_);
+        WritePodVector(os, committed_);
+        WriteBasicType(os, binary, committed_trailing_blank_);
+        WriteBasicType(os, binary, committed_speech_);
+        WritePodVector(os, committed_alignment_);
+        WriteBasicType(os, binary, committed_pending_score_);
+        WritePodVector(os, score_offsets_);
+        WriteBasicType(os, binary, score_max_);
+        WriteBasicType(os, binary, score_min_);
+        WriteBasicType(os, binary, score_beam_);
+        WriteBasicType(os, binary, prev_argmax_);
+        WritePodVector(os, contexts_);
+
+        // tokens are renumbered in discovery order from latest frame
+        snapshot_tokens_.assign(1, 0);
+        snapshot_index_.clear();
+        snapshot_index_[0] = 0;
+        vec<TokenSetRecord> sets;
+        vec<u32> set_tokens;
+        for (const TokenSet& ts : lattice_.Back()) {
+            TokenSetRecord r;
+            r.time = ts.time;
+            r.handle = ts.handle;
+            r.best_score = ts.best_score;
+            r.num_tokens = 0;
+            for (TokenHandle t = ts.head; t != 0; t = Tok(t).next) {
+                set_tokens.push_back(SnapshotIndex(t));
+                r.num_tokens++;
             }
+            sets.push_back(r);
+        }
 
-            if (survived) {
-                int k;
-                Token** p;
-                for (k = 0, p = &dst->head; k < config_.token_set_size && *p != nullptr; k++, p = &(*p)->next) {
-                    if ((*p)->total_score <= nt.total_score) {
-                        break;
-                    }
-                }
-
-                if (k != config_.token_set_size) {
-                    Token* q = NewToken(&nt); // actual heap copy to insert
-
-                    q->next = *p;
-                    *p = q;
-
-                    changed = true;
-                }
+        vec<TokenRecord> tokens;
+        vec<AltLink> alts;
+        for (size_t i = 1; i < snapshot_tokens_.size(); i++) { // grows while walking
+            TokenHandle h = snapshot_tokens_[i];
+            const Token& t = Tok(h);
+
+            TokenRecord r;
+            r.prev = SnapshotIndex(t.prev);
+            r.total_score = t.total_score;
+            r.lm_states = t.lm_states;
+            r.ilabel = Trace(h).ilabel;
+            r.olabel = Trace(h).olabel;
+            r.score = Trace(h).score;
+            r.lm_scores = Trace(h).lm_scores;
+            r.num_alts = 0;
+            for (u32 a = Trace(h).alts; a != 0; a = alt_links_[a].next) {
+                AltLink l = alt_links_[a];
+                l.prev = SnapshotIndex(l.prev);
+                l.next = 0;
+                alts.push_back(l);
+                r.num_alts++;
             }
-
-        } // for each token in src token set
-
-        if (changed) {
-            dst->best_score = dst->head->total_score;
+            tokens.push_back(r);
         }
 
-        return changed;
-    }
-
+        WriteToken(os, binary, "<Tokens>");
+        WritePodVector(os, tokens);
+        WritePodVector(os, alts);
 
-    Error FrontierExpandEmitting(const float* frame_score) {
-        SIO_CHECK(frontier_.empty());
+        WriteToken(os, binary, "<Frame>");
+        WritePodVector(os, sets);
+        WritePodVector(os, set_tokens);
 
-        score_max_ -= 1000.0;
-        score_min_ -= 1000.0;
-        cur_time_++; // consumes a time frame
+        return os.good() ? Error::OK : Error::Unknown;
+    }
 
-        f32 score_offset = config_.apply_score_offsets ? score_offsets_.back() : 0.0;
 
-        for (const TokenSet& src : lattice_.back()) {
-            for (auto aiter = graph_->GetArcIterator(HandleToState(src.handle)); !aiter.Done(); aiter.Next()) {
-                const FstArc& arc = aiter.Value();
-                if (arc.ilabel != kFstEps && arc.ilabel != kFstInputEnd) {
-                    f32 score = frame_score[arc.ilabel] + score_offset;
-                    if (src.best_score + arc.score + score < score_min_) continue;
+    Error Restore(std::istream& is) override {
+        using kaldi::ExpectToken;
+        using kaldi::ReadBasicType;
+
+        bool binary = true;
+
+        ExpectToken(is, binary, "<BeamSearch>");
+        int num_lms = 0;
+        ReadBasicType(is, binary, &num_lms);
+        SIO_CHECK_EQ(num_lms, NUM_LMS);
+        bool token_topology = false;
+        ReadBasicType(is, binary, &token_topology);
+        SIO_CHECK_EQ(token_topology, TOKEN_TOPOLOGY);
+        i64 num_states = 0;
+        ReadBasicType(is, binary, &num_states);
+        SIO_CHECK_EQ(num_states, graph_->num_states);
+        i32 num_class_graphs = 0;
+        ReadBasicType(is, binary, &num_class_graphs);
+        SIO_CHECK_EQ(num_class_graphs, class_graphs_.size());
+        str session_key;
+        ReadString(is, &session_key);
+
+        // a fresh session whose initial segment is replaced below
+        InitSession(session_key.c_str());
+        DeinitSegment();
+
+        ExpectToken(is, binary, "<Session>");
+        ReadBasicType(is, binary, &num_frames_);
+        ReadBasicType(is, binary, &num_skipped_frames_);
+        ReadBasicType(is, binary, &num_eps_reexpansions_);
+        vec<SearchStats> stats;
+        ReadPodVector(is, &stats);
+        SIO_CHECK_EQ(stats.size(), 2);
+        last_frame_stats_ = stats[0];
+        session_stats_ = stats[1];
+        ReadPodVector(is, &frame_stats_histogram_);
+        ReadBasicType(is, binary, &beam_);
+        ReadBasicType(is, binary, &beam_integral_);
+        ReadBasicType(is, binary, &beam_tightening_);
+        ReadBasicType(is, binary, &beam_cap_);
+        ReadBasicType(is, binary, &max_active_);
+        ReadBasicType(is, binary, &dropped_lm_);
+
+        ExpectToken(is, binary, "<Segment>");
+        ReadBasicType(is, binary, &cur_time_);
+        ReadBasicType(is, binary, &committed_time_);
+        ReadPodVector(is, &committed_);
+        ReadBasicType(is, binary, &committed_trailing_blank_);
+        ReadBasicType(is, binary, &committed_speech_);
+        ReadPodVector(is, &committed_alignment_);
+        ReadBasicType(is, binary, &committed_pending_score_);
+        ReadPodVector(is, &score_offsets_);
+        ReadBasicType(is, binary, &score_max_);
+        ReadBasicType(is, binary, &score_min_);
+        ReadBasicType(is, binary, &score_beam_);
+        ReadBasicType(is, binary, &prev_argmax_);
+        ReadPodVector(is, &contexts_);
+        context_index_.clear();
+        for (u32 c = 1; c < contexts_.size(); c++) {
+            const GraphContext& x = contexts_[c];
+            context_index_[std::make_tuple(x.graph, x.return_state, x.parent)] = c;
+        }
 
-                    TokenSet& dst = frontier_[
-                        FindOrAddTokenSet(cur_time_, ComposeStateHandle(0, arc.dst))
-                    ];
+        ExpectToken(is, binary, "<Tokens>");
+        vec<TokenRecord> tokens;
+        vec<AltLink> alts;
+        ReadPodVector(is, &tokens);
+        ReadPodVector(is, &alts);
 
-                    TokenPassing(src, arc, score, &dst);
-                }
+        token_arena_.SetSize(config_.token_allocator_slab_size);
+        alt_links_.assign(1, AltLink());
+        gc_epoch_ = 1;
+        snapshot_tokens_.assign(1, 0);
+        for (size_t i = 0; i != tokens.size(); i++) {
+            snapshot_tokens_.push_back(NewToken());
+        }
+        size_t a = 0;
+        for (size_t i = 0; i != tokens.size(); i++) {
+            const TokenRecord& r = tokens[i];
+            TokenHandle h = snapshot_tokens_[i + 1];
+
+            Token& t = Tok(h);
+            t.prev = snapshot_tokens_[r.prev];
+            t.total_score = r.total_score;
+            t.lm_states = r.lm_states;
+
+            TraceBack& tb = Trace(h);
+            tb.ilabel = r.ilabel;
+            tb.olabel = r.olabel;
+            tb.score = r.score;
+            tb.lm_scores = r.lm_scores;
+            for (u32 k = 0; k != r.num_alts; k++, a++) {
+                AltLink l = alts[a];
+                l.prev = snapshot_tokens_[l.prev];
+                l.next = tb.alts;
+                alt_links_.push_back(l);
+                tb.alts = alt_links_.size() - 1;
             }
         }
-        return Error::OK;
-    }
-
-
-    Error FrontierExpandEps() {
-        SIO_CHECK(eps_queue_.empty());
-
-        for (int k = 0; k != frontier_.size(); k++) {
-            if (graph_->ContainEpsilonArc(HandleToState(frontier_[k].handle))) {
-                eps_queue_.push_back(k);
+        gc_epoch_ += 2; // restored tokens belong to past frames
+
+        ExpectToken(is, binary, "<Frame>");
+        vec<TokenSetRecord> sets;
+        vec<u32> set_tokens;
+        ReadPodVector(is, &sets);
+        ReadPodVector(is, &set_tokens);
+
+        // token sets of released frames stay empty, lattice is indexed by time - committed_time_
+        vec<TokenSet> frame;
+        size_t k = 0;
+        for (const TokenSetRecord& r : sets) {
+            TokenSet ts;
+            ts.time = r.time;
+            ts.handle = r.handle;
+            ts.best_score = r.best_score;
+            TokenHandle* p = &ts.head;
+            for (u32 n = 0; n != r.num_tokens; n++, k++) {
+                *p = snapshot_tokens_[set_tokens[k]];
+                p = &Tok(*p).next;
             }
+            *p = 0;
+            frame.push_back(ts);
         }
+        for (int t = committed_time_; t != cur_time_; t++) {
+            lattice_.Push(nullptr, 0);
+        }
+        lattice_.Push(frame);
 
-        while (!eps_queue_.empty()) {
-            int src_k = eps_queue_.back(); eps_queue_.pop_back();
-            const TokenSet& src = frontier_[src_k];
+        return is.good() ? Error::OK : Error::Unknown;
+    }
 
-            if (src.best_score < score_min_) continue;
 
-            for (auto aiter = graph_->GetArcIterator(HandleToState(src.handle)); !aiter.Done(); aiter.Next()) {
-                const FstArc& arc = aiter.Value();
-                if (arc.ilabel == kFstEps) {
-                    if (src.best_score + arc.score < score_min_) continue;
+    Error DeinitSession() override {
+        OnSessionEnd();
 
-                    int dst_k = FindOrAddTokenSet(cur_time_, ComposeStateHandle(0, arc.dst));
-                    TokenSet& dst = frontier_[dst_k];
+        DeinitSegment();
 
-                    bool changed = TokenPassing(src, arc, 0.0, &dst);
+        class_graphs_.clear();
+        nonterminal_to_class_graph_.clear();
+        contexts_.resize(1);
+        context_index_.clear();
 
-                    if (changed && graph_->ContainEpsilonArc(arc.dst)) {
-                        eps_queue_.push_back(dst_k);
-                    }
-                }
-            }
+        if (context_lm_ >= 0) {
+            lms_[context_lm_].SetContextGraph(nullptr);
         }
 
         return Error::OK;
     }
 
+private:
 
-    Error FrontierExpandEos() {
-        SIO_CHECK(frontier_.empty());
+    Error DeinitSegment() {
+        cur_time_ = 0;
+        frontier_.clear();
+        ClearFrontierMap();
 
-        for (const TokenSet& src : lattice_.back()) {
-            for (auto aiter = graph_->GetArcIterator(HandleToState(src.handle)); !aiter.Done(); aiter.Next()) {
-                const FstArc& arc = aiter.Value();
-                if (arc.ilabel == kFstInputEnd) {
-                    TokenSet& dst = frontier_[
-                        FindOrAddTokenSet(cur_time_, ComposeStateHandle(0, arc.dst))
-                    ];
-                    TokenPassing(src, arc, 0.0, &dst);
-                }
-            }
+        lattice_.Clear();
+        token_arena_.Clear();
+        eps_discarded_.clear();
+        trace_backs_.clear();
+        alt_links_.clear();
+        committed_time_ = 0;
+        committed_.clear();
+        committed_trailing_blank_ = 0;
+        committed_speech_ = false;
+
+        committed_alignment_.clear();
+        committed_pending_score_ = 0.0;
+
+        if (config_.apply_score_offsets) {
+            score_offsets_.clear();
         }
 
+        nbest_.clear();
+        alignment_.clear();
+
+        prev_argmax_ = -1;
+
         return Error::OK;
     }
 
 
-    Error FrontierPrune() {
-        auto token_set_better_than = [](const TokenSet& x, const TokenSet& y) -> bool {
-            return (x.best_score != y.best_score) ? (x.best_score > y.best_score) : (x.handle < y.handle);
-        };
+    // Starts a fresh lattice from <s>, for both session begin and segment reset.
+    Error InitSegment() {
+        SIO_CHECK_EQ(token_arena_.NumUsed(), 0);
+        token_arena_.SetSize(config_.token_allocator_slab_size);
 
-        score_min_ = score_max_ - config_.beam;
+        SIO_CHECK_EQ(lattice_.Size(), 0);
+        SIO_CHECK(committed_.empty());
+        SIO_CHECK_EQ(committed_time_, 0);
+        gc_epoch_ = 1;
 
-        // adapt beam regarding to max_active constraint
-        if (config_.max_active > 0 && frontier_.size() > config_.max_active) {
-            std::nth_element(
-                frontier_.begin(),
-                frontier_.begin() + config_.max_active - 1,
-                frontier_.end(),
-                token_set_better_than
-            );
-            frontier_.resize(config_.max_active);
+        SIO_CHECK(alt_links_.empty());
+        alt_links_.push_back(AltLink());
+
+        SIO_CHECK(frontier_.empty());
+        frontier_.reserve(config_.max_active * 3);
+
+        SIO_CHECK(frontier_map_.empty());
+        if (dense_frontier_map_.empty()) {
+            frontier_map_.reserve(frontier_.capacity() * 2); // presumably 50% load factoer
+        }
+
+        if (config_.apply_score_offsets) {
+            SIO_CHECK(score_offsets_.empty());
+            score_offsets_.push_back(0.0);
+        }
+
+        TokenHandle h = NewToken();
+        Trace(h).ilabel = kFstEps;
+        Trace(h).olabel = tokenizer_->bos;
+
+        Token& t = Tok(h);
+        for (int i = 0; i != NUM_LMS; i++) {
+            t.total_score += lms_[i].GetScore(lms_[i].NullState(), tokenizer_->bos, &t.lm_states[i]);
+        }
+
+        SIO_CHECK_EQ(cur_time_, 0);
+        int k = FindOrAddTokenSet(cur_time_, ComposeStateHandle(0, graph_->start_state));
+        SIO_CHECK_EQ(k, 0);
+        TokenSet& ts = frontier_[0];
+
+        SIO_CHECK(ts.head == 0);
+        if (config_.token_arrays) {
+            AppendTokenSlot(k, h);
+        }
+        ts.head = h;
+        ts.best_score = t.total_score;
+
+        score_max_ = ts.best_score;
+        score_beam_ = EffectiveBeam();
+        score_min_ = score_max_ - score_beam_;
+
+        FrontierExpandEps();
+        FrontierLinkTokens();
+        FrontierPinDown();
+
+        return Error::OK;
+    }
+
+
+    // Token references stay valid across NewToken(): slabs never move once allocated.
+    inline Token& Tok(TokenHandle h) { return *token_arena_.Get(h); }
+    inline const Token& Tok(TokenHandle h) const { return *token_arena_.Get(h); }
+
+    // TraceBack references are invalidated by NewToken(), which may grow the side table.
+    inline TraceBack& Trace(TokenHandle h) { return trace_backs_[h]; }
+    inline const TraceBack& Trace(TokenHandle h) const { return trace_backs_[h]; }
+
+
+    inline TokenHandle NewToken(const Token* copy_from = nullptr, const TraceBack* trace_back = nullptr) {
+        TokenHandle h = token_arena_.Alloc();
+        if (SIO_UNLIKELY(h >= trace_backs_.size())) {
+            trace_backs_.resize(token_arena_.Capacity() + 1); // handle 0 is null
+        }
+
+        frame_stats_.tokens++;
+        frame_stats_.arena_high_water = std::max<i64>(frame_stats_.arena_high_water, token_arena_.NumUsed());
+
+        Token* p = token_arena_.Get(h);
+        if (copy_from == nullptr) {
+            new (p) Token(); // placement new via default constructor
+            trace_backs_[h] = TraceBack();
+        } else {
+            *p = *copy_from; // POD copy
+            trace_backs_[h] = *trace_back;
+        }
+        p->gc_stamp = gc_epoch_;
+        return h;
+    }
+
+
+    inline void DeleteToken(TokenHandle h) {
+        Tok(h).gc_stamp = 0;
+        token_arena_.Free(h);
+    }
+
+
+    // Tokens dropped during epsilon closure may already be referenced by
+    // trace backs of their epsilon successors in the same frame,
+    // so they are freed by FrontierPrune() once survivors of the frame are known.
+    inline void DiscardToken(TokenHandle h) {
+        if (expanding_eps_) {
+            eps_discarded_.push_back(h);
+        } else {
+            DeleteToken(h);
+        }
+    }
+
+
+    inline void ClearTokenSet(TokenSet *ts) {
+        TokenHandle t = ts->head;
+        while (t != 0) {
+            TokenHandle next = Tok(t).next;
+            DeleteToken(t);
+            t = next;
+        }
+        ts->head = 0;
+    }
+
+
+    inline int FindOrAddTokenSet(int t, StateHandle h) {
+        SIO_CHECK_EQ(cur_time_, t);
+
+        int k = FindTokenSet(h);
+        if (k < 0) {
+            TokenSet ts;
+            ts.time = t;
+            ts.handle = h;
+
+            k = frontier_.size();
+            frontier_.push_back(ts);
+            MapTokenSet(h, k);
+            frame_stats_.token_sets++;
+
+            if (config_.token_arrays) {
+                token_slot_sizes_.resize(k + 1);
+                token_slot_sizes_[k] = 0;
+                size_t end = static_cast<size_t>(k + 1) * token_slot_capacity_;
+                if (token_slots_.size() < end) { // only grows, so slots are not cleared every frame
+                    token_slots_.resize(std::max(end, token_slots_.size() * 2));
+                }
+            }
+        }
+
+        return k;
+    }
+
+
+    inline bool UseDenseFrontierMap(StateHandle h) const {
+        if (TOKEN_TOPOLOGY) {
+            return true;
+        }
+        return SIO_LIKELY(!dense_frontier_map_.empty()) && HandleToContext(h) == 0;
+    }
+
+
+    // returns token set index in frontier, or -1 if not found
+    inline int FindTokenSet(StateHandle h) const {
+        if (UseDenseFrontierMap(h)) {
+            const DenseMapSlot& slot = dense_frontier_map_[HandleToState(h)];
+            return slot.stamp == dense_frontier_stamp_ ? slot.k : -1;
+        }
+        auto it = frontier_map_.find(h);
+        return it == frontier_map_.end() ? -1 : it->second;
+    }
+
+
+    inline void MapTokenSet(StateHandle h, int k) {
+        if (UseDenseFrontierMap(h)) {
+            DenseMapSlot& slot = dense_frontier_map_[HandleToState(h)];
+            slot.stamp = dense_frontier_stamp_;
+            slot.k = k;
+        } else {
+            frontier_map_.insert({h, k});
+        }
+    }
+
+
+    inline void PrefetchTokenSet(StateHandle h) const {
+        if (UseDenseFrontierMap(h)) {
+            SIO_PREFETCH(&dense_frontier_map_[HandleToState(h)]);
+        } else {
+            frontier_map_.prefetch(h);
+        }
+    }
+
+
+    inline void ClearFrontierMap() {
+        if (!frontier_map_.empty()) {
+            frontier_map_.clear();
+        }
+
+        if (SIO_UNLIKELY(++dense_frontier_stamp_ == 0)) { // wrapped around, stale stamps may collide
+            std::fill(dense_frontier_map_.begin(), dense_frontier_map_.end(), DenseMapSlot());
+            dense_frontier_stamp_ = 1;
+        }
+    }
+
+
+    inline const Fst& GraphOf(StateHandle h) const {
+        if (TOKEN_TOPOLOGY) {
+            return *graph_;
+        }
+        u32 c = HandleToContext(h);
+        return SIO_LIKELY(c == 0) ? *graph_ : *class_graphs_[contexts_[c].graph];
+    }
+
+
+    // Whether epsilon closure needs to expand a state:
+    // class graph states also return to parent context via their kFstInputEnd arcs.
+    inline bool ContainNonEmittingArc(StateHandle h) const {
+        FstStateId s = HandleToState(h);
+        if (TOKEN_TOPOLOGY) { // leaving arcs of token states
+            return s != graph_->start_state && s != graph_->final_state;
+        }
+        const Fst& g = GraphOf(h);
+        return g.ContainEpsilonArc(s) || (HandleToContext(h) != 0 && g.ContainInputEndArc(s));
+    }
+
+
+    // Returns handle of class graph's start state, or 0 if nonterminal is not attached(or nested too deep).
+    // handle 0 is main graph's start state, which is never entered via nonterminal.
+    StateHandle EnterClassGraph(StateHandle h, const FstArc& arc) {
+        auto it = nonterminal_to_class_graph_.find(arc.olabel);
+        if (it == nonterminal_to_class_graph_.end()) {
+            return 0;
+        }
+
+        u32 parent = HandleToContext(h);
+        if (contexts_[parent].depth == SIO_MAX_GRAPH_DEPTH) {
+            return 0;
+        }
+
+        int graph = it->second;
+        auto res = context_index_.insert({std::make_tuple(graph, arc.dst, parent), contexts_.size()});
+        if (res.second) {
+            GraphContext c;
+            c.graph = graph;
+            c.return_state = arc.dst;
+            c.parent = parent;
+            c.depth = contexts_[parent].depth + 1;
+            contexts_.push_back(c);
+        }
+
+        return ComposeStateHandle(res.first->second, class_graphs_[graph]->start_state);
+    }
+
+
+    // Blank frames at the end of current best path.
+    // speech: whether the best path contains any non-blank frame.
+    int TrailingBlankFrames(bool* speech) const {
+        int n = 0;
+        for (TokenHandle t = lattice_.Back()[0].head; t != 0; t = Tok(t).prev) {
+            FstLabel ilabel = Trace(t).ilabel;
+            if (ilabel == kFstEps || ilabel == kFstInputEnd) continue;
+            if (ilabel != tokenizer_->blk) {
+                *speech = true;
+                return n;
+            }
+            n++;
+        }
+        *speech = committed_speech_;
+        return n + committed_trailing_blank_;
+    }
+
+
+    // Score gap between the best hypothesis and the best one that can end here(via kFstInputEnd arc of main graph).
+    f32 FinalRelativeCost() const {
+        f32 best_final = -std::numeric_limits<f32>::infinity();
+        for (const TokenSet& ts : lattice_.Back()) {
+            bool can_end = TOKEN_TOPOLOGY ?
+                HandleToState(ts.handle) == graph_->start_state :
+                HandleToContext(ts.handle) == 0 && graph_->ContainInputEndArc(HandleToState(ts.handle));
+            if (can_end) {
+                best_final = std::max(best_final, ts.best_score);
+            }
+        }
+        return lattice_.Back()[0].best_score - best_final;
+    }
+
+
+    // x, y: Token or TokenSlot
+    template <typename X, typename Y>
+    inline bool ContextEqual(const X& x, const Y& y) {
+        for (int i = 0; i != NUM_LMS; i++) {
+            if (x.lm_states[i] != y.lm_states[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+
+    // Upper bound of LM & insertion scores an arc can add to any token(LM lookahead), +inf if disabled.
+    inline f32 LmBound(const FstArc& arc) const {
+        if (!config_.lm_lookahead) {
+            return std::numeric_limits<f32>::infinity();
+        }
+        f32 lm_bound = 0.0;
+        if (arc.olabel != kFstEps) {
+            for (int i = 0; i != NUM_LMS; i++) {
+                if (i != dropped_lm_) {
+                    lm_bound += lms_[i].ScoreUpperBound(arc.olabel);
+                }
+            }
+            lm_bound -= config_.insertion_penalty;
+        }
+        return lm_bound;
+    }
+
+
+    // New token of passing token t(handle th) through arc, not yet inserted anywhere, t: Token or TokenSlot.
+    template <typename T>
+    inline void ProbeToken(const T& t, TokenHandle th, const FstArc& arc, f32 score, Token* nt, TraceBack* ntb) {
+        // 1. graph & AM score
+        nt->total_score = t.total_score + arc.score + score;
+
+        // 2. LM, dropped LMs keep their states
+        nt->lm_states = t.lm_states;
+        if (arc.olabel != kFstEps) {  /* word-end arc */
+            for (int i = 0; i != NUM_LMS; i++) {
+                if (i == dropped_lm_) {
+                    continue;
+                }
+                LanguageModel& lm = lms_[i];
+
+                LmScore& lm_score = ntb->lm_scores[i];
+                lm_score = lm.GetScore(t.lm_states[i], arc.olabel, &nt->lm_states[i]);
+                nt->total_score += lm_score;
+            }
+            nt->total_score -= config_.insertion_penalty;
+        }
+
+        // 3. trace back
+        nt->prev = th;
+        ntb->ilabel = arc.ilabel;
+        ntb->olabel = arc.olabel;
+        ntb->score = score;
+    }
+
+
+    inline void LiftBeam(f32 score) {
+        score_max_ = score;
+        score_min_ = score_max_ - score_beam_;
+    }
+
+
+    // src_k: frontier index of src if it is a token set of current frame(epsilon closure), -1 otherwise
+    bool TokenPassing(const TokenSet& src, const FstArc& arc, f32 score, TokenSet* dst, int src_k = -1) {
+        bool changed = false; // dst token set is changed
+
+        f32 lm_bound = LmBound(arc);
+
+        // returns false once t's bound misses the beam:
+        // source tokens are sorted best first and score_min_ only rises,
+        // so all the rest miss it too, and none of them costs an LM query.
+        auto pass = [&](const auto& t, TokenHandle th) -> bool {
+            if (t.total_score + arc.score + score + lm_bound < score_min_) {
+                return false;
+            }
+
+            // most tokens won't survive pruning and context recombination,
+            // here we use a "new token" on stack for probing, 
+            // and a heap-based copy is created only after its actual survival.
+            Token nt;
+            TraceBack ntb;
+            ProbeToken(t, th, arc, score, &nt, &ntb);
+            if (arc.olabel != kFstEps) {
+                frame_stats_.lm_queries += NUM_LMS - (dropped_lm_ >= 0 ? 1 : 0);
+            }
+
+            // beam pruning
+            if (nt.total_score < score_min_) {
+                frame_stats_.beam_pruned++;
+                return true;
+            } else if (nt.total_score > score_max_) {  // high enough to lift current beam range
+                LiftBeam(nt.total_score);
+            }
+
+            changed |= InsertToken(nt, ntb, dst);
+            return true;
+        };
+
+        if (config_.token_arrays && src_k >= 0) {
+            const TokenSlot* slots = TokenSlots(src_k);
+            int n = token_slot_sizes_[src_k];
+            int i = 0;
+            while (i != n && pass(slots[i], slots[i].handle)) {
+                i++;
+            }
+            frame_stats_.beam_pruned += config_.stats ? n - i : 0;
+        } else {
+            TokenHandle th = src.head;
+            while (th != 0 && pass(Tok(th), th)) {
+                th = Tok(th).next;
+            }
+            if (config_.stats) {
+                for (; th != 0; th = Tok(th).next) {
+                    frame_stats_.beam_pruned++;
+                }
+            }
+        }
+
+        if (changed) {
+            dst->best_score = Tok(dst->head).total_score;
+        }
+
+        return changed;
+    }
+
+
+    // Context recombination & insertion into a token set sorted best first, capped by token_set_size.
+    bool InsertToken(const Token& nt, const TraceBack& ntb, TokenSet* dst) {
+        if (config_.token_arrays) {
+            return InsertTokenSlot(nt, ntb, dst);
+        }
+
+        bool changed = false;
+
+        // context recombination
+        bool survived = true;
+        u32 alts = 0; // alternative links of new token
+        {
+            int k;
+            TokenHandle* p;
+            for (k = 0, p = &dst->head; k < config_.token_set_size && *p != 0; k++, p = &Tok(*p).next) {
+                if (ContextEqual(Tok(*p), nt)) {
+                    frame_stats_.recombined++;
+                    if (Tok(*p).total_score < nt.total_score) {  // existing token is worse, remove it
+                        if (config_.lattice_nbest) { // it becomes an alternative of new token, along with its own ones
+                            alts = AddAltLink(Tok(*p), Trace(*p), Trace(*p).alts);
+                        }
+                        TokenHandle next = Tok(*p).next;
+                        DiscardToken(*p);
+                        *p = next;
+
+                        changed = true;
+                    } else {  // existing token is better, kill new token
+                        if (config_.lattice_nbest) {
+                            Trace(*p).alts = AddAltLink(nt, ntb, Trace(*p).alts);
+                        }
+                        survived = false;
+                    }
+
+                    break;
+                }
+            }
+        }
+
+        if (survived) {
+            int k;
+            TokenHandle* p;
+            for (k = 0, p = &dst->head; k < config_.token_set_size && *p != 0; k++, p = &Tok(*p).next) {
+                if (Tok(*p).total_score <= nt.total_score) {
+                    break;
+                }
+            }
+
+            if (k != config_.token_set_size) {
+                TokenHandle q = NewToken(&nt, &ntb); // actual arena copy to insert
+                Trace(q).alts = alts;
+
+                Tok(q).next = *p;
+                *p = q;
+
+                // tokens pushed beyond token_set_size are dropped
+                for (k++, p = &Tok(q).next; k < config_.token_set_size && *p != 0; k++, p = &Tok(*p).next) { }
+                while (*p != 0) {
+                    TokenHandle next = Tok(*p).next;
+                    DiscardToken(*p);
+                    *p = next;
+                }
+
+                changed = true;
+            }
+        }
+
+        return changed;
+    }
+
+
+    // Same recombination & insertion as InsertToken(), over the token array of dst, see BeamSearchConfig::token_arrays.
+    // Comparisons against token_set_size are kept as is, so an array may hold ceil(token_set_size) + 1 tokens,
+    // plus one slot for shifting.
+    bool InsertTokenSlot(const Token& nt, const TraceBack& ntb, TokenSet* dst) {
+        bool changed = false;
+
+        int s = dst - frontier_.data();
+        TokenSlot* slots = TokenSlots(s);
+        int& n = token_slot_sizes_[s];
+
+        // context recombination
+        u32 alts = 0; // alternative links of new token
+        int k;
+        for (k = 0; k < config_.token_set_size && k < n; k++) {
+            if (ContextEqual(slots[k], nt)) {
+                frame_stats_.recombined++;
+                TokenHandle h = slots[k].handle;
+                if (slots[k].total_score < nt.total_score) {  // existing token is worse, remove it
+                    if (config_.lattice_nbest) {
+                        alts = AddAltLink(Tok(h), Trace(h), Trace(h).alts);
+                    }
+                    DiscardToken(h);
+                    std::copy(slots + k + 1, slots + n, slots + k);
+                    n--;
+
+                    changed = true;
+                } else {  // existing token is better, kill new token
+                    if (config_.lattice_nbest) {
+                        Trace(h).alts = AddAltLink(nt, ntb, Trace(h).alts);
+                    }
+                    return false;
+                }
+
+                break;
+            }
+        }
+
+        for (k = 0; k < config_.token_set_size && k < n; k++) {
+            if (slots[k].total_score <= nt.total_score) {
+                break;
+            }
+        }
+
+        if (k != config_.token_set_size) {
+            TokenHandle h = NewToken(&nt, &ntb); // actual arena copy to insert
+            Trace(h).alts = alts;
+
+            std::copy_backward(slots + k, slots + n, slots + n + 1);
+            slots[k] = MakeTokenSlot(nt, h);
+            n++;
+
+            // tokens pushed beyond token_set_size are dropped
+            for (k++; k < config_.token_set_size && k < n; k++) { }
+            for (int i = k; i != n; i++) {
+                DiscardToken(slots[i].handle);
+            }
+            n = k;
+
+            changed = true;
+        }
+
+        if (changed) {
+            dst->head = (n != 0) ? slots[0].handle : 0; // unlinked until FrontierLinkTokens()
+        }
+
+        return changed;
+    }
+
+
+    inline TokenSlot* TokenSlots(int k) {
+        return token_slots_.data() + static_cast<size_t>(k) * token_slot_capacity_;
+    }
+
+
+    static inline TokenSlot MakeTokenSlot(const Token& t, TokenHandle h) {
+        TokenSlot slot;
+        slot.total_score = t.total_score;
+        slot.handle = h;
+        slot.lm_states = t.lm_states;
+        return slot;
+    }
+
+
+    // Appends token h to the array of frontier token set k, tokens are appended best first.
+    inline void AppendTokenSlot(int k, TokenHandle h) {
+        TokenSlots(k)[token_slot_sizes_[k]++] = MakeTokenSlot(Tok(h), h);
+    }
+
+
+    // Links token arrays of frontier into token lists, the layout of pruning, lattice & trace back.
+    void FrontierLinkTokens() {
+        if (!config_.token_arrays) {
+            return;
+        }
+
+        for (int k = 0; k != frontier_.size(); k++) {
+            const TokenSlot* slots = TokenSlots(k);
+            TokenHandle next = 0;
+            for (int i = token_slot_sizes_[k] - 1; i >= 0; i--) {
+                Tok(slots[i].handle).next = next;
+                next = slots[i].handle;
+            }
+            frontier_[k].head = next;
+        }
+        token_slot_sizes_.clear();
+    }
+
+
+    // Returns head of alternative links after prepending one for hypothesis t.
+    inline u32 AddAltLink(const Token& t, const TraceBack& tb, u32 next) {
+        AltLink l;
+        l.prev = t.prev;
+        l.olabel = tb.olabel;
+        l.total_score = t.total_score;
+        l.next = next;
+
+        alt_links_.push_back(l);
+        return alt_links_.size() - 1;
+    }
+
+
+    // Returns the only label to expand for a skippable frame, or kFstEps for a frame needing full expansion.
+    // Skipped frames still go through the same expansion, pruning and score accounting,
+    // but only over arcs of the dominant label, located via binary search instead of scanning all arcs.
+    FstLabel SkipLabel(const float* frame_score, int dim) {
+        if (config_.blank_skip_threshold > 0.0 && frame_score[tokenizer_->blk] > blank_skip_score_) {
+            prev_argmax_ = tokenizer_->blk;
+            return tokenizer_->blk;
+        }
+
+        if (!config_.repeat_skip) {
+            return kFstEps;
+        }
+
+        TokenId argmax = std::max_element(frame_score, frame_score + dim) - frame_score;
+        bool repeat = (argmax == prev_argmax_ && argmax != tokenizer_->blk);
+        prev_argmax_ = argmax;
+
+        return repeat ? argmax : kFstEps;
+    }
+
+
+    // ilabel: restricts expansion to arcs of given input label, kFstEps means all emitting arcs.
+    Error FrontierExpandEmitting(const float* frame_score, FstLabel ilabel = kFstEps) {
+        SIO_CHECK(frontier_.empty());
+
+        score_max_ -= 1000.0;
+        score_min_ = score_max_ - score_beam_;
+        cur_time_++; // consumes a time frame
+
+        f32 score_offset = config_.apply_score_offsets ? score_offsets_.back() : 0.0;
+
+        if (TOKEN_TOPOLOGY) {
+            return TopoExpandEmitting(frame_score, ilabel, score_offset);
+        }
+
+        if (expand_pool_ != nullptr && ilabel == kFstEps) {
+            return ParallelExpandEmitting(frame_score, score_offset);
+        }
+
+        const auto frame = lattice_.Back();
+        for (int k = 0; k != frame.size(); k++) {
+            const TokenSet& src = frame[k];
+            if (k + 1 != frame.size()) {
+                PrefetchArcs(frame[k + 1].handle);
+            }
+
+            u32 context = HandleToContext(src.handle);
+            const Fst& graph = GraphOf(src.handle);
+            FstStateId state = HandleToState(src.handle);
+
+            if (ilabel != kFstEps) { // restricted expansion, only a few arcs
+                for (auto aiter = graph.GetArcIterator(state, ilabel); !aiter.Done(); aiter.Next()) {
+                    const FstArc& arc = aiter.Value();
+                    f32 score = frame_score[arc.ilabel] + score_offset;
+                    if (src.best_score + arc.score + score < score_min_) continue;
+
+                    TokenSet& dst = frontier_[
+                        FindOrAddTokenSet(cur_time_, ComposeStateHandle(context, arc.dst))
+                    ];
+
+                    TokenPassing(src, arc, score, &dst);
+                }
+                continue;
+            }
+
+            // survivors of each arc block are computed in bulk, then their frontier slots are prefetched before passing tokens
+            const FstArc* arcs = graph.arcs.data() + graph.states[state].offset;
+            int num_arcs = graph.states[state + 1].offset - graph.states[state].offset;
+            for (int i = 0; i < num_arcs; i += SIO_ARC_BLOCK) {
+                u32 mask = EmittingArcMask(
+                    arcs + i, std::min(SIO_ARC_BLOCK, num_arcs - i),
+                    frame_score, src.best_score, score_offset, score_min_
+                );
+
+                for (u32 m = mask; m != 0; m &= m - 1) {
+                    PrefetchTokenSet(ComposeStateHandle(context, arcs[i + __builtin_ctz(m)].dst));
+                }
+
+                for (; mask != 0; mask &= mask - 1) {
+                    const FstArc& arc = arcs[i + __builtin_ctz(mask)];
+                    f32 score = frame_score[arc.ilabel] + score_offset;
+
+                    TokenSet& dst = frontier_[
+                        FindOrAddTokenSet(cur_time_, ComposeStateHandle(context, arc.dst))
+                    ];
+
+                    TokenPassing(src, arc, score, &dst);
+                }
+            }
+        }
+        return Error::OK;
+    }
+
+
+    /*
+     * Emitting expansion across threads, the result is identical to serial FrontierExpandEmitting().
+     *
+     * Serial expansion prunes by a running beam: a probe survives iff its score >= M - score_beam_,
+     * M being the max of score_max_ and all token probe scores before it in serial order.
+     * Probes skipped by serial pruning can't exceed M, so M only depends on scores of an ordered sequence,
+     * which is replayed in three steps:
+     *   1. source token sets are split into contiguous chunks, each worker probes one chunk's arcs & tokens,
+     *      pruned by its chunk-local running max(a lower bound of M, so probes are a superset of serial ones),
+     *      probes are recorded with their chunk-local prefix max and bucketed by owner of destination state.
+     *   2. M of a probe = max(chunk-local prefix max, max of preceding chunks), so each owner replays serial
+     *      pruning and token set insertion exactly, visiting its buckets in chunk order.
+     *   3. staged token sets are merged into frontier in serial creation order, tokens get arena copies.
+     */
+    Error ParallelExpandEmitting(const float* frame_score, f32 score_offset) {
+        int n = expand_pool_->Size();
+
+        std::function<void(int)> probe = [&](int c) { ProbeChunk(c, frame_score, score_offset); };
+        expand_pool_->Run(probe);
+
+        std::function<void(int)> replay = [&](int o) { ReplayOwner(o); };
+        expand_pool_->Run(replay);
+
+        expand_merge_.clear();
+        for (int o = 0; o != n; o++) {
+            for (int i = 0; i != expand_owners_[o].sets.size(); i++) {
+                expand_merge_.emplace_back(expand_owners_[o].sets[i].first_arc, o, i);
+            }
+        }
+        std::sort(expand_merge_.begin(), expand_merge_.end());
+
+        for (const auto& m : expand_merge_) {
+            const ExpandOwner& w = expand_owners_[std::get<1>(m)];
+            const StagedTokenSet& s = w.sets[std::get<2>(m)];
+
+            int k = FindOrAddTokenSet(cur_time_, s.handle);
+            TokenSet& ts = frontier_[k];
+            if (config_.token_arrays) {
+                for (int i = 0; i != s.size; i++) {
+                    const StagedToken& st = w.tokens[s.offset + i];
+                    AppendTokenSlot(k, NewToken(&st.token, &st.trace_back));
+                }
+                ts.head = (s.size > 0) ? TokenSlots(k)[0].handle : 0;
+            } else {
+                for (int i = s.size - 1; i >= 0; i--) {
+                    const StagedToken& st = w.tokens[s.offset + i];
+                    TokenHandle h = NewToken(&st.token, &st.trace_back);
+                    Tok(h).next = ts.head;
+                    ts.head = h;
+                }
+            }
+            if (s.size > 0) {
+                ts.best_score = Tok(ts.head).total_score;
+            }
+        }
+
+        for (int c = 0; c != n; c++) {
+            if (expand_chunk_max_[c] > score_max_) {
+                LiftBeam(expand_chunk_max_[c]);
+            }
+        }
+
+        return Error::OK;
+    }
+
+
+    inline int ExpandOwnerOf(StateHandle h) const {
+        return static_cast<int>(((h * 0x9E3779B97F4A7C15ull) >> 32) % expand_pool_->Size());
+    }
+
+
+    // Step 1 of ParallelExpandEmitting(), mirrors loops of FrontierExpandEmitting().
+    void ProbeChunk(int c, const float* frame_score, f32 score_offset) {
+        const auto frame = lattice_.Back();
+        int n = expand_pool_->Size();
+        int begin = frame.size() * c / n;
+        int end = frame.size() * (c + 1) / n;
+
+        vec<vec<ExpandEvent>>& buckets = expand_events_[c];
+        for (auto& b : buckets) {
+            b.clear();
+        }
+
+        f32 prefix_max = score_max_;
+        u32 seq = 0;
+        for (int k = begin; k != end; k++) {
+            const TokenSet& src = frame[k];
+            if (k + 1 != end) {
+                PrefetchArcs(frame[k + 1].handle);
+            }
+
+            u32 context = HandleToContext(src.handle);
+            const Fst& graph = GraphOf(src.handle);
+            FstStateId state = HandleToState(src.handle);
+
+            const FstArc* arcs = graph.arcs.data() + graph.states[state].offset;
+            int num_arcs = graph.states[state + 1].offset - graph.states[state].offset;
+            for (int i = 0; i < num_arcs; i += SIO_ARC_BLOCK) {
+                // serial expansion checks a whole block against beam at block start
+                f32 block_max = prefix_max;
+                u32 mask = EmittingArcMask(
+                    arcs + i, std::min(SIO_ARC_BLOCK, num_arcs - i),
+                    frame_score, src.best_score, score_offset, block_max - score_beam_
+                );
+
+                for (; mask != 0; mask &= mask - 1) {
+                    const FstArc& arc = arcs[i + __builtin_ctz(mask)];
+                    f32 score = frame_score[arc.ilabel] + score_offset;
+
+                    ExpandEvent e;
+                    e.handle = ComposeStateHandle(context, arc.dst);
+                    e.score = src.best_score + arc.score + score;
+                    e.prefix_max = block_max;
+                    e.seq = seq++;
+                    e.arc = true;
+
+                    vec<ExpandEvent>& bucket = buckets[ExpandOwnerOf(e.handle)];
+                    bucket.push_back(e);
+
+                    e.arc = false;
+                    f32 lm_bound = LmBound(arc);
+                    for (TokenHandle th = src.head; th != 0; th = Tok(th).next) {
+                        const Token& t = Tok(th);
+                        if (t.total_score + arc.score + score + lm_bound < prefix_max - score_beam_) {
+                            break;
+                        }
+
+                        e.token = Token();
+                        e.trace_back = TraceBack();
+                        ProbeToken(t, th, arc, score, &e.token, &e.trace_back);
+                        if (e.token.total_score < prefix_max - score_beam_) {
+                            continue;
+                        }
+
+                        e.score = e.token.total_score;
+                        e.prefix_max = prefix_max;
+                        e.seq = seq++;
+                        bucket.push_back(e);
+
+                        prefix_max = std::max(prefix_max, e.score);
+                    }
+                }
+            }
+        }
+
+        expand_chunk_max_[c] = prefix_max;
+    }
+
+
+    // Step 2 of ParallelExpandEmitting(): serial pruning & insertion of owner o's destination states.
+    void ReplayOwner(int o) {
+        ExpandOwner& w = expand_owners_[o];
+        w.index.clear();
+        w.sets.clear();
+        w.tokens.clear();
+
+        int capacity = static_cast<int>(std::ceil(config_.token_set_size)) + 2; // see StagedInsertToken()
+
+        f32 chunk_max = score_max_; // max of preceding chunks
+        for (int c = 0; c != expand_pool_->Size(); c++) {
+            int k = -1; // staged set of current arc, -1 if the arc is pruned
+            for (const ExpandEvent& e : expand_events_[c][o]) {
+                f32 score_min = std::max(chunk_max, e.prefix_max) - score_beam_;
+                if (e.arc) {
+                    k = -1;
+                    if (e.score >= score_min) {
+                        auto res = w.index.insert({e.handle, w.sets.size()});
+                        if (res.second) {
+                            StagedTokenSet s;
+                            s.handle = e.handle;
+                            s.first_arc = (static_cast<u64>(c) << 32) | e.seq;
+                            s.offset = w.tokens.size();
+                            w.sets.push_back(s);
+                            w.tokens.resize(w.tokens.size() + capacity);
+                        }
+                        k = res.first->second;
+                    }
+                } else if (k >= 0 && e.score >= score_min) {
+                    StagedInsertToken(e.token, e.trace_back, &w.sets[k], &w.tokens[w.sets[k].offset]);
+                }
+            }
+            chunk_max = std::max(chunk_max, expand_chunk_max_[c]);
+        }
+    }
+
+
+    // Same recombination & insertion as InsertToken(), over a staged array instead of an arena linked list.
+    // Comparisons against token_set_size are kept as is, so array may hold ceil(token_set_size) + 1 tokens,
+    // plus one slot for shifting.
+    void StagedInsertToken(const Token& nt, const TraceBack& ntb, StagedTokenSet* s, StagedToken* tokens) {
+        int k;
+        for (k = 0; k < config_.token_set_size && k < s->size; k++) {
+            if (ContextEqual(tokens[k].token, nt)) {
+                if (tokens[k].token.total_score < nt.total_score) {
+                    std::copy(tokens + k + 1, tokens + s->size, tokens + k);
+                    s->size--;
+                } else {
+                    return;
+                }
+                break;
+            }
+        }
+
+        for (k = 0; k < config_.token_set_size && k < s->size; k++) {
+            if (tokens[k].token.total_score <= nt.total_score) {
+                break;
+            }
+        }
+        if (k == config_.token_set_size) {
+            return;
+        }
+
+        std::copy_backward(tokens + k, tokens + s->size, tokens + s->size + 1);
+        tokens[k].token = nt;
+        tokens[k].trace_back = ntb;
+        s->size++;
+
+        for (k++; k < config_.token_set_size && k < s->size; k++) { }
+        s->size = k;
+    }
+
+
+    inline void PrefetchArcs(StateHandle h) const {
+        if (TOKEN_TOPOLOGY) {
+            return;
+        }
+        const Fst& graph = GraphOf(h);
+        FstStateId s = HandleToState(h);
+        SIO_PREFETCH(graph.arcs.data() + graph.states[s].offset);
+    }
+
+
+    Error FrontierExpandEps() {
+        SIO_CHECK(eps_queue_.empty());
+        expanding_eps_ = true;
+
+        if (TOKEN_TOPOLOGY) {
+            TopoExpandEps();
+            expanding_eps_ = false;
+            return Error::OK;
+        }
+
+        frame_eps_reexpansions_ = 0;
+        eps_version_.assign(frontier_.size(), 0);
+        eps_expansions_.assign(frontier_.size(), 0);
+        for (int k = 0; k != frontier_.size(); k++) {
+            if (ContainNonEmittingArc(frontier_[k].handle)) {
+                PushEps(k);
+            }
+        }
+
+        int src_k;
+        while (PopEps(&src_k)) {
+            const TokenSet src = frontier_[src_k]; // copy, frontier_ may reallocate below
+
+            if (eps_expansions_[src_k]++ != 0) {
+                frame_eps_reexpansions_++;
+            }
+
+            if (src.best_score < score_min_) continue;
+
+            u32 context = HandleToContext(src.handle);
+            for (auto aiter = GraphOf(src.handle).GetArcIterator(HandleToState(src.handle)); !aiter.Done(); aiter.Next()) {
+                FstArc arc = aiter.Value();
+                if (arc.ilabel > kFstInputEnd) break; // arcs are sorted by ilabel, no more non-emitting arcs
+
+                StateHandle dst_handle;
+                if (arc.ilabel == kFstEps && !IsNonterminal(arc.olabel)) {
+                    dst_handle = ComposeStateHandle(context, arc.dst);
+                } else if (arc.ilabel == kFstEps) { // enter class graph
+                    dst_handle = EnterClassGraph(src.handle, arc);
+                    if (dst_handle == 0) continue;
+                    arc.olabel = kFstEps;
+                } else if (context != 0) { // kFstInputEnd of class graph, return to parent context
+                    const GraphContext& c = contexts_[context];
+                    dst_handle = ComposeStateHandle(c.parent, c.return_state);
+                    arc.olabel = kFstEps;
+                } else {
+                    continue;
+                }
+
+                if (src.best_score + arc.score < score_min_) continue;
+
+                int dst_k = FindOrAddTokenSet(cur_time_, dst_handle);
+                TokenSet& dst = frontier_[dst_k];
+
+                bool changed = TokenPassing(src, arc, 0.0, &dst, src_k);
+
+                if (changed && ContainNonEmittingArc(dst_handle)) {
+                    PushEps(dst_k);
+                }
+            }
+        }
+        num_eps_reexpansions_ += frame_eps_reexpansions_;
+
+        expanding_eps_ = false;
+        return Error::OK;
+    }
+
+
+    // Queues a changed token set for epsilon closure, see BeamSearchConfig::best_first_eps.
+    inline void PushEps(int k) {
+        if (k >= eps_version_.size()) { // added during closure
+            eps_version_.resize(frontier_.size(), 0);
+            eps_expansions_.resize(frontier_.size(), 0);
+        }
+
+        if (config_.best_first_eps) {
+            eps_heap_.push_back({frontier_[k].best_score, k, ++eps_version_[k]});
+            std::push_heap(eps_heap_.begin(), eps_heap_.end());
+        } else {
+            eps_queue_.push_back(k);
+        }
+    }
+
+
+    inline bool PopEps(int* k) {
+        if (!config_.best_first_eps) {
+            if (eps_queue_.empty()) {
+                return false;
+            }
+            *k = eps_queue_.back(); eps_queue_.pop_back();
+            return true;
+        }
+
+        while (!eps_heap_.empty()) {
+            std::pop_heap(eps_heap_.begin(), eps_heap_.end());
+            EpsEntry e = eps_heap_.back(); eps_heap_.pop_back();
+            if (e.version == eps_version_[e.k]) {
+                eps_version_[e.k]++; // dequeued, no live entry left
+                *k = e.k;
+                return true;
+            }
+        }
+        return false;
+    }
+
+
+    Error FrontierExpandEos() {
+        SIO_CHECK(frontier_.empty());
+
+        if (TOKEN_TOPOLOGY) {
+            for (const TokenSet& src : lattice_.Back()) {
+                if (HandleToState(src.handle) == graph_->start_state) {
+                    FstArc arc = TopoArc(graph_->start_state, graph_->final_state, kFstInputEnd, tokenizer_->eos);
+                    TokenSet& dst = frontier_[FindOrAddTokenSet(cur_time_, ComposeStateHandle(0, arc.dst))];
+                    TokenPassing(src, arc, 0.0, &dst);
+                }
+            }
+            return Error::OK;
+        }
+
+        for (const TokenSet& src : lattice_.Back()) {
+            if (HandleToContext(src.handle) != 0) continue; // inside an unfinished class graph
+
+            for (auto aiter = graph_->GetArcIterator(HandleToState(src.handle)); !aiter.Done(); aiter.Next()) {
+                const FstArc& arc = aiter.Value();
+                if (arc.ilabel == kFstInputEnd) {
+                    TokenSet& dst = frontier_[
+                        FindOrAddTokenSet(cur_time_, ComposeStateHandle(0, arc.dst))
+                    ];
+                    TokenPassing(src, arc, 0.0, &dst);
+                }
+            }
+        }
+
+        return Error::OK;
+    }
+
+
+    /*
+     * Procedural expansion of token topology T(see Fst::BuildTokenTopology()),
+     * arcs are synthesized from tokenizer instead of being loaded from graph:
+     *   start state: blank self-loop, entering arc of each token, kFstInputEnd arc to final state
+     *   token state: self-loop, epsilon arc leaving to start state
+     */
+    static inline FstArc TopoArc(FstStateId src, FstStateId dst, FstLabel ilabel, FstLabel olabel) {
+        FstArc arc;
+        arc.src = src;
+        arc.dst = dst;
+        arc.ilabel = ilabel;
+        arc.olabel = olabel;
+        return arc;
+    }
+
+
+    inline void TopoPassEmitting(const TokenSet& src, const FstArc& arc, const float* frame_score, f32 score_offset) {
+        f32 score = frame_score[arc.ilabel] + score_offset;
+        if (src.best_score + arc.score + score < score_min_) return;
+
+        TokenSet& dst = frontier_[
+            FindOrAddTokenSet(cur_time_, ComposeStateHandle(0, arc.dst))
+        ];
+        TokenPassing(src, arc, score, &dst);
+    }
+
+
+    Error TopoExpandEmitting(const float* frame_score, FstLabel ilabel, f32 score_offset) {
+        const FstStateId start = graph_->start_state;
+        const TokenId blk = tokenizer_->blk;
+
+        for (const TokenSet& src : lattice_.Back()) {
+            FstStateId s = HandleToState(src.handle);
+            if (s == start) {
+                if (ilabel == kFstEps || ilabel == blk) {
+                    TopoPassEmitting(src, TopoArc(start, start, blk, kFstEps), frame_score, score_offset);
+                }
+
+                if (ilabel == kFstEps) {
+                    // entering arcs are laid out as contiguous frame scores, no arc gathering needed
+                    int dim = tokenizer_->Size();
+                    for (int i = 0; i < dim; i += SIO_ARC_BLOCK) {
+                        u32 mask = ScoreMask(frame_score + i, std::min(SIO_ARC_BLOCK, dim - i), src.best_score, score_offset, score_min_);
+                        for (; mask != 0; mask &= mask - 1) {
+                            TokenId t = i + __builtin_ctz(mask);
+                            FstStateId dst = topo_token_to_state_[t];
+                            if (dst == 0) continue; // blk/unk/bos/eos
+                            TopoPassEmitting(src, TopoArc(start, dst, t, t), frame_score, score_offset);
+                        }
+                    }
+                } else if (ilabel != blk && topo_token_to_state_[ilabel] != 0) {
+                    TopoPassEmitting(src, TopoArc(start, topo_token_to_state_[ilabel], ilabel, ilabel), frame_score, score_offset);
+                }
+            } else if (s != graph_->final_state) {
+                TokenId t = topo_state_to_token_[s];
+                if (ilabel == kFstEps || ilabel == t) {
+                    TopoPassEmitting(src, TopoArc(s, s, t, kFstEps), frame_score, score_offset);
+                }
+            }
+        }
+        return Error::OK;
+    }
+
+
+    // only token states have epsilon arcs, all of them lead to start state, which has no epsilon arc.
+    // token sets are visited backward, the same order as epsilon queue of general graphs.
+    Error TopoExpandEps() {
+        const FstStateId start = graph_->start_state;
+        for (int k = frontier_.size() - 1; k >= 0; k--) {
+            const TokenSet src = frontier_[k]; // copy, frontier_ may reallocate below
+            FstStateId s = HandleToState(src.handle);
+            if (s == start || s == graph_->final_state) continue;
+            if (src.best_score < score_min_) continue;
+
+            TokenSet& dst = frontier_[FindOrAddTokenSet(cur_time_, ComposeStateHandle(0, start))];
+            TokenPassing(src, TopoArc(s, start, kFstEps, kFstEps), 0.0, &dst, k);
+        }
+        return Error::OK;
+    }
+
+
+    Error FrontierPrune() {
+        auto token_set_better_than = [](const TokenSet& x, const TokenSet& y) -> bool {
+            return (x.best_score != y.best_score) ? (x.best_score > y.best_score) : (x.handle < y.handle);
+        };
+
+        score_min_ = score_max_ - EffectiveBeam();
+
+        // adapt beam regarding to max_active constraint
+        int n = frontier_.size(); // num of survived token sets, frontier_[0, n)
+        if (max_active_ > 0 && frontier_.size() > max_active_) {
+            if (config_.histogram_pruning) {
+                f32 cutoff = HistogramCutoff();
+                n = std::partition(frontier_.begin(), frontier_.end(),
+                    [cutoff](const TokenSet& ts) { return ts.best_score >= cutoff; }
+                ) - frontier_.begin();
+                score_min_ = std::max(score_min_, cutoff);
+            } else {
+                std::nth_element(
+                    frontier_.begin(),
+                    frontier_.begin() + max_active_ - 1,
+                    frontier_.end(),
+                    token_set_better_than
+                );
+                n = max_active_;
+                score_min_ = std::max(score_min_, frontier_[n - 1].best_score);
+            }
+        }
+
+        // tokens of pruned token sets and tokens discarded by epsilon closure are freed,
+        // unless they are referenced by trace backs of survived tokens of this frame.
+        if (n != frontier_.size() || !eps_discarded_.empty()) {
+            u32 mark = gc_epoch_ + 1;
+            for (int k = 0; k != n; k++) {
+                for (TokenHandle t = frontier_[k].head; t != 0; t = Tok(t).next) {
+                    gc_walk_.push_back(t);
+                    while (!gc_walk_.empty()) {
+                        TokenHandle p = gc_walk_.back(); gc_walk_.pop_back();
+                        for (; p != 0 && Tok(p).gc_stamp == gc_epoch_; p = Tok(p).prev) {
+                            Tok(p).gc_stamp = mark;
+                            if (config_.lattice_nbest) {
+                                for (u32 i = Trace(p).alts; i != 0; i = alt_links_[i].next) {
+                                    gc_walk_.push_back(alt_links_[i].prev);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            for (int k = n; k != frontier_.size(); k++) {
+                TokenHandle t = frontier_[k].head;
+                while (t != 0) {
+                    TokenHandle next = Tok(t).next;
+                    if (Tok(t).gc_stamp == gc_epoch_) {
+                        DeleteToken(t);
+                    }
+                    t = next;
+                }
+            }
+            for (TokenHandle t : eps_discarded_) {
+                if (Tok(t).gc_stamp == gc_epoch_) {
+                    DeleteToken(t);
+                }
+            }
+            eps_discarded_.clear();
 
-            score_min_ = std::max(score_min_, frontier_.back().best_score);
+            frame_stats_.max_active_pruned += frontier_.size() - n;
+            frontier_.resize(n);
         }
+        gc_epoch_ += 2; // tokens of next frame are stamped with a fresh epoch
 
         // put best TokenSet first so that beam of next frame will be established quickly.
-        std::nth_element(frontier_.begin(), frontier_.begin(), frontier_.end(), token_set_better_than);
+        std::iter_swap(
+            frontier_.begin(),
+            std::min_element(frontier_.begin(), frontier_.end(), token_set_better_than)
+        );
         SIO_CHECK_EQ(frontier_[0].best_score, score_max_);
-        
+        score_beam_ = score_max_ - score_min_;
+
         return Error::OK;
     }
 
 
+    // Histogram pruning: token sets within beam are bucketed by best score in one pass,
+    // cutoff is the lower edge of the bucket where accumulated count reaches max_active.
+    // So survivors can exceed max_active by at most one bucket.
+    f32 HistogramCutoff() {
+        int num_bins = config_.histogram_bins;
+        f32 bin_width = (score_max_ - score_min_) / num_bins;
+
+        histogram_.assign(num_bins, 0);
+        for (const TokenSet& ts : frontier_) {
+            if (ts.best_score >= score_min_) {
+                int b = static_cast<int>((score_max_ - ts.best_score) / bin_width); // 0: best bucket
+                histogram_[std::min(b, num_bins - 1)]++;
+            }
+        }
+
+        int n = 0;
+        for (int b = 0; b != num_bins; b++) {
+            n += histogram_[b];
+            if (n >= max_active_) {
+                return score_max_ - (b + 1) * bin_width;
+            }
+        }
+        return score_min_;
+    }
+
+
+    // PI control of effective beam on frame size, in log domain since active token sets grow ~exponentially with beam.
+    // Integral stops accumulating while output is clamped(anti-windup).
+    void AdaptBeam() {
+        if (config_.target_active > 0) {
+            f32 error = std::log(static_cast<f32>(config_.target_active) / std::max<size_t>(lattice_.Back().size(), 1));
+            beam_integral_ += error;
+
+            f32 beam = config_.beam + config_.beam_kp * error + config_.beam_ki * beam_integral_;
+            if (beam > config_.max_beam || beam < config_.min_beam) {
+                beam_integral_ -= error;
+                beam = std::min(std::max(beam, config_.min_beam), config_.max_beam);
+            }
+            beam_ = beam;
+        }
+        beam_tightening_ += config_.beam - EffectiveBeam();
+    }
+
+
+    // adaptive beam capped by degradation
+    inline f32 EffectiveBeam() const {
+        return std::min(beam_, beam_cap_);
+    }
+
+
     Error FrontierPinDown() {
-        // use "copy" instead of "move", so frontier's capacity() is reserved across frames
-        lattice_.push_back(frontier_);
+        // copied into lattice arena, so frontier's capacity() is reserved across frames
+        lattice_.Push(frontier_);
 
         frontier_.clear();
-        frontier_map_.clear();
+        ClearFrontierMap();
 
         if (config_.apply_score_offsets) {
             score_offsets_.push_back(-score_max_);
         }
 
-        //for (TokenSet& ts : lattice_.back()) {
+        //for (TokenSet& ts : lattice_.Back()) {
         //    for (Token* t = ts.head; t != nullptr; t = t->next) {
         //        t->master = &ts;
         //    }
@@ -553,21 +2410,26 @@ private:
         SIO_CHECK(nbest_.empty());
         SIO_CHECK_EQ(frontier_.size(), 1); // There shoudl be only one final state(K2 convention)
 
-        auto it = frontier_map_.find(ComposeStateHandle(0, graph_->final_state));
-        if (it == frontier_map_.end()) {
+        int final_k = FindTokenSet(ComposeStateHandle(0, graph_->final_state));
+        if (final_k < 0) {
             SIO_WARNING << "No surviving hypothesis reaches to the end, key: " << session_key_;
             return Error::NoRecognitionResult;
         }
 
+        if (config_.lattice_nbest) {
+            return TraceLatticeNBest(frontier_[final_k]);
+        }
+
         int k;
-        Token* p;
-        for (k = 0, p = frontier_[it->second].head; k < config_.nbest && p != nullptr; k++, p = p->next) {
+        TokenHandle p;
+        for (k = 0, p = frontier_[final_k].head; k < config_.nbest && p != 0; k++, p = Tok(p).next) {
             vec<TokenId> path;
-            for(Token* t = p; t != nullptr; t = t->trace_back.token) {
-                if (t->trace_back.arc.olabel != kFstEps) {
-                    path.push_back(t->trace_back.arc.olabel);
+            for(TokenHandle t = p; t != 0; t = Tok(t).prev) {
+                if (Trace(t).olabel != kFstEps) {
+                    path.push_back(Trace(t).olabel);
                 }
             }
+            path.insert(path.end(), committed_.rbegin(), committed_.rend());
             std::reverse(path.begin(), path.end());
 
             nbest_.push_back(std::move(path));
@@ -577,20 +2439,490 @@ private:
     }
 
 
+    /*
+     * A* over lattice, from final tokens backward, yielding paths in score order:
+     *   an entry is a path whose outputs after its token are fixed, and which follows token's trace back below,
+     *   its priority is the exact score of the whole path, since trace back is the best past of a token.
+     * Popping an entry completes a path, and queues its deviations: at each token below entry's token,
+     * replace the token's trace back by one of its alternative links.
+     * Each path is thus queued once, paths of equal outputs(e.g. alignments) are merged into the first one.
+     */
+    Error TraceLatticeNBest(const TokenSet& final) {
+        nbest_queue_.clear();
+        nbest_suffixes_.assign(1, SuffixNode()); // [0]: empty suffix
+        nbest_index_.clear();
+
+        for (TokenHandle t = final.head; t != 0; t = Tok(t).next) {
+            nbest_queue_.push_back({Tok(t).total_score, t, 0});
+        }
+        std::make_heap(nbest_queue_.begin(), nbest_queue_.end());
+
+        for (int n = 0; n != config_.nbest_max_pops && !nbest_queue_.empty() && nbest_.size() < config_.nbest; n++) {
+            std::pop_heap(nbest_queue_.begin(), nbest_queue_.end());
+            NBestEntry e = nbest_queue_.back(); nbest_queue_.pop_back();
+
+            u32 suffix = e.suffix;
+            for (TokenHandle t = e.token; t != 0; t = Tok(t).prev) {
+                for (u32 i = Trace(t).alts; i != 0; i = alt_links_[i].next) {
+                    const AltLink& l = alt_links_[i];
+                    nbest_queue_.push_back({l.total_score + (e.score - Tok(t).total_score), l.prev, ExtendSuffix(suffix, l.olabel)});
+                    std::push_heap(nbest_queue_.begin(), nbest_queue_.end());
+                }
+                suffix = ExtendSuffix(suffix, Trace(t).olabel);
+            }
+
+            vec<TokenId> path = committed_;
+            for (u32 i = suffix; i != 0; i = nbest_suffixes_[i].next) {
+                path.push_back(nbest_suffixes_[i].label);
+            }
+            if (nbest_index_.insert({path, nbest_.size()}).second) {
+                nbest_.push_back(std::move(path));
+            }
+        }
+
+        return Error::OK;
+    }
+
+
+    inline u32 ExtendSuffix(u32 suffix, FstLabel label) {
+        if (label == kFstEps) {
+            return suffix;
+        }
+        nbest_suffixes_.push_back({label, suffix});
+        return nbest_suffixes_.size() - 1;
+    }
+
+
+    inline bool IsEmitting(FstLabel ilabel) const {
+        return ilabel != kFstEps && ilabel != kFstInputEnd;
+    }
+
+
+    // Extends alignment by trace backs from token `last`(at lattice time `time`) back to `stop`(exclusive),
+    // in chronological order. pending: am score of frames after last output's end.
+    void AlignChain(TokenHandle last, TokenHandle stop, int time, vec<OutputAlignment>* items, f32* pending) {
+        align_chain_.clear();
+        for (TokenHandle t = last; t != stop; t = Tok(t).prev) {
+            align_chain_.push_back({t, time});
+            if (IsEmitting(Trace(t).ilabel)) {
+                time--;
+            }
+        }
+
+        for (auto it = align_chain_.rbegin(); it != align_chain_.rend(); ++it) {
+            const TraceBack& tb = Trace(it->token);
+            bool emitting = IsEmitting(tb.ilabel);
+
+            if (tb.olabel != kFstEps && tb.olabel != tokenizer_->bos && tb.olabel != tokenizer_->eos) {
+                OutputAlignment a;
+                a.token = tb.olabel;
+                a.begin_frame = a.end_frame = emitting ? it->time - 1 : it->time;
+                for (int i = 0; i != NUM_LMS; i++) {
+                    a.lm_score += tb.lm_scores[i];
+                }
+                items->push_back(a);
+                *pending = 0.0;
+            }
+
+            if (emitting && !items->empty()) { // frame entering time t is offset by score_offsets_[t]
+                *pending += tb.score - (config_.apply_score_offsets ? score_offsets_[it->time - committed_time_] : 0.0);
+                if (tb.ilabel != tokenizer_->blk) {
+                    items->back().am_score += *pending;
+                    items->back().end_frame = it->time;
+                    *pending = 0.0;
+                }
+            }
+        }
+    }
+
+
+    Error AlignBestPath() {
+        SIO_CHECK(alignment_.empty());
+
+        int final_k = FindTokenSet(ComposeStateHandle(0, graph_->final_state));
+        if (final_k < 0) {
+            return Error::NoRecognitionResult;
+        }
+
+        alignment_ = committed_alignment_;
+        f32 pending = committed_pending_score_;
+        AlignChain(frontier_[final_k].head, 0, cur_time_, &alignment_, &pending);
+
+        for (OutputAlignment& a : alignment_) {
+            a.confidence = std::exp(a.am_score / std::max(a.end_frame - a.begin_frame, 1));
+        }
+
+        return Error::OK;
+    }
+
+
+    // Mark-and-sweep over trace back chains of latest frame:
+    //   1. find where each hypothesis joins the best path,
+    //      the oldest join point is the latest token shared by all hypotheses.
+    //   2. hypotheses joining earlier than lattice_max_frames are dropped.
+    //   3. outputs before shared token are committed, earlier frames are released.
+    //   4. tokens & token sets unreachable from latest frame are returned to arena.
+    // So memory is bounded by uncommitted part of the lattice instead of session length.
+    Error GarbageCollect() {
+        SIO_CHECK(frontier_.empty());
+        auto frame = lattice_.Back();
+
+        gc_path_.clear();
+        gc_join_.clear();
+        int time = cur_time_;
+        for (TokenHandle t = frame[0].head; t != 0; t = Tok(t).prev) {
+            gc_join_[t] = gc_path_.size();
+            gc_path_.push_back({t, time});
+            if (IsEmitting(Trace(t).ilabel)) { // class graph returns(kFstInputEnd) take no frame
+                time--;
+            }
+        }
+
+        for (const TokenSet& ts : frame) {
+            for (TokenHandle t = ts.head; t != 0; t = Tok(t).next) {
+                gc_walk_.clear();
+                TokenHandle p = t;
+                auto it = gc_join_.find(p);
+                while (it == gc_join_.end()) {
+                    gc_walk_.push_back(p);
+                    p = Tok(p).prev;
+                    it = gc_join_.find(p);
+                }
+                int join = it->second;
+                for (TokenHandle q : gc_walk_) {
+                    gc_join_[q] = join;
+                }
+            }
+        }
+
+        int limit = gc_path_.size() - 1;
+        if (config_.lattice_max_frames > 0) {
+            limit = 0;
+            while (limit + 1 < gc_path_.size() && gc_path_[limit + 1].time >= cur_time_ - config_.lattice_max_frames) {
+                limit++;
+            }
+        }
+
+        int shared = 0; // path index of the latest token shared by all surviving hypotheses
+        for (TokenSet& ts : frame) {
+            TokenHandle* p = &ts.head;
+            while (*p != 0) {
+                int join = gc_join_[*p];
+                if (join > limit) { // diverged from best path too long ago
+                    TokenHandle next = Tok(*p).next;
+                    DeleteToken(*p);
+                    *p = next;
+                } else {
+                    shared = std::max(shared, join);
+                    p = &Tok(*p).next;
+                }
+            }
+            if (ts.head != 0) {
+                ts.best_score = Tok(ts.head).total_score;
+            }
+        }
+        lattice_.Shrink(lattice_.Size() - 1,
+            std::remove_if(frame.begin(), frame.end(), [](const TokenSet& ts) { return ts.head == 0; }) - frame.begin()
+        );
+        frame = lattice_.Back();
+
+        u32 mark = gc_epoch_ + 1;
+        gc_epoch_ += 2;
+
+        TokenHandle root = gc_path_[shared].token;
+        Tok(root).gc_stamp = mark;
+        Trace(root).alts = 0; // alternatives of root differ in committed outputs
+        gc_walk_.clear(); // may hold tokens deleted above
+        for (const TokenSet& ts : frame) {
+            for (TokenHandle t = ts.head; t != 0; t = Tok(t).next) {
+                gc_walk_.push_back(t);
+            }
+        }
+        while (!gc_walk_.empty()) {
+            TokenHandle t = gc_walk_.back(); gc_walk_.pop_back();
+            // stop at marked token: its whole trace back (till root) is already marked
+            for (TokenHandle p = t; Tok(p).gc_stamp != mark; p = Tok(p).prev) {
+                Tok(p).gc_stamp = mark;
+                if (config_.lattice_nbest) {
+                    KeepAltLinks(p, shared);
+                }
+            }
+        }
+
+        int root_time = gc_path_[shared].time;
+        AlignChain(
+            Tok(root).prev, 0, root_time - (IsEmitting(Trace(root).ilabel) ? 1 : 0),
+            &committed_alignment_, &committed_pending_score_
+        );
+
+        // shared token becomes the new root of all trace backs
+        size_t n = committed_.size();
+        int trailing_blank = 0;
+        bool speech = false;
+        for (TokenHandle t = Tok(root).prev; t != 0; t = Tok(t).prev) {
+            if (Trace(t).olabel != kFstEps) {
+                committed_.push_back(Trace(t).olabel);
+            }
+            FstLabel ilabel = Trace(t).ilabel;
+            if (!speech && ilabel != kFstEps && ilabel != kFstInputEnd) {
+                if (ilabel == tokenizer_->blk) {
+                    trailing_blank++;
+                } else {
+                    speech = true;
+                }
+            }
+        }
+        committed_trailing_blank_ = speech ? trailing_blank : committed_trailing_blank_ + trailing_blank;
+        committed_speech_ = committed_speech_ || speech;
+        std::reverse(committed_.begin() + n, committed_.end());
+        Tok(root).prev = 0;
+
+        lattice_.PopFront(root_time - committed_time_);
+        if (config_.apply_score_offsets) {
+            score_offsets_.erase(score_offsets_.begin(), score_offsets_.begin() + (root_time - committed_time_));
+        }
+        committed_time_ = root_time;
+
+        for (int f = 0; f < (int)lattice_.Size() - 1; f++) {
+            const auto frame = lattice_[f];
+            for (TokenSet& ts : frame) {
+                TokenHandle* p = &ts.head;
+                while (*p != 0) {
+                    if (Tok(*p).gc_stamp == mark) {
+                        p = &Tok(*p).next;
+                    } else {
+                        *p = Tok(*p).next; // freed by arena sweep below
+                    }
+                }
+                if (ts.head != 0) {
+                    ts.best_score = Tok(ts.head).total_score;
+                }
+            }
+            lattice_.Shrink(f,
+                std::remove_if(frame.begin(), frame.end(), [](const TokenSet& ts) { return ts.head == 0; }) - frame.begin()
+            );
+        }
+
+        token_arena_.ForEachSlot([this, mark](TokenHandle h, Token* t) {
+            if (t->gc_stamp != 0 && t->gc_stamp != mark) {
+                DeleteToken(h);
+            }
+        });
+
+        if (config_.lattice_nbest) { // links of released tokens are dropped from pool
+            alt_links_swap_.assign(1, AltLink());
+            token_arena_.ForEachSlot([this](TokenHandle h, Token* t) {
+                if (t->gc_stamp != 0) {
+                    u32 head = 0;
+                    for (u32 i = Trace(h).alts; i != 0; i = alt_links_[i].next) {
+                        alt_links_swap_.push_back(alt_links_[i]);
+                        alt_links_swap_.back().next = head;
+                        head = alt_links_swap_.size() - 1;
+                    }
+                    Trace(h).alts = head;
+                }
+            });
+            alt_links_.swap(alt_links_swap_);
+        }
+
+        return Error::OK;
+    }
+
+
+    // Unlinks alternatives of token t that don't descend from the shared token(gc path index),
+    // surviving ones are queued for marking.
+    void KeepAltLinks(TokenHandle t, int shared) {
+        u32* p = &Trace(t).alts;
+        while (*p != 0) {
+            const AltLink& l = alt_links_[*p];
+
+            gc_alt_walk_.clear();
+            TokenHandle q = l.prev;
+            auto it = gc_join_.find(q);
+            while (it == gc_join_.end()) {
+                gc_alt_walk_.push_back(q);
+                q = Tok(q).prev;
+                it = gc_join_.find(q);
+            }
+            int join = it->second;
+            for (TokenHandle r : gc_alt_walk_) {
+                gc_join_[r] = join;
+            }
+
+            if (join <= shared) {
+                gc_walk_.push_back(l.prev);
+                p = &alt_links_[*p].next;
+            } else {
+                *p = l.next;
+            }
+        }
+    }
+
+
+    // Index of token in snapshot records, newly seen tokens are appended for writing.
+    u32 SnapshotIndex(TokenHandle h) {
+        auto res = snapshot_index_.insert({h, static_cast<u32>(snapshot_tokens_.size())});
+        if (res.second) {
+            snapshot_tokens_.push_back(h);
+        }
+        return res.first->second;
+    }
+
+
     void OnSessionBegin() { }
-    void OnSessionEnd() { }
-    void OnFrameBegin() { }
+    void OnSessionEnd() {
+        if (config_.debug) {
+            SIO_INFO << "frames: " << num_frames_ << ", skipped: " << num_skipped_frames_
+                     << ", eps re-expansions: " << num_eps_reexpansions_
+                     << ", beam tightening: " << BeamTightening();
+        }
+    }
+    void OnFrameBegin() {
+        frame_stats_ = SearchStats();
+        frame_stats_.arena_high_water = token_arena_.NumUsed(); // raised by NewToken() within frame
+        if (config_.stats) {
+            lm_cache_hits_ = 0;
+            lm_cache_misses_ = 0;
+            for (const LanguageModel& lm : lms_) {
+                lm_cache_hits_ += lm.NumCacheHits();
+                lm_cache_misses_ += lm.NumCacheMisses();
+            }
+        }
+    }
     void OnFrameEnd() {
+        if (config_.stats) {
+            frame_stats_.eps_reexpansions = frame_eps_reexpansions_;
+            for (const LanguageModel& lm : lms_) {
+                frame_stats_.lm_cache_hits += lm.NumCacheHits();
+                frame_stats_.lm_cache_misses += lm.NumCacheMisses();
+            }
+            frame_stats_.lm_cache_hits -= lm_cache_hits_;
+            frame_stats_.lm_cache_misses -= lm_cache_misses_;
+
+            last_frame_stats_ = frame_stats_;
+            session_stats_.Add(frame_stats_);
+            frame_stats_.AddToHistogram(&frame_stats_histogram_);
+        }
         if (config_.debug) {
-            printf("%d\t%f\t%f\t%lu\n",
+            printf("%d\t%f\t%f\t%lu\t%d\n",
                 cur_time_,
                 score_max_,
                 score_max_ - score_min_,
-                lattice_.back().size()
+                lattice_.Back().size(),
+                frame_eps_reexpansions_
             );
         }
     }
 
+}; // class BeamSearchImpl
+
+
+// main purposes of this wrapper class:
+// 1. pick a decoder(BeamSearchImpl specialization from config & graph, CtcPrefixBeamSearch or TransducerBeamSearch) at load time
+// 2. expose it via value semantics, like LanguageModel does for LMs
+class BeamSearch {
+    Unique<BeamSearchItf*> pimpl_;
+
+public:
+
+    Error Load(const BeamSearchConfig& config, const Fst& graph, const Tokenizer& tokenizer) {
+        SIO_CHECK(pimpl_ == nullptr);
+
+        // a prefix tree LM is needed only when a token set holds multiple hypotheses
+        int num_lms = (config.token_set_size > 1 ? 1 : 0) + (config.context_biasing ? 1 : 0);
+        bool token_topology = graph.token_topology;
+
+        if (num_lms == 0) {
+            if (token_topology) {
+                return LoadImpl<0, true>(config, graph, tokenizer);
+            } else {
+                return LoadImpl<0, false>(config, graph, tokenizer);
+            }
+        } else if (num_lms == 1) {
+            if (token_topology) {
+                return LoadImpl<1, true>(config, graph, tokenizer);
+            } else {
+                return LoadImpl<1, false>(config, graph, tokenizer);
+            }
+        } else {
+            if (token_topology) {
+                return LoadImpl<2, true>(config, graph, tokenizer);
+            } else {
+                return LoadImpl<2, false>(config, graph, tokenizer);
+            }
+        }
+    }
+
+
+    // Graph-free CTC prefix beam search, lm is optional and owned outside.
+    Error LoadCtcPrefixBeamSearch(const CtcPrefixBeamSearchConfig& config, const Tokenizer& tokenizer, LanguageModel* lm = nullptr) {
+        SIO_CHECK(pimpl_ == nullptr);
+
+        Unique<CtcPrefixBeamSearch*> impl = std::make_unique<CtcPrefixBeamSearch>();
+        Error err = impl->Load(config, tokenizer, lm);
+
+        pimpl_ = std::move(impl);
+        return err;
+    }
+
+
+    // Transducer beam search, pushed frames are encoder frames. model & lm(optional) are owned outside.
+    Error LoadTransducerBeamSearch(const TransducerBeamSearchConfig& config, TransducerModelItf& model,
+        const Tokenizer& tokenizer, LanguageModel* lm = nullptr)
+    {
+        SIO_CHECK(pimpl_ == nullptr);
+
+        Unique<TransducerBeamSearch*> impl = std::make_unique<TransducerBeamSearch>();
+        Error err = impl->Load(config, model, tokenizer, lm);
+
+        pimpl_ = std::move(impl);
+        return err;
+    }
+
+
+    Error AttachClassGraph(FstLabel nonterminal, const Fst& graph) { return pimpl_->AttachClassGraph(nonterminal, graph); }
+    Error AttachContextGraph(const ContextGraph& graph) { return pimpl_->AttachContextGraph(graph); }
+
+    Error InitSession(const char* session_key = "default_session") { return pimpl_->InitSession(session_key); }
+    Error Push(const torch::Tensor score) { return pimpl_->Push(score); }
+    Error PushEos() { return pimpl_->PushEos(); }
+    Error DeinitSession() { return pimpl_->DeinitSession(); }
+
+    const vec<vec<TokenId>>& NBest() { return pimpl_->NBest(); }
+    const vec<OutputAlignment>& BestAlignment() { return pimpl_->BestAlignment(); }
+    const vec<TokenId>& CommittedPath() const { return pimpl_->CommittedPath(); }
+    Error PartialPath(vec<TokenId>* path) const { return pimpl_->PartialPath(path); }
+
+    bool EndpointDetected(const EndpointConfig& config) const { return pimpl_->EndpointDetected(config); }
+    Error ResetSegment() { return pimpl_->ResetSegment(); }
+
+    Error SetDegradation(int level, const RtfBudgetConfig& config) { return pimpl_->SetDegradation(level, config); }
+
+    Error Snapshot(std::ostream& os) { return pimpl_->Snapshot(os); }
+    Error Restore(std::istream& is) { return pimpl_->Restore(is); }
+
+    int NumFrames() const { return pimpl_->NumFrames(); }
+    int NumSkippedFrames() const { return pimpl_->NumSkippedFrames(); }
+    int NumEpsReexpansions() const { return pimpl_->NumEpsReexpansions(); }
+    f32 BeamTightening() const { return pimpl_->BeamTightening(); }
+    size_t TokenArenaSize() const { return pimpl_->TokenArenaSize(); }
+    size_t NumLatticeFrames() const { return pimpl_->NumLatticeFrames(); }
+
+    const SearchStats& FrameStats() const { return pimpl_->FrameStats(); }
+    const SearchStats& SessionStats() const { return pimpl_->SessionStats(); }
+    const vec<SearchStats>& FrameStatsHistogram() const { return pimpl_->FrameStatsHistogram(); }
+
+private:
+
+    template <int NUM_LMS, bool TOKEN_TOPOLOGY>
+    Error LoadImpl(const BeamSearchConfig& config, const Fst& graph, const Tokenizer& tokenizer) {
+        Unique<BeamSearchImpl<NUM_LMS, TOKEN_TOPOLOGY>*> impl = std::make_unique<BeamSearchImpl<NUM_LMS, TOKEN_TOPOLOGY>>();
+        Error err = impl->Load(config, graph, tokenizer);
+
+        pimpl_ = std::move(impl);
+        return err;
+    }
+
 }; // class BeamSearch
 }  // namespace sio
 #endif
@@ -0,0 +1,184 @@
+#ifndef SIO_BEAM_SEARCH_ITF_H
+#define SIO_BEAM_SEARCH_ITF_H
+
+#include <algorithm>
+#include <istream>
+#include <ostream>
+
+#include <torch/torch.h>
+
+#include "sio/base.h"
+#include "sio/struct_loader.h"
+#include "sio/tokenizer.h"
+#include "sio/finite_state_transducer.h"
+#include "sio/context_graph.h"
+
+namespace sio {
+
+// Rule based endpoint detection, all lengths are in frames of beam search (i.e. after subsampling).
+// An endpoint is detected when any of these rules fires:
+//   1. nothing but blank within max_silence frames
+//   2. speech followed by min_trailing_blank blanks, and best path ends within max_relative_cost of a final state
+//   3. speech followed by max_trailing_blank blanks
+//   4. segment reaches max_segment_length
+struct EndpointConfig {
+    i32 max_silence = 125;
+    i32 min_trailing_blank = 13;
+    f32 max_relative_cost = 4.0;
+    i32 max_trailing_blank = 50;
+    i32 max_segment_length = 1000;
+
+    Error Register(StructLoader* loader, const std::string module = "") {
+        loader->AddEntry(module + ".max_silence", &max_silence);
+        loader->AddEntry(module + ".min_trailing_blank", &min_trailing_blank);
+        loader->AddEntry(module + ".max_relative_cost", &max_relative_cost);
+        loader->AddEntry(module + ".max_trailing_blank", &max_trailing_blank);
+        loader->AddEntry(module + ".max_segment_length", &max_segment_length);
+
+        return Error::OK;
+    }
+};
+
+
+// Real-time-factor budget of a session: wall time of each chunk is charged against budget x chunk's audio duration.
+// When the session lags behind by more than max_lag seconds, the decoder is degraded by one level,
+// and it is restored by one level after restore_chunks consecutive chunks on schedule.
+// At degradation level L:
+//   1. beam is capped at beam x beam_scale^L, max_active at max_active x max_active_scale^L
+//   2. context biasing LM is dropped once L >= drop_lm_level, LMs the search structurally needs are kept
+struct RtfBudgetConfig {
+    f32 budget = 0.0; // target RTF, <= 0 disables it
+    f32 max_lag = 0.2; // seconds
+    i32 max_level = 3;
+    i32 hold_chunks = 5; // min chunks between two degradations
+    i32 restore_chunks = 20;
+
+    f32 beam_scale = 0.8;
+    f32 max_active_scale = 0.5;
+    i32 drop_lm_level = 2;
+
+    Error Register(StructLoader* loader, const std::string module = "") {
+        loader->AddEntry(module + ".budget", &budget);
+        loader->AddEntry(module + ".max_lag", &max_lag);
+        loader->AddEntry(module + ".max_level", &max_level);
+        loader->AddEntry(module + ".hold_chunks", &hold_chunks);
+        loader->AddEntry(module + ".restore_chunks", &restore_chunks);
+
+        loader->AddEntry(module + ".beam_scale", &beam_scale);
+        loader->AddEntry(module + ".max_active_scale", &max_active_scale);
+        loader->AddEntry(module + ".drop_lm_level", &drop_lm_level);
+
+        return Error::OK;
+    }
+};
+
+
+// Alignment of an output on best path, frames are beam search frames of current segment.
+// An output spans from the frame of the arc emitting it to its last non-blank frame before next output,
+// so leading blanks belong to no output and trailing blanks are excluded.
+struct OutputAlignment {
+    TokenId token = kNoTokenId;
+    i32 begin_frame = 0;
+    i32 end_frame = 0; // exclusive
+    f32 am_score = 0.0; // log posterior sum over span
+    f32 lm_score = 0.0; // sum of LM scores of output
+    f32 confidence = 0.0; // exp(mean log posterior over span)
+};
+
+
+// Search counters of a frame or summed over a session, collected when enabled by decoder config.
+struct SearchStats {
+    i64 token_sets = 0; // created
+    i64 tokens = 0; // created
+    i64 beam_pruned = 0; // token passings cut by beam, including those cut by LM lookahead before probing
+    i64 max_active_pruned = 0; // token sets dropped by max_active
+    i64 recombined = 0; // hypotheses merged into a better one of the same LM context
+    i64 eps_reexpansions = 0; // token sets expanded again by epsilon closure
+    i64 lm_queries = 0;
+    i64 lm_cache_hits = 0;
+    i64 lm_cache_misses = 0;
+    i64 arena_high_water = 0; // max tokens alive, max instead of sum over frames
+
+    // Histogram of per-frame counters: bin 0 holds frames counting 0, bin b holds [2^(b-1), 2^b), last bin is open.
+    static constexpr int kNumBins = 24;
+
+    static int Bin(i64 n) {
+        return n <= 0 ? 0 : std::min(kNumBins - 1, 64 - __builtin_clzll(static_cast<u64>(n)));
+    }
+
+
+    void Add(const SearchStats& s) {
+        token_sets += s.token_sets;
+        tokens += s.tokens;
+        beam_pruned += s.beam_pruned;
+        max_active_pruned += s.max_active_pruned;
+        recombined += s.recombined;
+        eps_reexpansions += s.eps_reexpansions;
+        lm_queries += s.lm_queries;
+        lm_cache_hits += s.lm_cache_hits;
+        lm_cache_misses += s.lm_cache_misses;
+        arena_high_water = std::max(arena_high_water, s.arena_high_water);
+    }
+
+
+    // histogram: kNumBins entries, each field counts frames
+    void AddToHistogram(vec<SearchStats>* histogram) const {
+        vec<SearchStats>& h = *histogram;
+        h[Bin(token_sets)].token_sets++;
+        h[Bin(tokens)].tokens++;
+        h[Bin(beam_pruned)].beam_pruned++;
+        h[Bin(max_active_pruned)].max_active_pruned++;
+        h[Bin(recombined)].recombined++;
+        h[Bin(eps_reexpansions)].eps_reexpansions++;
+        h[Bin(lm_queries)].lm_queries++;
+        h[Bin(lm_cache_hits)].lm_cache_hits++;
+        h[Bin(lm_cache_misses)].lm_cache_misses++;
+        h[Bin(arena_high_water)].arena_high_water++;
+    }
+};
+
+
+// Session interface shared by decoders behind BeamSearch wrapper, loading is decoder specific.
+class BeamSearchItf {
+public:
+    virtual Error AttachClassGraph(FstLabel nonterminal, const Fst& graph) = 0;
+    virtual Error AttachContextGraph(const ContextGraph& graph) = 0; // hot phrases of next session
+
+    virtual Error InitSession(const char* session_key) = 0;
+    virtual Error Push(const torch::Tensor score) = 0;
+    virtual Error PushEos() = 0;
+    virtual Error DeinitSession() = 0;
+
+    virtual const vec<vec<TokenId>>& NBest() = 0;
+    virtual const vec<OutputAlignment>& BestAlignment() = 0;
+    virtual const vec<TokenId>& CommittedPath() const = 0;
+    virtual Error PartialPath(vec<TokenId>* path) const = 0;
+
+    virtual bool EndpointDetected(const EndpointConfig& config) const = 0;
+    virtual Error ResetSegment() = 0;
+
+    virtual Error SetDegradation(int level, const RtfBudgetConfig& config) = 0;
+
+    // Session state between two frames, restored by a decoder loaded from the same resources in place of InitSession().
+    virtual Error Snapshot(std::ostream& os) = 0;
+    virtual Error Restore(std::istream& is) = 0;
+
+    // Frames pushed in current session, including skipped ones: they still take a time step of alignments,
+    // so NumFrames() is the frame offset of next segment's alignment, see SpeechToText::AppendAlignment().
+    virtual int NumFrames() const = 0;
+    virtual int NumSkippedFrames() const = 0; // subset of NumFrames()
+    virtual int NumEpsReexpansions() const = 0;
+    virtual f32 BeamTightening() const = 0;
+    virtual size_t TokenArenaSize() const = 0;
+    virtual size_t NumLatticeFrames() const = 0; // frames kept for trace back, not yet released by garbage collection
+
+    // Empty unless stats collection is enabled, of current session until next InitSession().
+    virtual const SearchStats& FrameStats() const = 0; // of last frame
+    virtual const SearchStats& SessionStats() const = 0;
+    virtual const vec<SearchStats>& FrameStatsHistogram() const = 0; // SearchStats::kNumBins entries
+
+    virtual ~BeamSearchItf() { }
+};
+
+} // namespace sio
+#endif
@@ -0,0 +1,1084 @@
+#include "sio/beam_search.h"
+
+#include <chrono>
+#include <random>
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+namespace sio {
+namespace { // seal test helpers in anonymous namespace
+
+// Synthesizes peaky CTC-like log posteriors: blank dominates most frames,
+// a random token wins every few frames.
+class FakeScorer {
+    std::mt19937 rng_;
+    int dim_;
+    int blk_;
+    vec<f32> frame_;
+    f32 noise_floor_;
+
+public:
+    FakeScorer(int dim, int blk, int seed = 777, f32 noise_floor = -30.0) :
+        rng_(seed), dim_(dim), blk_(blk), frame_(dim), noise_floor_(noise_floor) { }
+
+    torch::Tensor Pop() {
+        std::uniform_real_distribution<f32> noise(noise_floor_, noise_floor_ + 10.0);
+        for (int i = 0; i != dim_; i++) {
+            frame_[i] = noise(rng_);
+        }
+
+        if (rng_() % 4 == 0) {
+            frame_[blk_] = -3.0;
+            frame_[rng_() % dim_] = -0.1;
+        } else {
+            frame_[blk_] = -0.1;
+        }
+
+        return torch::from_blob(frame_.data(), {dim_}, torch::kFloat).clone();
+    }
+};
+
+
+// Random HCLG-like graph: every state has a blank self-loop, a few emitting arcs to random states
+// (1/4 of them emit outputs), occasional epsilon arcs, and an arc to final state.
+// eps_per_state > 0 adds that many epsilon arcs with random scores to every state.
+str RandomGraphText(const Tokenizer& tokenizer, int num_states, int arcs_per_state, int seed, int eps_per_state = 0) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<f32> arc_score(-3.0, 0.0);
+    int final_state = num_states - 1;
+
+    std::stringstream arcs;
+    int num_arcs = 0;
+    for (int s = 0; s != final_state; s++) {
+        arcs << s << " " << s << " " << tokenizer.blk << ":" << kFstEps << "/0\n";
+        for (int i = 0; i != arcs_per_state; i++) {
+            TokenId t = 4 + rng() % (tokenizer.Size() - 4); // skip blk, bos, eos, unk
+            arcs << s << " " << rng() % final_state << " " << t << ":" << (rng() % 4 == 0 ? t : kFstEps) << "/" << arc_score(rng) << "\n";
+        }
+        if (rng() % 8 == 0) {
+            arcs << s << " " << rng() % final_state << " " << kFstEps << ":" << kFstEps << "/-1\n";
+            num_arcs++;
+        }
+        for (int i = 0; i != eps_per_state; i++) {
+            arcs << s << " " << rng() % final_state << " " << kFstEps << ":" << kFstEps << "/" << arc_score(rng) << "\n";
+            num_arcs++;
+        }
+        arcs << s << " " << final_state << " " << kFstInputEnd << ":" << tokenizer.eos << "/0\n";
+        num_arcs += arcs_per_state + 2;
+    }
+
+    std::stringstream text;
+    text << num_states << "," << num_arcs << ",0," << final_state << "\n" << arcs.str();
+    return text.str();
+}
+
+
+// Tokenizer of test model, loaded once and shared by all tests.
+const Tokenizer& TestTokenizer() {
+    static const Tokenizer* tokenizer = [] {
+        Tokenizer* t = new Tokenizer;
+        t->Load("testdata/model/tokenizer.vocab");
+        return t;
+    }();
+    return *tokenizer;
+}
+
+
+Fst TokenTopology() {
+    Fst graph;
+    graph.BuildTokenTopology(TestTokenizer());
+    return graph;
+}
+
+
+Fst RandomGraph(int num_states, int arcs_per_state, int eps_per_state = 0) {
+    std::stringstream text(RandomGraphText(TestTokenizer(), num_states, arcs_per_state, 777, eps_per_state));
+    Fst graph;
+    graph.LoadFromText(text);
+    return graph;
+}
+
+
+vec<torch::Tensor> FakeFrames(int num_frames, f32 noise_floor = -12.0) {
+    FakeScorer scorer(TestTokenizer().Size(), TestTokenizer().blk, 777, noise_floor);
+    vec<torch::Tensor> frames;
+    for (int t = 0; t != num_frames; t++) {
+        frames.push_back(scorer.Pop());
+    }
+    return frames;
+}
+
+
+// Frame where token t clearly wins.
+torch::Tensor OneHotFrame(TokenId t) {
+    vec<f32> score(TestTokenizer().Size(), -20.0);
+    score[t] = -0.1;
+    return torch::from_blob(score.data(), {(i64)score.size()}, torch::kFloat).clone();
+}
+
+
+// Observables of one decoding session.
+struct Decoded {
+    vec<vec<TokenId>> nbest;
+    vec<OutputAlignment> alignment;
+    vec<vec<TokenId>> committed; // committed path after each frame
+    vec<vec<TokenId>> paths; // committed + partial path after each frame
+    SearchStats frame_sum; // FrameStats() summed over frames
+    SearchStats session_stats;
+    vec<SearchStats> histogram;
+    int num_frames = 0;
+    int num_skipped_frames = 0;
+    int eps_reexpansions = 0;
+    f32 beam_tightening = 0.0;
+    size_t token_arena_size = 0;
+};
+
+
+Decoded Decode(const BeamSearchConfig& config, const Fst& graph, const vec<torch::Tensor>& frames) {
+    BeamSearch search;
+    search.Load(config, graph, TestTokenizer());
+    search.InitSession();
+
+    Decoded res;
+    for (const auto& frame : frames) {
+        search.Push(frame);
+
+        res.committed.push_back(search.CommittedPath());
+        vec<TokenId> path = search.CommittedPath();
+        vec<TokenId> partial;
+        search.PartialPath(&partial);
+        path.insert(path.end(), partial.begin(), partial.end());
+        res.paths.push_back(path);
+
+        res.frame_sum.Add(search.FrameStats());
+    }
+    res.token_arena_size = search.TokenArenaSize();
+    search.PushEos();
+
+    res.nbest = search.NBest();
+    res.alignment = search.BestAlignment();
+    res.session_stats = search.SessionStats();
+    res.histogram = search.FrameStatsHistogram();
+    res.num_frames = search.NumFrames();
+    res.num_skipped_frames = search.NumSkippedFrames();
+    res.eps_reexpansions = search.NumEpsReexpansions();
+    res.beam_tightening = search.BeamTightening();
+    search.DeinitSession();
+    return res;
+}
+
+
+void ExpectSameAlignment(const vec<OutputAlignment>& x, const vec<OutputAlignment>& y) {
+    ASSERT_EQ(y.size(), x.size());
+    for (int i = 0; i != x.size(); i++) {
+        EXPECT_EQ(y[i].token, x[i].token);
+        EXPECT_EQ(y[i].begin_frame, x[i].begin_frame);
+        EXPECT_EQ(y[i].end_frame, x[i].end_frame);
+        EXPECT_NEAR(y[i].am_score, x[i].am_score, 1e-3);
+        EXPECT_NEAR(y[i].lm_score, x[i].lm_score, 1e-3);
+    }
+}
+
+} // namespace
+
+
+TEST(BeamSearch, GarbageCollectionSoak) {
+    const Tokenizer& tokenizer = TestTokenizer();
+    Fst graph = TokenTopology();
+
+    BeamSearchConfig config;
+    config.max_active = 16;
+    config.token_set_size = 4;
+    config.nbest = 2;
+    config.gc_interval = 25;
+
+    BeamSearch search;
+    search.Load(config, graph, tokenizer);
+
+    FakeScorer scorer(tokenizer.Size(), tokenizer.blk);
+
+    for (int session = 0; session != 2; session++) {
+        search.InitSession();
+
+        size_t arena_size = 0;
+        size_t lattice_frames = 0;
+        for (int t = 0; t != 20000; t++) { // ~13 minutes audio at 25 frames per second
+            search.Push(scorer.Pop());
+            if (t == 1000) {
+                arena_size = search.TokenArenaSize();
+            }
+            lattice_frames = std::max(lattice_frames, search.NumLatticeFrames());
+        }
+        // memory stays flat once warmed up
+        EXPECT_LE(search.TokenArenaSize(), arena_size);
+        EXPECT_LT(lattice_frames, 1000); // uncommitted window, not session length
+
+        search.PushEos();
+        ASSERT_FALSE(search.NBest().empty());
+        EXPECT_EQ(search.NBest()[0].front(), tokenizer.bos);
+        EXPECT_EQ(search.NBest()[0].back(), tokenizer.eos);
+
+        search.DeinitSession();
+    }
+}
+
+
+TEST(BeamSearch, PartialPath) {
+    BeamSearchConfig config;
+    config.max_active = 16;
+    config.token_set_size = 4;
+    config.gc_interval = 10;
+
+    Decoded res = Decode(config, TokenTopology(), FakeFrames(2000, -30.0));
+
+    // committed path only grows
+    for (int t = 1; t != res.committed.size(); t++) {
+        const vec<TokenId>& prev = res.committed[t - 1];
+        const vec<TokenId>& cur = res.committed[t];
+        ASSERT_GE(cur.size(), prev.size());
+        EXPECT_TRUE(std::equal(prev.begin(), prev.end(), cur.begin()));
+    }
+    const vec<TokenId>& committed = res.committed.back();
+    EXPECT_GT(committed.size(), 0);
+    EXPECT_TRUE(std::equal(committed.begin(), committed.end(), res.nbest[0].begin()));
+}
+
+
+TEST(BeamSearch, ClassGraph) {
+    const Tokenizer& tokenizer = TestTokenizer();
+    TokenId x = tokenizer.Index("的");
+    TokenId y = tokenizer.Index("在");
+    FstLabel nt = kFstNonterminalBegin;
+
+    // main graph: x $CLASS </s>
+    std::stringstream main_text;
+    main_text << "4,6,0,3\n"
+        << "0 0 " << tokenizer.blk << ":" << kFstEps << "/0\n"
+        << "0 1 " << x << ":" << x << "/0\n"
+        << "1 1 " << x << ":" << kFstEps << "/0\n"
+        << "1 2 " << kFstEps << ":" << nt << "/0\n"
+        << "2 2 " << tokenizer.blk << ":" << kFstEps << "/0\n"
+        << "2 3 " << kFstInputEnd << ":" << tokenizer.eos << "/0\n";
+    Fst graph;
+    graph.LoadFromText(main_text);
+
+    // class graph: y
+    std::stringstream class_text;
+    class_text << "3,4,0,2\n"
+        << "0 0 " << tokenizer.blk << ":" << kFstEps << "/0\n"
+        << "0 1 " << y << ":" << y << "/0\n"
+        << "1 1 " << y << ":" << kFstEps << "/0\n"
+        << "1 2 " << kFstInputEnd << ":" << kFstEps << "/0\n";
+    Fst class_graph;
+    class_graph.LoadFromText(class_text);
+
+    BeamSearchConfig config;
+    BeamSearch search;
+    search.Load(config, graph, tokenizer);
+
+    for (int session = 0; session != 2; session++) { // class graphs are per-session
+        search.InitSession();
+        search.AttachClassGraph(nt, class_graph);
+
+        for (TokenId t : {x, x, tokenizer.blk, y, y, tokenizer.blk}) {
+            search.Push(OneHotFrame(t));
+        }
+        search.PushEos();
+
+        ASSERT_FALSE(search.NBest().empty());
+        EXPECT_EQ(search.NBest()[0], vec<TokenId>({tokenizer.bos, x, y, tokenizer.eos}));
+
+        search.DeinitSession();
+    }
+
+    // garbage collection past class graph return: return arc takes no frame
+    config.gc_interval = 1;
+    BeamSearch gc_search;
+    gc_search.Load(config, graph, tokenizer);
+    gc_search.InitSession();
+    gc_search.AttachClassGraph(nt, class_graph);
+    for (TokenId t : {x, x, tokenizer.blk, y, y, tokenizer.blk, tokenizer.blk, tokenizer.blk, tokenizer.blk}) {
+        gc_search.Push(OneHotFrame(t));
+    }
+    EXPECT_EQ(gc_search.CommittedPath(), vec<TokenId>({tokenizer.bos, x, y}));
+    gc_search.PushEos();
+    EXPECT_EQ(gc_search.NBest()[0], vec<TokenId>({tokenizer.bos, x, y, tokenizer.eos}));
+
+    const vec<OutputAlignment>& alignment = gc_search.BestAlignment();
+    ASSERT_EQ(alignment.size(), 2);
+    EXPECT_EQ(alignment[0].token, x);
+    EXPECT_EQ(alignment[0].begin_frame, 0);
+    EXPECT_EQ(alignment[0].end_frame, 2);
+    EXPECT_EQ(alignment[1].token, y);
+    EXPECT_EQ(alignment[1].begin_frame, 3);
+    EXPECT_EQ(alignment[1].end_frame, 5);
+    gc_search.DeinitSession();
+}
+
+
+TEST(BeamSearch, Endpoint) {
+    const Tokenizer& tokenizer = TestTokenizer();
+    TokenId x = tokenizer.Index("的");
+    Fst graph = TokenTopology();
+
+    BeamSearchConfig config;
+    config.gc_interval = 5; // trailing blanks span committed path
+    config.insertion_penalty = 1.0; // "x" beats "x x" that ties on acoustic score
+    BeamSearch search;
+    search.Load(config, graph, tokenizer);
+
+    EndpointConfig endpoint;
+    endpoint.max_silence = 30;
+    endpoint.min_trailing_blank = 10;
+    endpoint.max_trailing_blank = 20;
+
+    search.InitSession();
+    for (int segment = 0; segment != 2; segment++) {
+        search.Push(OneHotFrame(x));
+        search.Push(OneHotFrame(x));
+        for (int t = 1; t != endpoint.min_trailing_blank; t++) {
+            search.Push(OneHotFrame(tokenizer.blk));
+            EXPECT_FALSE(search.EndpointDetected(endpoint));
+        }
+        search.Push(OneHotFrame(tokenizer.blk));
+        EXPECT_TRUE(search.EndpointDetected(endpoint));
+
+        search.PushEos();
+        EXPECT_EQ(search.NBest()[0], vec<TokenId>({tokenizer.bos, x, tokenizer.eos}));
+        search.ResetSegment();
+    }
+
+    // silence only
+    for (int t = 1; t != endpoint.max_silence; t++) {
+        search.Push(OneHotFrame(tokenizer.blk));
+        EXPECT_FALSE(search.EndpointDetected(endpoint));
+    }
+    search.Push(OneHotFrame(tokenizer.blk));
+    EXPECT_TRUE(search.EndpointDetected(endpoint));
+
+    search.DeinitSession();
+}
+
+
+TEST(BeamSearch, FrameSkipping) {
+    vec<torch::Tensor> frames = FakeFrames(500, -30.0);
+
+    BeamSearchConfig config;
+    config.max_active = 16;
+    Decoded baseline = Decode(config, TokenTopology(), frames);
+    EXPECT_EQ(baseline.num_frames, frames.size());
+    EXPECT_EQ(baseline.num_skipped_frames, 0);
+
+    config.blank_skip_threshold = 0.8;
+    config.repeat_skip = true;
+    Decoded skipped = Decode(config, TokenTopology(), frames);
+    EXPECT_EQ(skipped.num_frames, frames.size());
+    EXPECT_GT(skipped.num_skipped_frames, frames.size() / 2);
+
+    // peaky posteriors: skipping doesn't change the best path, nor its frames
+    EXPECT_EQ(skipped.nbest[0], baseline.nbest[0]);
+    ASSERT_EQ(skipped.alignment.size(), baseline.alignment.size());
+    for (int i = 0; i != baseline.alignment.size(); i++) {
+        EXPECT_EQ(skipped.alignment[i].begin_frame, baseline.alignment[i].begin_frame);
+        EXPECT_EQ(skipped.alignment[i].end_frame, baseline.alignment[i].end_frame);
+    }
+}
+
+
+TEST(BeamSearch, DenseFrontierMap) {
+    vec<torch::Tensor> frames = FakeFrames(300, -15.0);
+
+    BeamSearchConfig config;
+    config.max_active = 64;
+    config.token_set_size = 4;
+    config.nbest = 4;
+    config.dense_frontier_map_max_states = 0; // hash map
+    Decoded baseline = Decode(config, TokenTopology(), frames);
+
+    config.dense_frontier_map_max_states = 1 << 24;
+    EXPECT_EQ(Decode(config, TokenTopology(), frames).nbest, baseline.nbest);
+}
+
+
+TEST(BeamSearch, HistogramPruning) {
+    const Tokenizer& tokenizer = TestTokenizer();
+
+    // one frame of 48 tokens evenly spread over 6.0, 8 tokens per histogram bin of width beam / bins = 1.0
+    vec<f32> score(tokenizer.Size(), -30.0);
+    for (int k = 0; k != 48; k++) {
+        score[4 + k] = -0.125 * k;
+    }
+    vec<torch::Tensor> frame = {torch::from_blob(score.data(), {(i64)score.size()}, torch::kFloat).clone()};
+
+    BeamSearchConfig config;
+    config.beam = 16.0;
+    config.max_active = 20;
+    config.histogram_bins = 16;
+    config.stats = true;
+
+    auto survivors = [&](const Decoded& res) {
+        return res.frame_sum.token_sets - res.frame_sum.max_active_pruned;
+    };
+
+    config.histogram_pruning = false;
+    EXPECT_EQ(survivors(Decode(config, TokenTopology(), frame)), config.max_active);
+
+    config.histogram_pruning = true;
+    int n = survivors(Decode(config, TokenTopology(), frame));
+    EXPECT_GE(n, config.max_active);
+    EXPECT_LE(n, config.max_active + 8) << n; // at most one extra bin
+
+    // peaky posteriors: approximate cutoff doesn't change the best path
+    vec<torch::Tensor> frames = FakeFrames(300);
+    BeamSearchConfig peaky_config;
+    peaky_config.max_active = 64;
+    peaky_config.token_set_size = 2;
+    peaky_config.stats = true;
+    Decoded baseline = Decode(peaky_config, TokenTopology(), frames);
+    EXPECT_GT(baseline.session_stats.max_active_pruned, 0); // max_active is in effect
+
+    peaky_config.histogram_pruning = true;
+    EXPECT_EQ(Decode(peaky_config, TokenTopology(), frames).nbest[0], baseline.nbest[0]);
+}
+
+
+TEST(BeamSearch, ImplicitTokenTopology) {
+    const Tokenizer& tokenizer = TestTokenizer();
+
+    Fst implicit_graph;
+    implicit_graph.BuildImplicitTokenTopology(tokenizer);
+    EXPECT_TRUE(implicit_graph.arcs.empty());
+
+    Fst graph = TokenTopology();
+    EXPECT_EQ(implicit_graph.num_states, graph.num_states);
+    EXPECT_EQ(implicit_graph.final_state, graph.final_state);
+
+    Fst general_graph = graph;
+    general_graph.token_topology = false; // expanded via stored arcs
+
+    vec<torch::Tensor> frames = FakeFrames(300, -15.0);
+
+    BeamSearchConfig config;
+    config.max_active = 64;
+    config.token_set_size = 4;
+    config.nbest = 4;
+    config.blank_skip_threshold = 0.95;
+
+    Decoded baseline = Decode(config, general_graph, frames);
+    EXPECT_EQ(Decode(config, graph, frames).nbest, baseline.nbest);
+    EXPECT_EQ(Decode(config, implicit_graph, frames).nbest, baseline.nbest);
+}
+
+
+TEST(BeamSearch, LatticeNBest) {
+    const Tokenizer& tokenizer = TestTokenizer();
+    vec<torch::Tensor> frames = FakeFrames(1000);
+
+    BeamSearchConfig config;
+    config.max_active = 32;
+    config.token_set_size = 1; // final token set holds only one hypothesis
+    config.nbest = 20;
+    vec<vec<TokenId>> best = Decode(config, TokenTopology(), frames).nbest;
+
+    config.lattice_nbest = true;
+    vec<vec<TokenId>> lattice = Decode(config, TokenTopology(), frames).nbest;
+
+    ASSERT_EQ(best.size(), 1);
+    ASSERT_EQ(lattice.size(), 20);
+    EXPECT_EQ(lattice[0], best[0]);
+
+    for (int i = 0; i != lattice.size(); i++) {
+        EXPECT_EQ(lattice[i].front(), tokenizer.bos);
+        EXPECT_EQ(lattice[i].back(), tokenizer.eos);
+        for (int j = 0; j != i; j++) {
+            EXPECT_NE(lattice[i], lattice[j]);
+        }
+    }
+}
+
+
+TEST(BeamSearch, Alignment) {
+    vec<torch::Tensor> frames = FakeFrames(1000);
+
+    BeamSearchConfig config;
+    config.max_active = 16;
+    config.gc_interval = 0;
+    Decoded res = Decode(config, TokenTopology(), frames);
+
+    const vec<TokenId>& best = res.nbest[0];
+    const vec<OutputAlignment>& alignment = res.alignment;
+    ASSERT_FALSE(alignment.empty());
+    ASSERT_EQ(alignment.size() + 2, best.size()); // bos & eos excluded
+
+    int end = 0;
+    for (int i = 0; i != alignment.size(); i++) {
+        const OutputAlignment& a = alignment[i];
+        EXPECT_EQ(a.token, best[i + 1]);
+        EXPECT_LE(end, a.begin_frame);
+        EXPECT_LT(a.begin_frame, a.end_frame);
+        EXPECT_LE(a.end_frame, (int)frames.size());
+        EXPECT_GT(a.confidence, 0.0);
+        EXPECT_LE(a.confidence, 1.0);
+        end = a.end_frame;
+    }
+
+    // garbage collection commits alignment piecewise, result is the same
+    config.gc_interval = 25;
+    Decoded gc = Decode(config, TokenTopology(), frames);
+    ASSERT_EQ(gc.nbest[0], best);
+    ExpectSameAlignment(alignment, gc.alignment);
+}
+
+
+TEST(BeamSearch, EpsClosureTokenRelease) {
+    // tokens dropped by epsilon closure are freed at frame end, with or without garbage collection
+    Fst graph = RandomGraph(3000, 8, 3);
+    vec<torch::Tensor> frames = FakeFrames(200);
+
+    BeamSearchConfig config;
+    config.beam = 12.0;
+    config.token_set_size = 2;
+    config.nbest = 3;
+    config.lattice_nbest = true; // alternative links may refer to dropped tokens
+    config.gc_interval = 0;
+    Decoded baseline = Decode(config, graph, frames);
+    ASSERT_FALSE(baseline.nbest.empty());
+    EXPECT_GT(baseline.eps_reexpansions, 0);
+
+    for (int gc_interval : {1, 25}) {
+        config.gc_interval = gc_interval;
+        Decoded res = Decode(config, graph, frames);
+        EXPECT_EQ(res.nbest[0], baseline.nbest[0]) << "gc_interval: " << gc_interval; // gc drops stale alternatives
+        ExpectSameAlignment(baseline.alignment, res.alignment);
+    }
+}
+
+
+TEST(BeamSearch, Snapshot) {
+    const Tokenizer& tokenizer = TestTokenizer();
+    vec<torch::Tensor> frames = FakeFrames(1000);
+
+    auto check = [&](const BeamSearchConfig& config, const Fst& graph) {
+        BeamSearch search;
+        search.Load(config, graph, tokenizer);
+        search.InitSession();
+
+        BeamSearch migrated; // e.g. in another process
+        migrated.Load(config, graph, tokenizer);
+
+        int cut = 537; // not at a garbage collection frame
+        for (int t = 0; t != cut; t++) {
+            search.Push(frames[t]);
+        }
+        std::stringstream blob;
+        ASSERT_EQ(search.Snapshot(blob), Error::OK);
+        ASSERT_EQ(migrated.Restore(blob), Error::OK);
+        EXPECT_EQ(migrated.NumFrames(), cut);
+
+        for (int t = cut; t != frames.size(); t++) {
+            search.Push(frames[t]);
+            migrated.Push(frames[t]);
+        }
+        EXPECT_EQ(migrated.CommittedPath(), search.CommittedPath());
+
+        search.PushEos();
+        migrated.PushEos();
+        ASSERT_FALSE(search.NBest().empty());
+        EXPECT_EQ(migrated.NBest(), search.NBest());
+        ExpectSameAlignment(search.BestAlignment(), migrated.BestAlignment());
+
+        search.DeinitSession();
+        migrated.DeinitSession();
+    };
+
+    BeamSearchConfig config;
+    config.max_active = 32;
+    config.token_set_size = 4; // prefix tree LM states are carried over
+    config.nbest = 2;
+    check(config, TokenTopology());
+
+    BeamSearchConfig lattice_config;
+    lattice_config.max_active = 32;
+    lattice_config.token_set_size = 1;
+    lattice_config.nbest = 5;
+    lattice_config.lattice_nbest = true; // alternative links are carried over
+    check(lattice_config, RandomGraph(3000, 12));
+}
+
+
+TEST(BeamSearch, AdaptiveBeam) {
+    Fst graph = RandomGraph(3000, 12);
+    vec<torch::Tensor> frames = FakeFrames(200);
+
+    BeamSearchConfig config;
+    config.beam = 16.0;
+    config.min_beam = 4.0;
+    config.max_beam = 30.0;
+
+    auto tightening = [&](int target_active) {
+        config.target_active = target_active;
+        Decoded res = Decode(config, graph, frames);
+        EXPECT_FALSE(res.nbest.empty());
+        return res.beam_tightening;
+    };
+
+    EXPECT_EQ(tightening(0), 0.0);
+    EXPECT_GT(tightening(5), 0.0); // narrowed to track a small active set
+    EXPECT_LT(tightening(100000), 0.0); // widened towards max_beam
+    EXPECT_LE(tightening(1), 16.0 - 4.0); // bounded by min_beam
+}
+
+
+TEST(BeamSearch, BestFirstEpsClosure) {
+    Fst graph = RandomGraph(3000, 8, 3);
+    vec<torch::Tensor> frames = FakeFrames(100);
+
+    BeamSearchConfig config;
+    config.beam = 12.0;
+    config.token_set_size = 2;
+    config.nbest = 2;
+    config.best_first_eps = false;
+    Decoded lifo = Decode(config, graph, frames);
+
+    config.best_first_eps = true;
+    Decoded best_first = Decode(config, graph, frames);
+
+    ASSERT_FALSE(lifo.nbest.empty());
+    EXPECT_EQ(best_first.nbest, lifo.nbest); // same closure, different order
+    EXPECT_GT(lifo.eps_reexpansions, 0);
+    EXPECT_LT(best_first.eps_reexpansions, lifo.eps_reexpansions);
+}
+
+
+TEST(BeamSearch, ContextBiasing) {
+    const Tokenizer& tokenizer = TestTokenizer();
+    Fst graph = TokenTopology();
+
+    // token a narrowly beats token b, b is hot
+    TokenId a = tokenizer.Index("中"), b = tokenizer.Index("国");
+    vec<torch::Tensor> frames;
+    for (int t = 0; t != 4; t++) {
+        vec<f32> frame(tokenizer.Size(), -20.0);
+        frame[tokenizer.blk] = (t == 1) ? -5.0 : -0.01;
+        frame[a] = (t == 1) ? -0.5 : -20.0;
+        frame[b] = (t == 1) ? -1.0 : -20.0;
+        frames.push_back(torch::from_blob(frame.data(), {(long)frame.size()}, torch::kFloat).clone());
+    }
+
+    std::istringstream phrases("国\t2.0");
+    ContextGraph context;
+    context.Load(phrases, tokenizer, 1.0);
+
+    for (int token_set_size : {1, 4}) { // context LM alone, or along with prefix tree LM
+        BeamSearchConfig config;
+        config.token_set_size = token_set_size;
+        config.context_biasing = true;
+
+        BeamSearch search;
+        search.Load(config, graph, tokenizer);
+
+        auto decode = [&](bool attach) {
+            if (attach) {
+                search.AttachContextGraph(context);
+            }
+            search.InitSession();
+            for (const auto& frame : frames) {
+                search.Push(frame);
+            }
+            search.PushEos();
+            vec<TokenId> best = search.NBest()[0];
+            search.DeinitSession();
+            return best;
+        };
+
+        EXPECT_EQ(decode(false), vec<TokenId>({tokenizer.bos, a, tokenizer.eos}));
+        EXPECT_EQ(decode(true), vec<TokenId>({tokenizer.bos, b, tokenizer.eos}));
+        EXPECT_EQ(decode(false), vec<TokenId>({tokenizer.bos, a, tokenizer.eos})); // detached by session end
+    }
+}
+
+
+TEST(BeamSearch, SearchStats) {
+    Fst graph = RandomGraph(3000, 8, 1);
+    vec<torch::Tensor> frames = FakeFrames(100);
+
+    BeamSearchConfig config;
+    config.max_active = 8;
+    config.token_set_size = 2;
+    config.token_allocator_slab_size = 1; // arena grows by one token, so its size is the peak of tokens alive
+    config.stats = false;
+    Decoded off = Decode(config, graph, frames);
+
+    config.stats = true;
+    Decoded on = Decode(config, graph, frames);
+    EXPECT_EQ(on.nbest[0], off.nbest[0]);
+
+    const SearchStats& session = on.session_stats;
+    EXPECT_GT(session.token_sets, 0);
+    EXPECT_GT(session.tokens, 0);
+    EXPECT_GT(session.beam_pruned, 0);
+    EXPECT_GT(session.max_active_pruned, 0);
+    EXPECT_GT(session.recombined, 0);
+    EXPECT_GT(session.lm_queries, 0);
+    EXPECT_EQ(session.lm_cache_hits + session.lm_cache_misses, 0); // prefix tree LM isn't cached
+    EXPECT_EQ(session.arena_high_water, on.token_arena_size); // peak within frame, not after pruning
+    EXPECT_EQ(session.arena_high_water, on.frame_sum.arena_high_water); // max over frames
+    EXPECT_EQ(session.tokens, on.frame_sum.tokens);
+    EXPECT_EQ(session.eps_reexpansions, on.frame_sum.eps_reexpansions);
+
+    ASSERT_EQ(on.histogram.size(), static_cast<size_t>(SearchStats::kNumBins));
+    int num_frames = 0;
+    for (const SearchStats& bin : on.histogram) {
+        num_frames += bin.tokens;
+    }
+    EXPECT_EQ(num_frames, frames.size());
+
+    EXPECT_EQ(off.session_stats.tokens, 0); // disabled
+    EXPECT_TRUE(off.histogram.empty());
+}
+
+
+// Graph search loads no n-gram LM, and prefix tree LM scores are all 0, so the bound here is
+// the insertion penalty alone: queries are saved by it, KenLm bounds are covered by KenLmScoreUpperBound.
+TEST(BeamSearch, LmLookahead) {
+    vec<torch::Tensor> frames = FakeFrames(200);
+
+    BeamSearchConfig config;
+    config.max_active = 32;
+    config.token_set_size = 4; // prefix tree LM
+    config.insertion_penalty = 0.5;
+    config.stats = true;
+    config.lm_lookahead = false;
+    Decoded baseline = Decode(config, TokenTopology(), frames);
+
+    config.lm_lookahead = true;
+    Decoded lookahead = Decode(config, TokenTopology(), frames);
+
+    EXPECT_EQ(lookahead.nbest[0], baseline.nbest[0]);
+    EXPECT_GT(lookahead.session_stats.lm_queries, 0);
+    EXPECT_LT(lookahead.session_stats.lm_queries, baseline.session_stats.lm_queries); // GetScore() calls saved
+}
+
+
+TEST(BeamSearch, Degradation) {
+    const Tokenizer& tokenizer = TestTokenizer();
+    Fst graph = RandomGraph(3000, 12);
+    vec<torch::Tensor> frames = FakeFrames(100);
+
+    BeamSearchConfig config;
+    config.beam = 16.0;
+    config.max_active = 100;
+
+    RtfBudgetConfig rtf_budget;
+    rtf_budget.beam_scale = 0.5;
+
+    BeamSearch search;
+    search.Load(config, graph, tokenizer);
+
+    // degraded for the first half of session, restored for the rest
+    search.InitSession();
+    for (int t = 0; t != frames.size(); t++) {
+        if (t == 0 || t == frames.size() / 2) {
+            search.SetDegradation(t == 0 ? 2 : 0, rtf_budget);
+        }
+        search.Push(frames[t]);
+    }
+    search.PushEos();
+    EXPECT_FALSE(search.NBest().empty());
+    EXPECT_FLOAT_EQ(search.BeamTightening(), (16.0 - 16.0 * 0.25) / 2);
+    search.DeinitSession();
+
+    // next session starts with full search
+    search.InitSession();
+    for (const auto& frame : frames) {
+        search.Push(frame);
+    }
+    search.PushEos();
+    EXPECT_FALSE(search.NBest().empty());
+    EXPECT_EQ(search.BeamTightening(), 0.0);
+    search.DeinitSession();
+
+    // context LM is dropped by role, also when it is the only LM(token_set_size = 1)
+    const Tokenizer& tk = tokenizer;
+    Fst topo = TokenTopology();
+    TokenId a = tk.Index("中"), b = tk.Index("国"); // a narrowly beats b, b is hot
+    vec<torch::Tensor> biased;
+    for (int t = 0; t != 4; t++) {
+        vec<f32> frame(tk.Size(), -20.0);
+        frame[tk.blk] = (t == 1) ? -5.0 : -0.01;
+        frame[a] = (t == 1) ? -0.5 : -20.0;
+        frame[b] = (t == 1) ? -1.0 : -20.0;
+        biased.push_back(torch::from_blob(frame.data(), {(long)frame.size()}, torch::kFloat).clone());
+    }
+    std::istringstream phrases("国\t2.0");
+    ContextGraph context;
+    context.Load(phrases, tk, 1.0);
+
+    for (int token_set_size : {1, 4}) {
+        BeamSearchConfig biasing;
+        biasing.token_set_size = token_set_size;
+        biasing.context_biasing = true;
+
+        BeamSearch s;
+        s.Load(biasing, topo, tk);
+        for (int level : {rtf_budget.drop_lm_level - 1, rtf_budget.drop_lm_level}) {
+            s.AttachContextGraph(context);
+            s.InitSession();
+            s.SetDegradation(level, rtf_budget);
+            for (const auto& frame : biased) {
+                s.Push(frame);
+            }
+            s.PushEos();
+            TokenId expected = level < rtf_budget.drop_lm_level ? b : a;
+            EXPECT_EQ(s.NBest()[0], vec<TokenId>({tk.bos, expected, tk.eos})) << token_set_size << " " << level;
+            s.DeinitSession();
+        }
+    }
+}
+
+
+TEST(BeamSearch, ParallelExpansion) {
+    Fst graph = RandomGraph(3000, 12);
+    vec<torch::Tensor> frames = FakeFrames(200);
+
+    BeamSearchConfig config;
+    config.max_active = 300;
+    config.token_set_size = 3;
+    config.nbest = 3;
+    config.insertion_penalty = 0.5;
+    Decoded serial = Decode(config, graph, frames);
+    ASSERT_FALSE(serial.nbest.empty());
+
+    for (int num_threads : {2, 3, 8}) {
+        config.num_expansion_threads = num_threads;
+        Decoded parallel = Decode(config, graph, frames);
+        EXPECT_EQ(parallel.nbest, serial.nbest) << num_threads << " threads";
+        EXPECT_EQ(parallel.paths, serial.paths) << num_threads << " threads";
+    }
+}
+
+
+TEST(BeamSearch, TokenArrays) {
+    Fst graph = RandomGraph(3000, 8, 1);
+    Fst topo = TokenTopology();
+    vec<torch::Tensor> frames = FakeFrames(150);
+
+    auto expect_same = [&](const Fst& g, BeamSearchConfig config, const str& what) {
+        config.token_arrays = false;
+        Decoded lists = Decode(config, g, frames);
+        ASSERT_FALSE(lists.nbest.empty());
+
+        config.token_arrays = true;
+        Decoded arrays = Decode(config, g, frames);
+        EXPECT_EQ(arrays.nbest, lists.nbest) << what;
+        EXPECT_EQ(arrays.paths, lists.paths) << what;
+    };
+
+    for (int token_set_size : {1, 2, 4}) {
+        BeamSearchConfig config;
+        config.max_active = 300;
+        config.token_set_size = token_set_size;
+        config.nbest = 3;
+
+        for (const Fst* g : {&graph, &topo}) {
+            expect_same(*g, config, "token_set_size: " + std::to_string(token_set_size));
+        }
+    }
+
+    // alternative links of recombined tokens, and staged tokens of parallel expansion
+    for (bool lattice_nbest : {true, false}) {
+        BeamSearchConfig config;
+        config.max_active = 300;
+        config.token_set_size = 3;
+        config.nbest = 3;
+        config.insertion_penalty = 0.5;
+        config.lattice_nbest = lattice_nbest;
+        config.num_expansion_threads = lattice_nbest ? 1 : 3;
+        expect_same(graph, config, "lattice_nbest: " + std::to_string(lattice_nbest));
+    }
+}
+
+
+TEST(BeamSearch, ArcMasks) {
+#ifndef __AVX2__
+    GTEST_SKIP() << "built without AVX2(-DSIO_USE_AVX2=ON)";
+#endif
+    std::mt19937 rng(777);
+    std::uniform_real_distribution<f32> uniform(-10.0, 0.0);
+
+    vec<f32> frame_score(64);
+    for (f32& x : frame_score) {
+        x = uniform(rng);
+    }
+
+    vec<FstArc> arcs(SIO_ARC_BLOCK);
+    for (int round = 0; round != 10000; round++) {
+        for (FstArc& arc : arcs) {
+            switch (rng() % 6) {
+                case 0: arc.ilabel = kFstEps; break;
+                case 1: arc.ilabel = kFstInputEnd; break;
+                case 2: arc.ilabel = kFstNonterminalBegin + rng() % (kFstNonterminalEnd - kFstNonterminalBegin); break;
+                default: arc.ilabel = rng() % frame_score.size();
+            }
+            arc.score = uniform(rng);
+        }
+        f32 best_score = uniform(rng), score_offset = uniform(rng), score_min = 3 * uniform(rng);
+
+        int n = 1 + round % SIO_ARC_BLOCK; // full blocks & tails
+        EXPECT_EQ(
+            EmittingArcMask(arcs.data(), n, frame_score.data(), best_score, score_offset, score_min),
+            EmittingArcMaskScalar(arcs.data(), n, frame_score.data(), best_score, score_offset, score_min)
+        ) << "n: " << n;
+
+        const f32* score = frame_score.data() + rng() % (frame_score.size() - SIO_ARC_BLOCK);
+        EXPECT_EQ(
+            ScoreMask(score, n, best_score, score_offset, score_min),
+            ScoreMaskScalar(score, n, best_score, score_offset, score_min)
+        ) << "n: " << n;
+    }
+}
+
+
+// Benchmarks below are disabled, run them with: --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+TEST(BeamSearch, DISABLED_ParallelExpansionBenchmark) {
+    Fst graph = RandomGraph(200000, 16);
+    vec<torch::Tensor> frames = FakeFrames(100);
+
+    for (int num_threads : {1, 2, 4, 8, 16}) {
+        BeamSearchConfig config;
+        config.beam = 20.0;
+        config.max_active = 5000;
+        config.token_set_size = 4;
+        config.num_expansion_threads = num_threads;
+
+        BeamSearch search;
+        search.Load(config, graph, TestTokenizer());
+        search.InitSession();
+
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& frame : frames) {
+            search.Push(frame);
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        SIO_INFO << "threads: " << num_threads << ", " << elapsed.count() / frames.size() << " ms/frame";
+
+        search.DeinitSession();
+    }
+}
+
+
+// Snapshot cost vs session length: trace backs are pruned like garbage collection,
+// so only committed outputs & their alignment grow with session.
+TEST(BeamSearch, DISABLED_SnapshotBenchmark) {
+    const Tokenizer& tokenizer = TestTokenizer();
+    Fst graph = TokenTopology();
+
+    BeamSearchConfig config;
+    config.max_active = 64;
+    config.token_set_size = 4;
+
+    FakeScorer scorer(tokenizer.Size(), tokenizer.blk);
+
+    for (int num_frames : {1000, 10000, 50000}) {
+        BeamSearch search;
+        search.Load(config, graph, tokenizer);
+        search.InitSession();
+        for (int t = 0; t != num_frames; t++) {
+            search.Push(scorer.Pop());
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::stringstream blob;
+        search.Snapshot(blob);
+        std::chrono::duration<double, std::milli> snapshot_time = std::chrono::steady_clock::now() - start;
+
+        BeamSearch migrated;
+        migrated.Load(config, graph, tokenizer);
+        start = std::chrono::steady_clock::now();
+        migrated.Restore(blob);
+        std::chrono::duration<double, std::milli> restore_time = std::chrono::steady_clock::now() - start;
+
+        SIO_INFO << "frames: " << num_frames
+                 << ", snapshot: " << blob.str().size() << " bytes, " << snapshot_time.count() << " ms"
+                 << ", restore: " << restore_time.count() << " ms";
+
+        search.DeinitSession();
+        migrated.DeinitSession();
+    }
+}
+
+
+TEST(BeamSearch, DISABLED_HistogramPruningBenchmark) {
+    Fst graph = TokenTopology();
+    // noisy posteriors keep most of 4096 tokens within beam, so max_active dominates pruning
+    vec<torch::Tensor> frames = FakeFrames(200);
+
+    for (int max_active : {500, 1000, 2000}) {
+        for (bool histogram : {false, true}) {
+            BeamSearchConfig config;
+            config.beam = 20.0;
+            config.max_active = max_active;
+            config.histogram_pruning = histogram;
+
+            BeamSearch search;
+            search.Load(config, graph, TestTokenizer());
+            search.InitSession();
+
+            auto start = std::chrono::steady_clock::now();
+            for (const auto& frame : frames) {
+                search.Push(frame);
+            }
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+            SIO_INFO << "max_active: " << max_active
+                     << (histogram ? ", histogram: " : ", nth_element: ")
+                     << elapsed.count() / frames.size() << " ms/frame";
+
+            search.DeinitSession();
+        }
+    }
+}
+
+
+// Token arrays vs token lists of frontier, over token_set_size.
+// Arrays pay off once token sets are crowded: on token topology, where a set gathers hypotheses of all prefixes
+// ending with its token, they are ~1.3x faster at token_set_size 8 and ~2x at 16, on par at 4,
+// and up to ~10% slower at 1 & 2 due to linking. Sparse HCLG-like graphs stay within noise.
+TEST(BeamSearch, DISABLED_TokenArraysBenchmark) {
+    Fst graph = RandomGraph(100000, 16, 1);
+    Fst topo = TokenTopology();
+    vec<torch::Tensor> frames = FakeFrames(100);
+
+    for (const Fst* g : {&graph, &topo}) {
+        for (int token_set_size : {1, 2, 4, 8, 16}) {
+            for (bool token_arrays : {false, true}) {
+                BeamSearchConfig config;
+                config.beam = 16.0;
+                config.max_active = (g == &topo) ? 500 : 2000;
+                config.token_set_size = token_set_size;
+                config.token_arrays = token_arrays;
+
+                BeamSearch search;
+                search.Load(config, *g, TestTokenizer());
+                search.InitSession();
+
+                auto start = std::chrono::steady_clock::now();
+                for (const auto& frame : frames) {
+                    search.Push(frame);
+                }
+                std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+                SIO_INFO << (g == &topo ? "topology" : "graph")
+                         << ", token_set_size: " << token_set_size
+                         << (token_arrays ? ", arrays: " : ", lists: ")
+                         << elapsed.count() / frames.size() << " ms/frame";
+
+                search.DeinitSession();
+            }
+        }
+    }
+}
+
+} // namespace sio
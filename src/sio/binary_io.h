@@ -0,0 +1,53 @@
+#ifndef SIO_BINARY_IO_H
+#define SIO_BINARY_IO_H
+
+#include <istream>
+#include <ostream>
+#include <type_traits>
+
+#include "sio/base.h"
+
+namespace sio {
+
+// Raw binary I/O of trivially copyable arrays & strings, complementing Kaldi's token/basic type I/O,
+// used by session snapshots. Blobs are meant to be restored on hosts of the same build & architecture.
+
+template <typename T>
+inline void WritePodVector(std::ostream& os, const vec<T>& v) {
+    static_assert(std::is_trivially_copyable<T>::value, "POD required");
+    u64 n = v.size();
+    os.write(reinterpret_cast<const char*>(&n), sizeof(n));
+    os.write(reinterpret_cast<const char*>(v.data()), n * sizeof(T));
+}
+
+
+template <typename T>
+inline void ReadPodVector(std::istream& is, vec<T>* v) {
+    static_assert(std::is_trivially_copyable<T>::value, "POD required");
+    u64 n = 0;
+    is.read(reinterpret_cast<char*>(&n), sizeof(n));
+    SIO_CHECK(!is.fail());
+    v->resize(n);
+    is.read(reinterpret_cast<char*>(v->data()), n * sizeof(T));
+    SIO_CHECK(!is.fail());
+}
+
+
+inline void WriteString(std::ostream& os, const str& s) {
+    u64 n = s.size();
+    os.write(reinterpret_cast<const char*>(&n), sizeof(n));
+    os.write(s.data(), n);
+}
+
+
+inline void ReadString(std::istream& is, str* s) {
+    u64 n = 0;
+    is.read(reinterpret_cast<char*>(&n), sizeof(n));
+    SIO_CHECK(!is.fail());
+    s->resize(n);
+    is.read(&(*s)[0], n);
+    SIO_CHECK(!is.fail());
+}
+
+} // namespace sio
+#endif
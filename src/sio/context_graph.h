@@ -0,0 +1,202 @@
+#ifndef SIO_CONTEXT_GRAPH_H
+#define SIO_CONTEXT_GRAPH_H
+
+#include <istream>
+
+#include "absl/strings/str_split.h"
+
+#include "sio/base.h"
+#include "sio/tokenizer.h"
+#include "sio/language_model_itf.h"
+
+namespace sio {
+
+// ContextGraph is an Aho-Corasick automaton over hot phrases(token sequences) for contextual biasing:
+//   1. states are trie nodes of phrase prefixes, 0 is root(nothing matched)
+//   2. failure link of a state is its longest proper suffix that is still a prefix in the trie
+//   3. transitions missing in trie follow failure links, they are resolved at load time into a deterministic
+//      table, only transitions differing from root's are stored, so Next() is a hash lookup or an array read.
+//
+// Scoring: potential of a state is the bonus of its partial match, i.e. per-token bonus * depth,
+// a transition scores potential(next) - potential(prev) + bonuses of phrases completed at next.
+// So a completed phrase keeps its bonus, while a broken partial match gives back what it gained.
+//
+// A loaded graph is immutable, it can be shared by sessions of multiple threads.
+class ContextGraph {
+    vec<LmScore> potential_; // by state
+    vec<LmScore> gain_; // by state, potential + bonuses of phrases ending at the state or its suffixes
+    vec<LmStateId> root_next_; // by token, transitions of root
+    hashtab<u64, LmStateId> next_; // (state, token) -> state, transitions of non-root states differing from root's
+    vec<LmScore> score_bound_; // by token
+    size_t num_phrases_ = 0;
+
+public:
+
+    // phrases[i] gains bonuses[i] per matched token
+    Error Load(const vec<vec<TokenId>>& phrases, const vec<f32>& bonuses, size_t vocab_size) {
+        SIO_CHECK(Empty());
+        SIO_CHECK_EQ(phrases.size(), bonuses.size());
+
+        // 1. trie
+        hashtab<u64, LmStateId> trie;
+        vec<vec<std::pair<TokenId, LmStateId>>> children(1);
+        vec<LmScore> bonus(1, 0.0); // of phrases ending at a state
+        potential_.assign(1, 0.0);
+        for (size_t p = 0; p != phrases.size(); p++) {
+            const vec<TokenId>& phrase = phrases[p];
+            if (phrase.empty()) continue;
+
+            LmStateId s = 0;
+            for (size_t d = 0; d != phrase.size(); d++) {
+                TokenId t = phrase[d];
+                SIO_CHECK(t >= 0 && t < vocab_size);
+                auto res = trie.insert({Key(s, t), static_cast<LmStateId>(potential_.size())});
+                if (res.second) {
+                    children[s].push_back({t, res.first->second});
+                    children.emplace_back();
+                    bonus.push_back(0.0);
+                    potential_.push_back(0.0);
+                }
+                s = res.first->second;
+                potential_[s] = std::max(potential_[s], bonuses[p] * (d + 1));
+            }
+            bonus[s] += bonuses[p] * phrase.size();
+            num_phrases_++;
+        }
+
+        // 2. failure links & deterministic transitions, breadth first so suffixes are resolved before their extensions
+        size_t num_states = potential_.size();
+        vec<LmStateId> fail(num_states, 0);
+        vec<vec<std::pair<TokenId, LmStateId>>> arcs(num_states); // stored transitions by state, dropped after load
+        gain_.assign(num_states, 0.0);
+
+        root_next_.assign(vocab_size, 0);
+        for (const auto& c : children[0]) {
+            root_next_[c.first] = c.second;
+        }
+
+        vec<LmStateId> queue;
+        for (const auto& c : children[0]) {
+            OnStateReached(c.second, 0, children, bonus, fail);
+            queue.push_back(c.second);
+        }
+        for (size_t i = 0; i != queue.size(); i++) {
+            LmStateId s = queue[i];
+
+            // inherits stored transitions of its failure state, overridden by its own children
+            arcs[s] = children[s];
+            for (const auto& a : arcs[fail[s]]) {
+                if (trie.find(Key(s, a.first)) == trie.end()) {
+                    arcs[s].push_back(a);
+                }
+            }
+            for (const auto& a : arcs[s]) {
+                next_[Key(s, a.first)] = a.second;
+            }
+
+            for (const auto& c : children[s]) {
+                OnStateReached(c.second, Next(fail[s], c.first), children, bonus, fail);
+                queue.push_back(c.second);
+            }
+        }
+
+        // 3. score bounds, transitions not stored leave from states with non-negative potential
+        score_bound_.assign(vocab_size, 0.0);
+        for (TokenId t = 0; t != vocab_size; t++) {
+            score_bound_[t] = gain_[root_next_[t]];
+        }
+        for (const auto& kv : next_) {
+            TokenId t = static_cast<TokenId>(kv.first & 0xFFFFFFFFu);
+            LmStateId s = static_cast<LmStateId>(kv.first >> 32);
+            score_bound_[t] = std::max(score_bound_[t], gain_[kv.second] - potential_[s]);
+        }
+
+        SIO_INFO << "Context graph loaded: " << num_phrases_ << " phrases, "
+                 << NumStates() << " states, " << next_.size() << " stored transitions";
+
+        return Error::OK;
+    }
+
+
+    // One phrase per line, tokens separated by spaces, optionally followed by a tab & its per-token bonus.
+    // Phrases with tokens out of vocabulary are skipped.
+    Error Load(std::istream& is, const Tokenizer& tokenizer, f32 bonus) {
+        vec<vec<TokenId>> phrases;
+        vec<f32> bonuses;
+
+        str line;
+        while (std::getline(is, line)) {
+            vec<str> cols = absl::StrSplit(line, '\t', absl::SkipWhitespace());
+            if (cols.empty()) continue;
+            SIO_CHECK_LE(cols.size(), 2);
+
+            vec<TokenId> phrase;
+            vec<str> tokens = absl::StrSplit(cols[0], ' ', absl::SkipWhitespace());
+            for (const str& token : tokens) {
+                if (!tokenizer.Contains(token)) {
+                    SIO_WARNING << "Context phrase skipped, unknown token: " << token << " in " << line;
+                    phrase.clear();
+                    break;
+                }
+                phrase.push_back(tokenizer.Index(token));
+            }
+            if (phrase.empty()) continue;
+
+            phrases.push_back(std::move(phrase));
+            bonuses.push_back(cols.size() == 2 ? std::stof(cols[1]) : bonus);
+        }
+
+        return Load(phrases, bonuses, tokenizer.Size());
+    }
+
+
+    bool Empty() const { return potential_.empty(); }
+    size_t NumStates() const { return potential_.size(); }
+    size_t NumPhrases() const { return num_phrases_; }
+
+
+    inline LmStateId Next(LmStateId s, TokenId t) const {
+        if (t < 0 || t >= root_next_.size()) {
+            return 0;
+        }
+        if (s != 0) {
+            auto it = next_.find(Key(s, t));
+            if (it != next_.end()) {
+                return it->second;
+            }
+        }
+        return root_next_[t];
+    }
+
+
+    inline LmScore GetScore(LmStateId s, TokenId t, LmStateId* next) const {
+        *next = Next(s, t);
+        return gain_[*next] - potential_[s];
+    }
+
+
+    inline LmScore ScoreUpperBound(TokenId t) const {
+        return (t < 0 || t >= score_bound_.size()) ? 0.0 : score_bound_[t];
+    }
+
+private:
+
+    static inline u64 Key(LmStateId s, TokenId t) {
+        return (static_cast<u64>(s) << 32) | static_cast<u32>(t);
+    }
+
+
+    // s is entered from trie with failure state f, its suffixes are all settled
+    void OnStateReached(LmStateId s, LmStateId f,
+        const vec<vec<std::pair<TokenId, LmStateId>>>& children, const vec<LmScore>& bonus, vec<LmStateId>& fail)
+    {
+        fail[s] = f;
+        if (children[s].empty()) { // a full match with nothing to extend, partial match continues from suffix
+            potential_[s] = potential_[f];
+        }
+        gain_[s] = potential_[s] + bonus[s] + (gain_[f] - potential_[f]);
+    }
+
+}; // class ContextGraph
+} // namespace sio
+#endif
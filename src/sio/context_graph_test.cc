@@ -0,0 +1,104 @@
+#include "sio/context_graph.h"
+
+#include <chrono>
+#include <random>
+#include <sstream>
+
+#include "gtest/gtest.h"
+
+namespace sio {
+
+TEST(ContextGraph, AhoCorasick) {
+    ContextGraph graph;
+    graph.Load({{1, 2, 3}, {2, 3}, {5, 6}}, {1.0, 1.0, 1.0}, 10);
+    EXPECT_EQ(graph.NumPhrases(), 3);
+    EXPECT_EQ(graph.NumStates(), 8);
+
+    auto walk = [&](const vec<TokenId>& tokens) {
+        LmStateId s = 0;
+        LmScore total = 0.0;
+        for (TokenId t : tokens) {
+            total += graph.GetScore(s, t, &s);
+        }
+        return total;
+    };
+
+    EXPECT_FLOAT_EQ(walk({1, 2}), 2.0); // partial match
+    EXPECT_FLOAT_EQ(walk({1, 2, 3}), 5.0); // "2 3" completes along with "1 2 3"
+    EXPECT_FLOAT_EQ(walk({1, 2, 3, 4}), 5.0); // completed bonuses are kept
+    EXPECT_FLOAT_EQ(walk({5, 7}), 0.0); // broken partial match is revoked
+    EXPECT_FLOAT_EQ(walk({1, 5, 6}), 2.0); // failure to root, then "5 6"
+    EXPECT_FLOAT_EQ(walk({1, 2, 2, 3}), 2.0); // failure to "2"
+
+    for (LmStateId s = 0; s != graph.NumStates(); s++) {
+        for (TokenId t = 0; t != 10; t++) {
+            LmStateId next;
+            EXPECT_LE(graph.GetScore(s, t, &next), graph.ScoreUpperBound(t));
+        }
+    }
+}
+
+
+TEST(ContextGraph, LoadText) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+
+    std::istringstream is(
+        "中 国\n"
+        "中 国 人\t3.0\n"
+        "中 no_such_token\n"
+        "\n"
+    );
+    ContextGraph graph;
+    graph.Load(is, tokenizer, 1.0);
+    EXPECT_EQ(graph.NumPhrases(), 2);
+
+    LmStateId s = 0;
+    LmScore total = 0.0;
+    for (const char* t : {"中", "国", "人"}) {
+        total += graph.GetScore(s, tokenizer.Index(t), &s);
+    }
+    EXPECT_FLOAT_EQ(total, 2.0 + 9.0);
+}
+
+
+TEST(ContextGraph, DISABLED_Benchmark) {
+    const int vocab_size = 5000;
+    std::mt19937 rng(777);
+
+    vec<vec<TokenId>> phrases;
+    for (int i = 0; i != 10000; i++) {
+        vec<TokenId> phrase(2 + rng() % 5);
+        for (TokenId& t : phrase) {
+            t = rng() % vocab_size;
+        }
+        phrases.push_back(phrase);
+    }
+    vec<f32> bonuses(phrases.size(), 2.0);
+
+    auto start = std::chrono::steady_clock::now();
+    ContextGraph graph;
+    graph.Load(phrases, bonuses, vocab_size);
+    std::chrono::duration<double> load = std::chrono::steady_clock::now() - start;
+
+    // random walk, entering phrases every few tokens so that non-root states are queried
+    vec<TokenId> tokens;
+    for (int i = 0; i != 1000000; i++) {
+        const vec<TokenId>& p = phrases[rng() % phrases.size()];
+        tokens.insert(tokens.end(), p.begin(), p.begin() + 1 + rng() % p.size());
+        tokens.push_back(rng() % vocab_size);
+    }
+
+    start = std::chrono::steady_clock::now();
+    LmStateId s = 0;
+    LmScore total = 0.0;
+    for (TokenId t : tokens) {
+        total += graph.GetScore(s, t, &s);
+    }
+    std::chrono::duration<double> query = std::chrono::steady_clock::now() - start;
+
+    SIO_INFO << "10k phrases: " << graph.NumStates() << " states, load " << load.count() * 1e3 << " ms, "
+             << query.count() * 1e9 / tokens.size() << " ns per lookup, total score " << total;
+}
+
+} // namespace sio
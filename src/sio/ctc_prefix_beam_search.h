@@ -0,0 +1,713 @@
+#ifndef SIO_CTC_PREFIX_BEAM_SEARCH_H
+#define SIO_CTC_PREFIX_BEAM_SEARCH_H
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <torch/torch.h>
+
+#include "sio/base.h"
+#include "sio/struct_loader.h"
+#include "sio/binary_io.h"
+#include "sio/tokenizer.h"
+#include "sio/language_model.h"
+#include "sio/beam_search_itf.h"
+
+namespace sio {
+
+struct CtcPrefixBeamSearchConfig {
+    i32 beam_size = 10; // prefixes kept after each frame
+    i32 token_topk = 10; // candidate tokens expanded per frame
+    f32 token_beam = 10.0; // candidate tokens score within this of frame's best token
+
+    i32 nbest = 1;
+
+    f32 insertion_penalty = 0.0;
+
+    Error Register(StructLoader* loader, const std::string module = "") {
+        loader->AddEntry(module + ".beam_size", &beam_size);
+        loader->AddEntry(module + ".token_topk", &token_topk);
+        loader->AddEntry(module + ".token_beam", &token_beam);
+
+        loader->AddEntry(module + ".nbest", &nbest);
+
+        loader->AddEntry(module + ".insertion_penalty", &insertion_penalty);
+
+        return Error::OK;
+    }
+};
+
+
+// Max of n scores, 8 lanes at a time with AVX2.
+static inline f32 FrameMax(const float* score, int n) {
+    int i = 0;
+    f32 m = -std::numeric_limits<f32>::infinity();
+#ifdef __AVX2__
+    if (n >= 8) {
+        __m256 x = _mm256_loadu_ps(score);
+        for (i = 8; i + 8 <= n; i += 8) {
+            x = _mm256_max_ps(x, _mm256_loadu_ps(score + i));
+        }
+        __m128 y = _mm_max_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+        y = _mm_max_ps(y, _mm_movehl_ps(y, y));
+        y = _mm_max_ss(y, _mm_shuffle_ps(y, y, 1));
+        m = _mm_cvtss_f32(y);
+    }
+#endif
+    for (; i != n; i++) {
+        m = std::max(m, score[i]);
+    }
+    return m;
+}
+
+
+// Appends indexes of scores >= score_min, survivors of a block of 8 are found by one AVX2 compare.
+static inline void FrameCandidates(const float* score, int n, f32 score_min, vec<TokenId>* candidates) {
+    int i = 0;
+#ifdef __AVX2__
+    const __m256 threshold = _mm256_set1_ps(score_min);
+    for (; i + 8 <= n; i += 8) {
+        u32 mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(score + i), threshold, _CMP_GE_OQ));
+        for (; mask != 0; mask &= mask - 1) {
+            candidates->push_back(i + __builtin_ctz(mask));
+        }
+    }
+#endif
+    for (; i != n; i++) {
+        if (score[i] >= score_min) {
+            candidates->push_back(i);
+        }
+    }
+}
+
+
+/*
+ * CTC prefix beam search: hypotheses are output prefixes instead of graph states,
+ * each prefix carries two scores, of alignments ending in blank & ending in its last token,
+ * so that repeated tokens are collapsed only when not separated by blank.
+ *
+ * No decoding graph is needed, which makes it a cheap decoder for LM-free high-QPS services.
+ * An optional LanguageModel is shallow-fused when a prefix is extended.
+ *
+ * Prefixes are hash-consed into a trie: a prefix is a (parent prefix, token) node,
+ * so extending/merging a hypothesis is O(1), and tokens shared by all surviving
+ * prefixes(their common ancestor) are committed incrementally.
+ * Only prefixes surviving pruning are interned, and once the trie doubles since last compaction,
+ * nodes no surviving prefix descends from are dropped, so it is bounded by committed tokens
+ * plus uncommitted branches of the beam, instead of growing with every frame of a long session.
+ */
+class CtcPrefixBeamSearch : public BeamSearchItf {
+    using NodeId = u32;
+    static constexpr NodeId kRoot = 0;
+    static constexpr NodeId kPending = std::numeric_limits<NodeId>::max(); // not interned yet
+    static constexpr f32 kLogZero = -std::numeric_limits<f32>::infinity();
+    static constexpr size_t kMinCompactSize = 1024;
+
+    struct PrefixNode {
+        NodeId parent = 0;
+        TokenId token = kNoTokenId; // last token of prefix, kNoTokenId for root
+        int depth = 0;
+        LmStateId lm_state = 0;
+        f32 lm_score = 0.0; // LM & insertion scores of whole prefix
+        int last_emit = 0; // latest frame where prefix's last token dominates
+        int first_emit = 0; // frame where prefix's last token is first emitted
+        f32 emit_score = 0.0; // log posterior of last token at first_emit
+    };
+
+    // A prefix hypothesis of current frame, not interned into trie before it survives pruning.
+    struct Prefix {
+        NodeId node = kPending;
+        NodeId parent = 0;
+        TokenId token = kNoTokenId;
+
+        LmStateId lm_state = 0;
+        f32 lm_score = 0.0;
+
+        f32 blank_score = kLogZero;
+        f32 nonblank_score = kLogZero;
+
+        inline f32 AmScore() const { return LogAddExp(blank_score, nonblank_score); }
+        inline f32 TotalScore() const { return AmScore() + lm_score; }
+    };
+
+    CtcPrefixBeamSearchConfig config_;
+    const Tokenizer* tokenizer_ = nullptr;
+    LanguageModel* lm_ = nullptr; // optional, owned outside
+
+    SearchStats stats_; // stays empty
+    vec<SearchStats> stats_histogram_;
+
+    str session_key_;
+    int cur_time_ = 0;
+    int num_frames_ = 0;
+
+    vec<PrefixNode> nodes_;
+    hashtab<u64, NodeId> children_; // (parent, token) -> child node
+    size_t compact_size_ = kMinCompactSize; // trie size triggering next compaction
+    vec<NodeId> remap_; // old -> new node id during compaction
+
+    vec<Prefix> beam_; // sorted, best first
+    vec<Prefix> next_;
+    hashtab<u64, int> next_index_; // (parent, token) -> index in next_
+
+    vec<TokenId> candidates_;
+    const float* frame_score_ = nullptr; // for candidate sorting
+
+    NodeId committed_node_ = kRoot;
+    vec<TokenId> committed_;
+
+    // effective limits under RTF budget degradation, see SetDegradation()
+    i32 beam_size_ = 0;
+    f32 token_beam_ = 0.0;
+
+    vec<vec<TokenId>> nbest_;
+    vec<OutputAlignment> alignment_;
+
+public:
+
+    Error Load(const CtcPrefixBeamSearchConfig& config, const Tokenizer& tokenizer, LanguageModel* lm = nullptr) {
+        config_ = config;
+        SIO_CHECK_GT(config_.beam_size, 0);
+        SIO_CHECK_GT(config_.token_topk, 0);
+
+        SIO_CHECK(tokenizer_ == nullptr);
+        tokenizer_ = &tokenizer;
+
+        lm_ = lm;
+
+        beam_size_ = config_.beam_size;
+        token_beam_ = config_.token_beam;
+
+        return Error::OK;
+    }
+
+
+    Error AttachClassGraph(FstLabel nonterminal, const Fst& graph) override {
+        SIO_CHECK(false); // prefix search works without decoding graph
+        return Error::AssertionFailure;
+    }
+
+
+    Error AttachContextGraph(const ContextGraph& graph) override {
+        SIO_CHECK(false); // prefix search takes its LM at load time
+        return Error::AssertionFailure;
+    }
+
+
+    Error InitSession(const char* session_key) override {
+        session_key_ = session_key;
+        num_frames_ = 0;
+
+        beam_size_ = config_.beam_size;
+        token_beam_ = config_.token_beam;
+
+        InitSegment();
+
+        return Error::OK;
+    }
+
+
+    Error Push(const torch::Tensor score) override {
+        SIO_CHECK_EQ(score.dim(), 1); // frame by frame
+
+        frame_score_ = score.data_ptr<float>();
+        SelectCandidates(score.size(0));
+        ExpandPrefixes();
+        PrunePrefixes();
+        CommitPrefix();
+        CompactTrie();
+
+        cur_time_++;
+        num_frames_++;
+
+        return Error::OK;
+    }
+
+
+    Error PushEos() override {
+        SIO_CHECK(nbest_.empty());
+
+        if (lm_ != nullptr) {
+            for (Prefix& p : beam_) {
+                LmStateId s;
+                p.lm_score += lm_->GetScore(p.lm_state, tokenizer_->eos, &s);
+            }
+            std::sort(beam_.begin(), beam_.end(), [](const Prefix& x, const Prefix& y) {
+                return x.TotalScore() > y.TotalScore();
+            });
+        }
+
+        for (int k = 0; k < config_.nbest && k < beam_.size(); k++) {
+            vec<TokenId> path = {tokenizer_->eos}; // same convention as graph search outputs
+            for (NodeId n = beam_[k].node; n != kRoot; n = nodes_[n].parent) {
+                path.push_back(nodes_[n].token);
+            }
+            path.push_back(tokenizer_->bos);
+            std::reverse(path.begin(), path.end());
+            nbest_.push_back(std::move(path));
+        }
+
+        AlignBestPrefix();
+
+        return Error::OK;
+    }
+
+
+    const vec<vec<TokenId>>& NBest() override {
+        return nbest_;
+    }
+
+
+    // Prefixes keep no per-frame scores: spans are from first emitted to last dominated frames of tokens,
+    // and acoustic score & confidence come from the posterior of the first emitted frame.
+    const vec<OutputAlignment>& BestAlignment() override {
+        return alignment_;
+    }
+
+
+    // Tokens shared by all surviving prefixes, they are stable and only grow during a segment.
+    const vec<TokenId>& CommittedPath() const override {
+        return committed_;
+    }
+
+
+    Error PartialPath(vec<TokenId>* path) const override {
+        SIO_CHECK(path != nullptr);
+        path->clear();
+
+        for (NodeId n = beam_[0].node; n != committed_node_; n = nodes_[n].parent) {
+            path->push_back(nodes_[n].token);
+        }
+        std::reverse(path->begin(), path->end());
+
+        return Error::OK;
+    }
+
+
+    // Every prefix can end at any frame, so only blank length rules apply(relative cost is always 0).
+    bool EndpointDetected(const EndpointConfig& config) const override {
+        if (cur_time_ >= config.max_segment_length) {
+            return true;
+        }
+
+        const PrefixNode& best = nodes_[beam_[0].node];
+        int trailing_blank = cur_time_ - best.last_emit;
+        if (beam_[0].node == kRoot) {
+            return trailing_blank >= config.max_silence;
+        }
+
+        return trailing_blank >= config.min_trailing_blank;
+    }
+
+
+    Error ResetSegment() override {
+        DeinitSegment();
+        InitSegment();
+
+        return Error::OK;
+    }
+
+
+    // Prefix beam maps to max_active, candidate token beam to beam.
+    // The only LM is the primary one, it is never dropped.
+    Error SetDegradation(int level, const RtfBudgetConfig& config) override {
+        SIO_CHECK_GE(level, 0);
+        beam_size_ = std::max(1, static_cast<i32>(config_.beam_size * std::pow(config.max_active_scale, level)));
+        token_beam_ = config_.token_beam * std::pow(config.beam_scale, level);
+
+        return Error::OK;
+    }
+
+
+    // Trie is written as is(with its compaction point), so a restored search revives pruned prefixes
+    // from the same nodes(and first emitted frames) as the original one.
+    // LM states are written as is, so an external LM must have process independent states.
+    Error Snapshot(std::ostream& os) override {
+        SIO_CHECK(nbest_.empty()); // before PushEos()
+
+        using kaldi::WriteToken;
+        using kaldi::WriteBasicType;
+
+        bool binary = true;
+
+        WriteToken(os, binary, "<CtcPrefixBeamSearch>");
+        WriteString(os, session_key_);
+        WriteBasicType(os, binary, num_frames_);
+        WriteBasicType(os, binary, beam_size_);
+        WriteBasicType(os, binary, token_beam_);
+
+        WriteBasicType(os, binary, cur_time_);
+        WritePodVector(os, nodes_);
+        WriteBasicType(os, binary, compact_size_);
+        WritePodVector(os, beam_);
+        WriteBasicType(os, binary, committed_node_);
+        WritePodVector(os, committed_);
+
+        return os.good() ? Error::OK : Error::Unknown;
+    }
+
+
+    Error Restore(std::istream& is) override {
+        using kaldi::ExpectToken;
+        using kaldi::ReadBasicType;
+
+        bool binary = true;
+
+        ExpectToken(is, binary, "<CtcPrefixBeamSearch>");
+        str session_key;
+        ReadString(is, &session_key);
+
+        InitSession(session_key.c_str());
+        DeinitSegment();
+
+        ReadBasicType(is, binary, &num_frames_);
+        ReadBasicType(is, binary, &beam_size_);
+        ReadBasicType(is, binary, &token_beam_);
+
+        ReadBasicType(is, binary, &cur_time_);
+        ReadPodVector(is, &nodes_);
+        ReadBasicType(is, binary, &compact_size_);
+        ReadPodVector(is, &beam_);
+        ReadBasicType(is, binary, &committed_node_);
+        ReadPodVector(is, &committed_);
+
+        for (NodeId n = 1; n < nodes_.size(); n++) {
+            children_[PrefixKey(nodes_[n].parent, nodes_[n].token)] = n;
+        }
+
+        return is.good() ? Error::OK : Error::Unknown;
+    }
+
+
+    Error DeinitSession() override {
+        DeinitSegment();
+
+        return Error::OK;
+    }
+
+
+    int NumFrames() const override { return num_frames_; }
+    int NumSkippedFrames() const override { return 0; }
+    int NumEpsReexpansions() const override { return 0; }
+    f32 BeamTightening() const override { return 0.0; }
+
+    // num of interned prefixes
+    size_t TokenArenaSize() const override { return nodes_.size(); }
+    size_t NumLatticeFrames() const override { return 0; } // prefixes keep no per-frame state
+
+    // prefix search keeps no search counters
+    const SearchStats& FrameStats() const override { return stats_; }
+    const SearchStats& SessionStats() const override { return stats_; }
+    const vec<SearchStats>& FrameStatsHistogram() const override { return stats_histogram_; }
+
+private:
+
+    Error InitSegment() {
+        SIO_CHECK(nodes_.empty());
+
+        PrefixNode root;
+        if (lm_ != nullptr) {
+            root.lm_score = lm_->GetScore(lm_->NullState(), tokenizer_->bos, &root.lm_state);
+        }
+        nodes_.push_back(root);
+
+        Prefix p;
+        p.node = kRoot;
+        p.lm_state = root.lm_state;
+        p.lm_score = root.lm_score;
+        p.blank_score = 0.0;
+        beam_.push_back(p);
+
+        return Error::OK;
+    }
+
+
+    Error DeinitSegment() {
+        cur_time_ = 0;
+
+        nodes_.clear();
+        children_.clear();
+        compact_size_ = kMinCompactSize;
+
+        beam_.clear();
+        next_.clear();
+        next_index_.clear();
+
+        committed_node_ = kRoot;
+        committed_.clear();
+
+        nbest_.clear();
+        alignment_.clear();
+
+        return Error::OK;
+    }
+
+
+    static inline u64 PrefixKey(NodeId parent, TokenId token) {
+        return (static_cast<u64>(static_cast<u32>(token)) << 32) | parent;
+    }
+
+
+    // Top-k tokens of current frame within token_beam of the best one, special tokens except blank are excluded.
+    void SelectCandidates(int n) {
+        candidates_.clear();
+        FrameCandidates(frame_score_, n, FrameMax(frame_score_, n) - token_beam_, &candidates_);
+
+        const Tokenizer& tk = *tokenizer_;
+        candidates_.erase(
+            std::remove_if(candidates_.begin(), candidates_.end(), [&tk](TokenId t) {
+                return t != tk.blk && (t == tk.unk || t == tk.bos || t == tk.eos);
+            }),
+            candidates_.end()
+        );
+
+        if (candidates_.size() > config_.token_topk) {
+            const float* s = frame_score_;
+            std::nth_element(candidates_.begin(), candidates_.begin() + config_.token_topk, candidates_.end(),
+                [s](TokenId x, TokenId y) { return s[x] > s[y]; }
+            );
+            candidates_.resize(config_.token_topk);
+        }
+    }
+
+
+    // Prefix of next frame extended from parent by token, created on first reach.
+    Prefix& NextPrefix(NodeId parent, TokenId token) {
+        u64 key = PrefixKey(parent, token);
+        auto it = next_index_.find(key);
+        if (it != next_index_.end()) {
+            return next_[it->second];
+        }
+
+        next_index_[key] = next_.size();
+        next_.emplace_back();
+        Prefix& p = next_.back();
+        p.parent = parent;
+        p.token = token;
+
+        auto c = children_.find(key);
+        if (c != children_.end()) { // interned earlier, LM scores are reused
+            const PrefixNode& node = nodes_[c->second];
+            p.node = c->second;
+            p.lm_state = node.lm_state;
+            p.lm_score = node.lm_score;
+        } else {
+            const PrefixNode& par = nodes_[parent];
+            p.lm_state = par.lm_state;
+            p.lm_score = par.lm_score - config_.insertion_penalty;
+            if (lm_ != nullptr) {
+                p.lm_score += lm_->GetScore(par.lm_state, token, &p.lm_state);
+            }
+        }
+
+        return p;
+    }
+
+
+    // Prefix of next frame same as an interned node.
+    Prefix& NextPrefix(NodeId node) {
+        const PrefixNode& n = nodes_[node];
+        u64 key = PrefixKey(n.parent, n.token);
+        auto it = next_index_.find(key);
+        if (it != next_index_.end()) {
+            return next_[it->second];
+        }
+
+        next_index_[key] = next_.size();
+        next_.emplace_back();
+        Prefix& p = next_.back();
+        p.node = node;
+        p.parent = n.parent;
+        p.token = n.token;
+        p.lm_state = n.lm_state;
+        p.lm_score = n.lm_score;
+
+        return p;
+    }
+
+
+    void ExpandPrefixes() {
+        SIO_CHECK(next_.empty());
+        const TokenId blk = tokenizer_->blk;
+
+        for (int i = 0; i != beam_.size(); i++) {
+            // copy, next_ grows while iterating
+            const NodeId node = beam_[i].node;
+            const f32 blank_score = beam_[i].blank_score;
+            const f32 nonblank_score = beam_[i].nonblank_score;
+            const f32 am_score = beam_[i].AmScore();
+            const TokenId last = nodes_[node].token;
+
+            for (TokenId t : candidates_) {
+                f32 s = frame_score_[t];
+                if (t == blk) {
+                    Prefix& p = NextPrefix(node);
+                    p.blank_score = LogAddExp(p.blank_score, am_score + s);
+                } else if (t == last) {
+                    // repeat collapses into same prefix, unless separated by blank
+                    if (nonblank_score != kLogZero) {
+                        Prefix& p = NextPrefix(node);
+                        p.nonblank_score = LogAddExp(p.nonblank_score, nonblank_score + s);
+                    }
+                    if (blank_score != kLogZero) {
+                        Prefix& q = NextPrefix(node, t);
+                        q.nonblank_score = LogAddExp(q.nonblank_score, blank_score + s);
+                    }
+                } else {
+                    Prefix& q = NextPrefix(node, t);
+                    q.nonblank_score = LogAddExp(q.nonblank_score, am_score + s);
+                }
+            }
+        }
+    }
+
+
+    // Keeps beam_size best prefixes, interns survivors into trie.
+    void PrunePrefixes() {
+        auto better = [](const Prefix& x, const Prefix& y) {
+            return x.TotalScore() > y.TotalScore();
+        };
+        if (next_.empty()) { // no candidate token this frame, prefixes stay as they are
+            return;
+        }
+        if (next_.size() > beam_size_) {
+            std::nth_element(next_.begin(), next_.begin() + beam_size_, next_.end(), better);
+            next_.resize(beam_size_);
+        }
+        std::sort(next_.begin(), next_.end(), better);
+        next_index_.clear();
+
+        // keep scores in a good dynamic range, ranking is unchanged
+        f32 offset = next_[0].AmScore();
+
+        for (Prefix& p : next_) {
+            p.blank_score -= offset;
+            p.nonblank_score -= offset;
+
+            if (p.node == kPending) {
+                p.node = nodes_.size();
+                children_[PrefixKey(p.parent, p.token)] = p.node;
+
+                PrefixNode n;
+                n.parent = p.parent;
+                n.token = p.token;
+                n.depth = nodes_[p.parent].depth + 1;
+                n.lm_state = p.lm_state;
+                n.lm_score = p.lm_score;
+                n.first_emit = cur_time_;
+                n.emit_score = frame_score_[p.token];
+                nodes_.push_back(n);
+            }
+            if (p.nonblank_score >= p.blank_score) {
+                nodes_[p.node].last_emit = cur_time_ + 1;
+            }
+        }
+
+        beam_.swap(next_);
+        next_.clear();
+    }
+
+
+    void AlignBestPrefix() {
+        SIO_CHECK(alignment_.empty());
+        if (beam_.empty()) {
+            return;
+        }
+
+        for (NodeId n = beam_[0].node; n != kRoot; n = nodes_[n].parent) {
+            const PrefixNode& node = nodes_[n];
+
+            OutputAlignment a;
+            a.token = node.token;
+            a.begin_frame = node.first_emit;
+            a.end_frame = std::max(node.last_emit, node.first_emit + 1);
+            a.am_score = node.emit_score;
+            a.lm_score = node.lm_score - nodes_[node.parent].lm_score;
+            a.confidence = std::exp(node.emit_score);
+            alignment_.push_back(a);
+        }
+        std::reverse(alignment_.begin(), alignment_.end());
+    }
+
+
+    // Advances committed node to the deepest common ancestor of surviving prefixes.
+    // Surviving prefixes all descend from previous committed node, so the walk is bounded by uncommitted depth.
+    void CommitPrefix() {
+        int depth = nodes_[beam_[0].node].depth;
+        for (const Prefix& p : beam_) {
+            depth = std::min(depth, nodes_[p.node].depth);
+        }
+
+        NodeId common = beam_[0].node;
+        while (nodes_[common].depth > depth) {
+            common = nodes_[common].parent;
+        }
+        for (const Prefix& p : beam_) {
+            NodeId n = p.node;
+            while (nodes_[n].depth > depth) {
+                n = nodes_[n].parent;
+            }
+            while (n != common) { // both are at same depth
+                n = nodes_[n].parent;
+                common = nodes_[common].parent;
+                depth--;
+            }
+        }
+
+        size_t k = committed_.size();
+        for (NodeId n = common; n != committed_node_; n = nodes_[n].parent) {
+            committed_.push_back(nodes_[n].token);
+        }
+        std::reverse(committed_.begin() + k, committed_.end());
+        committed_node_ = common;
+    }
+
+
+    // Drops nodes no surviving prefix descends from, a pruned prefix revived later is interned again.
+    // Live nodes keep their order, so parents still precede children and are renumbered first.
+    void CompactTrie() {
+        if (nodes_.size() < compact_size_) {
+            return;
+        }
+
+        remap_.assign(nodes_.size(), static_cast<NodeId>(kPending)); // no ODR-use of constants in C++14
+        remap_[kRoot] = kRoot;
+        for (const Prefix& p : beam_) {
+            for (NodeId n = p.node; remap_[n] == kPending; n = nodes_[n].parent) {
+                remap_[n] = kRoot; // marked, renumbered below
+            }
+        }
+
+        NodeId live = 1;
+        for (NodeId n = 1; n != nodes_.size(); n++) {
+            if (remap_[n] == kPending) {
+                continue;
+            }
+            remap_[n] = live;
+            PrefixNode node = nodes_[n];
+            node.parent = remap_[node.parent];
+            nodes_[live++] = node;
+        }
+        nodes_.resize(live);
+
+        children_.clear();
+        for (NodeId n = 1; n != nodes_.size(); n++) {
+            children_[PrefixKey(nodes_[n].parent, nodes_[n].token)] = n;
+        }
+        for (Prefix& p : beam_) {
+            p.node = remap_[p.node];
+            p.parent = remap_[p.parent];
+        }
+        committed_node_ = remap_[committed_node_];
+
+        compact_size_ = std::max(static_cast<size_t>(kMinCompactSize), 2 * nodes_.size());
+    }
+
+}; // class CtcPrefixBeamSearch
+}  // namespace sio
+#endif
@@ -0,0 +1,246 @@
+#include "sio/ctc_prefix_beam_search.h"
+
+#include <random>
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+#include "sio/beam_search.h"
+
+namespace sio {
+
+TEST(CtcPrefixBeamSearch, FrameCandidates) {
+    std::mt19937 rng(777);
+    std::uniform_real_distribution<f32> u(-20.0, 0.0);
+    vec<f32> score(4099); // not a multiple of SIMD width
+    for (auto& s : score) {
+        s = u(rng);
+    }
+
+    f32 m = FrameMax(score.data(), score.size());
+    EXPECT_EQ(m, *std::max_element(score.begin(), score.end()));
+
+    vec<TokenId> candidates;
+    FrameCandidates(score.data(), score.size(), m - 1.0, &candidates);
+    vec<TokenId> expected;
+    for (int i = 0; i != score.size(); i++) {
+        if (score[i] >= m - 1.0) {
+            expected.push_back(i);
+        }
+    }
+    EXPECT_EQ(candidates, expected);
+}
+
+
+TEST(CtcPrefixBeamSearch, Collapse) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+    TokenId x = tokenizer.Index("的");
+    TokenId y = tokenizer.Index("在");
+
+    auto frame = [&](TokenId t) {
+        vec<f32> score(tokenizer.Size(), -20.0);
+        score[t] = -0.1;
+        return torch::from_blob(score.data(), {(i64)score.size()}, torch::kFloat).clone();
+    };
+
+    BeamSearch search;
+    search.LoadCtcPrefixBeamSearch(CtcPrefixBeamSearchConfig(), tokenizer);
+
+    // x x blk x y y blk -> x x y
+    search.InitSession();
+    for (TokenId t : {x, x, tokenizer.blk, x, y, y, tokenizer.blk}) {
+        search.Push(frame(t));
+    }
+    vec<TokenId> partial;
+    search.PartialPath(&partial);
+    vec<TokenId> path = search.CommittedPath();
+    path.insert(path.end(), partial.begin(), partial.end());
+    EXPECT_EQ(path, vec<TokenId>({x, x, y}));
+
+    search.PushEos();
+    ASSERT_EQ(search.NBest().size(), 1);
+    EXPECT_EQ(search.NBest()[0], vec<TokenId>({tokenizer.bos, x, x, y, tokenizer.eos}));
+    search.DeinitSession();
+}
+
+
+// On peaky frames(one token dominates each frame), best prefix equals greedy CTC output,
+// while noise tokens within token_beam keep the beam full of competing prefixes.
+TEST(CtcPrefixBeamSearch, PeakyFramesMatchGreedy) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+
+    std::mt19937 rng(777);
+    std::uniform_real_distribution<f32> noise(-12.0, -6.0);
+    vec<f32> score(tokenizer.Size());
+
+    CtcPrefixBeamSearchConfig config;
+    config.beam_size = 8;
+    config.token_topk = 16;
+    BeamSearch search;
+    search.LoadCtcPrefixBeamSearch(config, tokenizer);
+
+    search.InitSession();
+    vec<TokenId> greedy = {tokenizer.bos};
+    TokenId prev = tokenizer.blk;
+    for (int t = 0; t != 500; t++) {
+        for (auto& s : score) {
+            s = noise(rng);
+        }
+        TokenId best = rng() % 3 == 0 ? 4 + rng() % 8 : tokenizer.blk; // few distinct tokens, so repeats occur
+        score[best] = -0.01;
+        if (best != tokenizer.blk && best != prev) {
+            greedy.push_back(best);
+        }
+        prev = best;
+
+        search.Push(torch::from_blob(score.data(), {(i64)score.size()}, torch::kFloat).clone());
+
+        const vec<TokenId>& committed = search.CommittedPath();
+        EXPECT_TRUE(std::equal(committed.begin(), committed.end(), greedy.begin() + 1));
+    }
+    greedy.push_back(tokenizer.eos);
+
+    search.PushEos();
+    EXPECT_EQ(search.NBest()[0], greedy);
+    search.DeinitSession();
+}
+
+
+// Pruned branches are compacted away, so trie is bounded by committed tokens instead of frames.
+TEST(CtcPrefixBeamSearch, LongSessionTrie) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+
+    std::mt19937 rng(777);
+    std::uniform_real_distribution<f32> noise(-12.0, -6.0);
+    vec<f32> score(tokenizer.Size());
+
+    CtcPrefixBeamSearchConfig config;
+    config.beam_size = 8;
+    config.token_topk = 16;
+    BeamSearch search;
+    search.LoadCtcPrefixBeamSearch(config, tokenizer);
+
+    search.InitSession();
+    vec<TokenId> greedy = {tokenizer.bos};
+    TokenId prev = tokenizer.blk;
+    for (int t = 0; t != 5000; t++) {
+        for (auto& s : score) {
+            s = noise(rng) + t * 1e-3; // rising noise, so older alternatives fall out of beam
+        }
+        TokenId best = rng() % 3 == 0 ? 4 + rng() % 8 : tokenizer.blk;
+        score[best] = -0.01;
+        if (best != tokenizer.blk && best != prev) {
+            greedy.push_back(best);
+        }
+        prev = best;
+
+        search.Push(torch::from_blob(score.data(), {(i64)score.size()}, torch::kFloat).clone());
+        EXPECT_LT(search.TokenArenaSize(), 2 * search.CommittedPath().size() + 2048);
+    }
+    greedy.push_back(tokenizer.eos);
+
+    search.PushEos();
+    EXPECT_EQ(search.NBest()[0], greedy);
+    ASSERT_EQ(search.BestAlignment().size(), greedy.size() - 2);
+    for (int i = 1; i != search.BestAlignment().size(); i++) {
+        EXPECT_LT(search.BestAlignment()[i - 1].begin_frame, search.BestAlignment()[i].begin_frame);
+    }
+    search.DeinitSession();
+}
+
+
+TEST(CtcPrefixBeamSearch, Snapshot) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+
+    std::mt19937 rng(777);
+    std::uniform_real_distribution<f32> noise(-8.0, -2.0); // flat enough to keep competing prefixes
+    vec<torch::Tensor> frames;
+    vec<f32> score(tokenizer.Size());
+    for (int t = 0; t != 400; t++) {
+        for (auto& s : score) {
+            s = noise(rng);
+        }
+        score[rng() % 3 == 0 ? 4 + rng() % 8 : tokenizer.blk] = -0.5;
+        frames.push_back(torch::from_blob(score.data(), {(i64)score.size()}, torch::kFloat).clone());
+    }
+
+    CtcPrefixBeamSearchConfig config;
+    config.nbest = 4;
+    BeamSearch search;
+    search.LoadCtcPrefixBeamSearch(config, tokenizer);
+    BeamSearch migrated;
+    migrated.LoadCtcPrefixBeamSearch(config, tokenizer);
+
+    search.InitSession();
+    for (int t = 0; t != 200; t++) {
+        search.Push(frames[t]);
+    }
+    std::stringstream blob;
+    ASSERT_EQ(search.Snapshot(blob), Error::OK);
+    ASSERT_EQ(migrated.Restore(blob), Error::OK);
+
+    for (int t = 200; t != frames.size(); t++) {
+        search.Push(frames[t]);
+        migrated.Push(frames[t]);
+    }
+    search.PushEos();
+    migrated.PushEos();
+    EXPECT_EQ(migrated.NBest(), search.NBest());
+    EXPECT_EQ(migrated.NumFrames(), search.NumFrames());
+
+    search.DeinitSession();
+    migrated.DeinitSession();
+}
+
+
+TEST(CtcPrefixBeamSearch, Endpoint) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+    TokenId x = tokenizer.Index("的");
+
+    auto frame = [&](TokenId t) {
+        vec<f32> score(tokenizer.Size(), -20.0);
+        score[t] = -0.1;
+        return torch::from_blob(score.data(), {(i64)score.size()}, torch::kFloat).clone();
+    };
+
+    BeamSearch search;
+    search.LoadCtcPrefixBeamSearch(CtcPrefixBeamSearchConfig(), tokenizer);
+
+    EndpointConfig endpoint;
+    endpoint.max_silence = 30;
+    endpoint.min_trailing_blank = 10;
+
+    search.InitSession();
+    for (int segment = 0; segment != 2; segment++) {
+        search.Push(frame(x));
+        search.Push(frame(x));
+        for (int t = 1; t != endpoint.min_trailing_blank; t++) {
+            search.Push(frame(tokenizer.blk));
+            EXPECT_FALSE(search.EndpointDetected(endpoint));
+        }
+        search.Push(frame(tokenizer.blk));
+        EXPECT_TRUE(search.EndpointDetected(endpoint));
+        EXPECT_EQ(search.CommittedPath(), vec<TokenId>({x}));
+
+        search.PushEos();
+        EXPECT_EQ(search.NBest()[0], vec<TokenId>({tokenizer.bos, x, tokenizer.eos}));
+        search.ResetSegment();
+    }
+
+    // silence only
+    for (int t = 1; t != endpoint.max_silence; t++) {
+        search.Push(frame(tokenizer.blk));
+        EXPECT_FALSE(search.EndpointDetected(endpoint));
+    }
+    search.Push(frame(tokenizer.blk));
+    EXPECT_TRUE(search.EndpointDetected(endpoint));
+
+    search.DeinitSession();
+}
+
+} // namespace sio
@@ -3,9 +3,11 @@
 
 #include <memory>
 
+#include "base/io-funcs.h"
 #include "feat/online-feature.h"
 
 #include "sio/base.h"
+#include "sio/binary_io.h"
 #include "sio/struct_loader.h"
 #include "sio/mean_var_norm.h"
 
@@ -40,6 +42,12 @@ class FeatureExtractor {
     // [cur_frame_, NumFramesReady()) ~ remainder frames.
     int cur_frame_ = 0;
 
+    // Kaldi online features can't be serialized, so pushed samples from the first one of frame cur_frame_ are kept,
+    // a session snapshot replays them into a fresh extractor. Exact when samples are at feature sample rate.
+    vec<f32> samples_;
+    i64 samples_begin_ = 0; // index of samples_[0] in samples pushed to pimpl_
+    f32 sample_rate_ = 0.0; // of pushed samples
+
 public:
 
     Error Load(const FeatureConfig& config, Nullable<const MeanVarNorm*> mvn = nullptr) { 
@@ -58,6 +66,16 @@ public:
 
 
     void Push(const f32* samples, size_t num_samples, f32 sample_rate) {
+        SIO_CHECK(sample_rate_ == 0.0 || sample_rate_ == sample_rate);
+        sample_rate_ = sample_rate;
+
+        i64 begin = FirstPendingSample();
+        if (begin > samples_begin_) {
+            samples_.erase(samples_.begin(), samples_.begin() + std::min<i64>(begin - samples_begin_, samples_.size()));
+            samples_begin_ = begin;
+        }
+        samples_.insert(samples_.end(), samples, samples + num_samples);
+
         pimpl_->AcceptWaveform(
             sample_rate, 
             kaldi::SubVector<f32>(samples, num_samples)
@@ -92,10 +110,54 @@ public:
         pimpl_ = std::make_unique<kaldi::OnlineFbank>(config_->fbank);
         cur_frame_ = 0;
 
+        samples_.clear();
+        samples_begin_ = 0;
+        sample_rate_ = 0.0;
+
         return Error::OK;
     }
 
 
+    // Frames ready but not popped are recomputed after Restore(), so only samples are written.
+    Error Snapshot(std::ostream& os) const {
+        using kaldi::WriteToken;
+        using kaldi::WriteBasicType;
+
+        bool binary = true;
+
+        i64 begin = std::max(FirstPendingSample(), samples_begin_);
+        vec<f32> samples(samples_.begin() + std::min<i64>(begin - samples_begin_, samples_.size()), samples_.end());
+
+        WriteToken(os, binary, "<FeatureExtractor>");
+        WriteBasicType(os, binary, sample_rate_);
+        WritePodVector(os, samples);
+
+        return os.good() ? Error::OK : Error::Unknown;
+    }
+
+
+    Error Restore(std::istream& is) {
+        using kaldi::ExpectToken;
+        using kaldi::ReadBasicType;
+
+        bool binary = true;
+
+        Clear();
+
+        ExpectToken(is, binary, "<FeatureExtractor>");
+        f32 sample_rate = 0.0;
+        ReadBasicType(is, binary, &sample_rate);
+        vec<f32> samples;
+        ReadPodVector(is, &samples);
+
+        if (!samples.empty()) {
+            Push(samples.data(), samples.size(), sample_rate);
+        }
+
+        return is.good() ? Error::OK : Error::Unknown;
+    }
+
+
     size_t Dim() const {
         return pimpl_->Dim();
     }
@@ -117,6 +179,17 @@ public:
         return 1000.0f / config_->fbank.frame_opts.frame_shift_ms;
     }
 
+private:
+
+    // first pushed sample still needed, i.e. the first one of frame cur_frame_
+    i64 FirstPendingSample() const {
+        if (sample_rate_ == 0.0) {
+            return 0;
+        }
+        const kaldi::FrameExtractionOptions& opts = config_->fbank.frame_opts;
+        return static_cast<i64>(static_cast<f64>(cur_frame_) * opts.WindowShift() * sample_rate_ / opts.samp_freq);
+    }
+
 }; // class FeatureExtractor
 }  // namespace sio
 #endif
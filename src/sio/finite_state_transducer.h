@@ -21,10 +21,19 @@ enum FstSpecialSymbol {
     kFstEps = -32768,
     kFstRho,
     kFstPhi,
+    kFstNonterminalBegin = -16384, // [begin, end) are reserved for nonterminals(class slots)
+    kFstNonterminalEnd = -2,
     kFstInputEnd = -1 // This conforms to K2 Fsa
 };
 
 
+// A nonterminal arc (ilabel = kFstEps, olabel = nonterminal) enters a class graph attached at runtime,
+// the class graph returns to the arc's destination via its kFstInputEnd arcs.
+inline bool IsNonterminal(FstLabel label) {
+    return label >= kFstNonterminalBegin && label < kFstNonterminalEnd;
+}
+
+
 struct FstState {
     FstArcId offset = 0;
 };
@@ -54,6 +63,12 @@ public:
 };
 
 
+struct ArcILabelLess {
+    bool operator()(const FstArc& arc, FstLabel label) const { return arc.ilabel < label; }
+    bool operator()(FstLabel label, const FstArc& arc) const { return label < arc.ilabel; }
+};
+
+
 struct Fst {
     str version; // TODO: make version a part of binary header
 
@@ -67,8 +82,11 @@ struct Fst {
     vec<FstState> states;  // one extra sentinel at the end: states.size() = num_states + 1
     vec<FstArc> arcs;
 
+    bool token_topology = false; // built by BuildTokenTopology(), lets beam search specialize on T
+    bool implicit = false; // arcs are not stored, beam search expands T procedurally from tokenizer
+
 
-    inline bool Empty() const { return this->states.empty(); }
+    inline bool Empty() const { return this->states.empty() && !this->implicit; }
 
     inline bool ContainEpsilonArc(FstStateId s) const {
         // Preconditions:
@@ -79,8 +97,20 @@ struct Fst {
     }
 
 
+    inline bool ContainInputEndArc(FstStateId s) const {
+        // arcs are sorted by ilabels: epsilons, then kFstInputEnd, then normal symbols
+        for (FstArcId i = this->states[s].offset; i != this->states[s+1].offset; i++) {
+            if (this->arcs[i].ilabel >= kFstInputEnd) {
+                return this->arcs[i].ilabel == kFstInputEnd;
+            }
+        }
+        return false;
+    }
+
+
     FstArcIterator GetArcIterator(FstStateId i) const {
         SIO_CHECK(!Empty());
+        SIO_CHECK(!this->implicit);
         SIO_CHECK_NE(i, this->states.size() - 1); // block external access to sentinel
         return FstArcIterator(
             &this->arcs[this->states[i  ].offset],
@@ -89,6 +119,21 @@ struct Fst {
     }
 
 
+    // Arcs of state i with given ilabel, via binary search on ilabel-sorted arcs.
+    FstArcIterator GetArcIterator(FstStateId i, FstLabel ilabel) const {
+        SIO_CHECK(!Empty());
+        SIO_CHECK(!this->implicit);
+        SIO_CHECK_NE(i, this->states.size() - 1);
+        auto range = std::equal_range(
+            this->arcs.data() + this->states[i  ].offset,
+            this->arcs.data() + this->states[i+1].offset,
+            ilabel,
+            ArcILabelLess()
+        );
+        return FstArcIterator(range.first, range.second);
+    }
+
+
     Error Load(std::istream& is) {
         SIO_CHECK(Empty()); // Can't reload
         SIO_CHECK(is.good());
@@ -326,6 +371,35 @@ struct Fst {
             this->states.back().offset = n; // setup last sentinel state
         }
 
+        this->token_topology = true;
+        return Error::OK;
+    }
+
+
+    // Same states as BuildTokenTopology(), but no arc is materialized:
+    //   state 0 is start state, tokens(except blk/unk/bos/eos) take states 1, 2, ... in id order,
+    //   final state follows.
+    Error BuildImplicitTokenTopology(const Tokenizer& tokenizer) {
+        SIO_CHECK(Empty());
+        SIO_CHECK_NE(tokenizer.Size(), 0);
+        SIO_INFO << "Building implicit token graph T from tokenizer with size: " << tokenizer.Size();
+
+        FstStateId cur_state = 1;
+        for (TokenId t = 0; t != tokenizer.Size(); t++) {
+            if (t == tokenizer.blk) continue;
+            if (t == tokenizer.unk) continue;
+            if (t == tokenizer.bos) continue;
+            if (t == tokenizer.eos) continue;
+            cur_state++;
+        }
+
+        this->start_state = 0;
+        this->final_state = cur_state;
+        this->num_states = this->final_state + 1;
+        this->num_arcs = 0;
+
+        this->token_topology = true;
+        this->implicit = true;
         return Error::OK;
     }
 
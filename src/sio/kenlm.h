@@ -1,9 +1,16 @@
 #ifndef SIO_KENLM_H
 #define SIO_KENLM_H
 
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
 #include "lm/word_index.hh"
 #include "lm/model.hh"
 #include "util/murmur_hash.hh"
+#include "util/string_piece.hh"
 
 #include "sio/base.h"
 #include "sio/tokenizer.h"
@@ -16,6 +23,7 @@ namespace sio {
 //  2. handles the index mapping between tokenizer & kenlm vocab
 //  3. KenLm yields log10 score, whereas ASR decoder normally uses natural log, a conversion is need.
 //  4. provides a stateless ngram query engine, can be shared by multiple threads
+//  5. provides per-token score upper bounds for LM lookahead
 class KenLm {
 public:
     using State = lm::ngram::State;
@@ -45,6 +53,9 @@ private:
     // Decision: for sake of simplicity, choose solution B
     vec<WordId> token_to_word_;
 
+    // upper bound of Score() over all states, indexed by token
+    vec<f32> token_score_upper_bound_;
+
     Unique<lm::base::Model*> model_;
 
 public:
@@ -90,6 +101,18 @@ public:
         }
         //dbg(token_to_word_);
 
+        // binary models don't keep n-grams enumerable by word, their bound stays at log-probability's natural bound
+        SIO_CHECK(token_score_upper_bound_.empty());
+        token_score_upper_bound_.resize(tokenizer.Size(), 0.0);
+        std::ifstream is(filepath);
+        str line;
+        while (std::getline(is, line) && line.empty()) { }
+        if (line == "\\data\\") {
+            LoadScoreUpperBounds(is);
+        } else {
+            SIO_WARNING << "Binary KenLm model, LM lookahead bounds stay at 0: " << filepath;
+        }
+
         return Error::OK;
     }
 
@@ -111,6 +134,68 @@ public:
         return SIO_LN10 * model_->BaseScore(istate, word, ostate);
     }
 
+
+    inline f32 ScoreUpperBound(TokenId t) const {
+        return token_score_upper_bound_[t];
+    }
+
+private:
+
+    // Bounds from ARPA n-gram sections: score of a word is the log-prob of longest matched n-gram ending in it,
+    // plus backoffs of unmatched longer contexts, at most one per order.
+    // So bound = max log-prob of n-grams ending in the word + positive part of max backoff of each order.
+    // One pass keyed by KenLm word index, only log-prob, last word & backoff columns of a line are parsed.
+    Error LoadScoreUpperBounds(std::istream& is) {
+        const lm::base::Vocabulary& vocab = model_->BaseVocabulary();
+        vec<f32> max_logprob(vocab.Bound(), -std::numeric_limits<f32>::infinity());
+        f32 backoff_bound = 0.0;
+
+        int order = 0;
+        f32 max_backoff = 0.0; // of current order
+        str line;
+        while (std::getline(is, line)) {
+            if (line.empty()) {
+                continue;
+            }
+            if (line[0] == '\\') { // section header, "\N-grams:" or "\end\"
+                backoff_bound += max_backoff;
+                max_backoff = 0.0;
+                order = (line == "\\end\\") ? 0 : std::atoi(line.c_str() + 1);
+                continue;
+            }
+            if (order == 0) { // ngram counts of "\data\"
+                continue;
+            }
+
+            // log-prob w1 ... wN [backoff]
+            char* p = nullptr;
+            f32 logprob = std::strtof(line.c_str(), &p);
+            size_t n = 0;
+            for (int k = 0; k != order; k++) {
+                p += n;
+                p += std::strspn(p, " \t");
+                n = std::strcspn(p, " \t");
+            }
+            SIO_CHECK_GT(n, 0);
+            WordId w = vocab.Index(StringPiece(p, n));
+            max_logprob[w] = std::max(max_logprob[w], logprob);
+
+            p += n;
+            p += std::strspn(p, " \t");
+            if (*p != '\0') {
+                max_backoff = std::max(max_backoff, std::strtof(p, nullptr));
+            }
+        }
+
+        // unseen tokens are mapped to <unk>, i.e. word 0, words without any n-gram keep natural bound 0
+        for (TokenId t = 0; t != token_to_word_.size(); t++) {
+            f32 bound = max_logprob[token_to_word_[t]];
+            token_score_upper_bound_[t] = std::isinf(bound) ? 0.0 : SIO_LN10 * std::min(bound + backoff_bound, 0.0f);
+        }
+
+        return Error::OK;
+    }
+
 }; // class KenLm
 
 } // namespace sio
@@ -13,6 +13,8 @@ namespace sio {
 // 2. centralized LoadXXXLm() uses for typical LM types
 class LanguageModel {
     Unique<LanguageModelItf*> pimpl_;
+    Nullable<ContextLm*> context_ = nullptr; // pimpl_ of a context LM
+    Nullable<CachedLm*> cached_ = nullptr; // pimpl_ of a cached LM
 
 public:
 
@@ -32,11 +34,29 @@ public:
         Unique<CachedLm*> cached_ngram = std::make_unique<CachedLm>();
         cached_ngram->Load(std::move(ngram)/*sink*/, scale, cache_size);
 
+        cached_ = cached_ngram.get();
         pimpl_ = std::move(cached_ngram);
         return Error::OK;
     }
 
 
+    // Context LM starts without a graph, see SetContextGraph().
+    Error LoadContextLm() {
+        SIO_CHECK(pimpl_ == nullptr);
+        Unique<ContextLm*> context = std::make_unique<ContextLm>();
+        context_ = context.get();
+        pimpl_ = std::move(context);
+        return Error::OK;
+    }
+
+
+    // States of hypotheses scored by previous graph are invalid afterwards.
+    Error SetContextGraph(Nullable<const ContextGraph*> graph) {
+        SIO_CHECK(context_ != nullptr);
+        return context_->Load(graph);
+    }
+
+
     LmStateId NullState() const {
         SIO_CHECK(pimpl_ != nullptr);
         return pimpl_->NullState();
@@ -47,6 +67,16 @@ public:
         return pimpl_->GetScore(istate, word, ostate_ptr);
     }
 
+
+    inline LmScore ScoreUpperBound(LmWordId word) const {
+        return pimpl_->ScoreUpperBound(word);
+    }
+
+
+    // cache counters of cached LMs, 0 for others
+    i64 NumCacheHits() const { return cached_ != nullptr ? cached_->NumHits() : 0; }
+    i64 NumCacheMisses() const { return cached_ != nullptr ? cached_->NumMisses() : 0; }
+
 }; // class LanguageModel
 
 } // namespace sio
@@ -1,8 +1,11 @@
 #ifndef SIO_LANGUAGE_MODEL_IMPL_H
 #define SIO_LANGUAGE_MODEL_IMPL_H
 
+#include <limits>
+
 #include "sio/tokenizer.h"
 #include "sio/kenlm.h"
+#include "sio/context_graph.h"
 #include "sio/language_model_itf.h"
 
 namespace sio {
@@ -28,6 +31,12 @@ public:
         return 0.0;
     }
 
+
+    // all scores are 0, so the bound is exact
+    LmScore ScoreUpperBound(LmWordId word) const override {
+        return 0.0;
+    }
+
 }; // class PrefixTreeLm
 
 
@@ -95,6 +104,12 @@ public:
         return score;
     }
 
+
+    // bounds are computed by KenLm at load time, see KenLm::ScoreUpperBound()
+    LmScore ScoreUpperBound(LmWordId word) const override {
+        return kenlm_->ScoreUpperBound(word);
+    }
+
 }; // class NgramLm
 
 
@@ -115,6 +130,9 @@ class CachedLm : public LanguageModelItf {
     f32 scale_ = 1.0;
     vec<Cache> caches_;
 
+    i64 num_hits_ = 0;
+    i64 num_misses_ = 0;
+
 public:
 
     // NOTE sink argument: lm ownership transfered to loaded instance
@@ -149,12 +167,25 @@ public:
             k.word = word;
 
             v.score = scale_ * lm_->GetScore(istate, word, &v.ostate);
+            num_misses_++;
+        } else {
+            num_hits_++;
         }
 
         *ostate_ptr = v.ostate;
         return v.score;
     }
 
+
+    LmScore ScoreUpperBound(LmWordId word) const override {
+        // negative scale(e.g. internal LM subtraction) flips the bound into an unbounded side
+        return scale_ >= 0.0 ? scale_ * lm_->ScoreUpperBound(word) : std::numeric_limits<LmScore>::infinity();
+    }
+
+
+    i64 NumHits() const { return num_hits_; }
+    i64 NumMisses() const { return num_misses_; }
+
 private:
 
     inline size_t GetCacheIndex(LmStateId istate, LmWordId word) {
@@ -164,5 +195,38 @@ private:
 
 }; // class CachedLm
 
+// ContextLm biases hypotheses towards hot phrases of a ContextGraph, states are graph states.
+// The graph is owned outside and can be swapped between sessions, no graph -> all scores are 0.
+class ContextLm : public LanguageModelItf {
+    Nullable<const ContextGraph*> graph_ = nullptr;
+
+public:
+
+    Error Load(Nullable<const ContextGraph*> graph) {
+        graph_ = (graph != nullptr && !graph->Empty()) ? graph : nullptr;
+        return Error::OK;
+    }
+
+
+    LmStateId NullState() const override {
+        return 0;
+    }
+
+
+    LmScore GetScore(LmStateId istate, LmWordId word, LmStateId* ostate_ptr) override {
+        if (graph_ == nullptr) {
+            *ostate_ptr = 0;
+            return 0.0;
+        }
+        return graph_->GetScore(istate, word, ostate_ptr);
+    }
+
+
+    LmScore ScoreUpperBound(LmWordId word) const override {
+        return graph_ == nullptr ? 0.0 : graph_->ScoreUpperBound(word);
+    }
+
+}; // class ContextLm
+
 }  // namespace sio
 #endif
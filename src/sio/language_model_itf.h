@@ -13,6 +13,8 @@ class LanguageModelItf {
 public:
     virtual LmStateId NullState() const = 0;
     virtual LmScore GetScore(LmStateId istate, LmWordId word, LmStateId* ostate_ptr) = 0;
+    // upper bound of GetScore() over all states, lets decoders prune hypotheses before querying
+    virtual LmScore ScoreUpperBound(LmWordId word) const = 0;
     virtual ~LanguageModelItf() { }
 };
 
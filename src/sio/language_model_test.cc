@@ -31,6 +31,28 @@ TEST(LanguageModel, PrefixTreeLm) {
 }
 
 
+TEST(LanguageModel, ContextLm) {
+    LanguageModel lm;
+    lm.LoadContextLm();
+
+    LmStateId s;
+    EXPECT_EQ(lm.GetScore(lm.NullState(), 1, &s), 0.0); // no graph attached
+    EXPECT_EQ(s, 0);
+
+    ContextGraph x, y;
+    x.Load({{1, 2}}, {1.0}, 10);
+    y.Load({{3}}, {2.0}, 10);
+
+    lm.SetContextGraph(&x);
+    EXPECT_EQ(lm.GetScore(lm.NullState(), 1, &s), 1.0);
+    EXPECT_EQ(lm.ScoreUpperBound(3), 0.0);
+
+    lm.SetContextGraph(&y); // swapped
+    EXPECT_EQ(lm.GetScore(lm.NullState(), 3, &s), 2.0);
+    EXPECT_EQ(lm.ScoreUpperBound(3), 2.0);
+}
+
+
 TEST(LanguageModel, KenLm) {
     Tokenizer tokenizer;
     tokenizer.Load("testdata/model/tokenizer.vocab");
@@ -60,12 +82,51 @@ TEST(LanguageModel, KenLm) {
 }
 
 
+TEST(LanguageModel, KenLmScoreUpperBound) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+
+    KenLm arpa;
+    arpa.Load("testdata/model/lm.arpa", tokenizer);
+
+    // binary model: natural bound only
+    KenLm binary;
+    binary.Load("testdata/model/lm.trie", tokenizer);
+
+    int num_bounded = 0;
+    for (TokenId t = 0; t != tokenizer.Size(); t++) {
+        EXPECT_LE(arpa.ScoreUpperBound(t), 0.0);
+        EXPECT_EQ(binary.ScoreUpperBound(t), 0.0);
+        num_bounded += (arpa.ScoreUpperBound(t) < 0.0);
+    }
+    EXPECT_GT(num_bounded, tokenizer.Size() / 2);
+
+    std::ifstream sentences("testdata/sentences.txt");
+
+    str sentence;
+    while(std::getline(sentences, sentence)) {
+        vec<str> words = absl::StrSplit(sentence, " ");
+
+        KenLm::State state[2];
+        KenLm::State* is = &state[0];
+        KenLm::State* os = &state[1];
+
+        arpa.SetStateToNull(is);
+        for (const auto& w : words) {
+            TokenId t = tokenizer.Index(w);
+            EXPECT_LE(arpa.Score(is, arpa.GetWordIndex(t), os), arpa.ScoreUpperBound(t) + 1e-4) << w;
+            std::swap(is, os);
+        }
+    }
+}
+
+
 TEST(LanguageModel, CachedNgramLm) {
     Tokenizer tokenizer;
     tokenizer.Load("testdata/model/tokenizer.vocab");
 
     KenLm kenlm;
-    kenlm.Load("testdata/model/lm.trie", tokenizer);
+    kenlm.Load("testdata/model/lm.arpa", tokenizer); // ARPA for non-trivial score bounds
 
     LanguageModel lm;
     lm.LoadCachedNgramLm(kenlm, 1.0, 10000);
@@ -84,6 +145,7 @@ TEST(LanguageModel, CachedNgramLm) {
         *is = lm.NullState();
         for (const auto& w : words) {
             f32 score = lm.GetScore(*is, tokenizer.Index(w), os);
+            EXPECT_LE(score, lm.ScoreUpperBound(tokenizer.Index(w)));
             log += " " + w + "[" + std::to_string(tokenizer.Index(w)) + "]=" + std::to_string(score);
             std::swap(is, os);
         }
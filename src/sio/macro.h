@@ -12,6 +12,13 @@ namespace sio {
 #define SIO_LIKELY   ABSL_PREDICT_TRUE
 #define SIO_UNLIKELY ABSL_PREDICT_FALSE
 
+/* software prefetch into cache, for read */
+#if defined(__GNUC__) || defined(__clang__)
+#define SIO_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define SIO_PREFETCH(addr)
+#endif
+
 constexpr const char* Basename(const char* fname, int offset) {
     return offset == 0 || fname[offset - 1] == '/' || fname[offset - 1] == '\\'
                ? fname + offset
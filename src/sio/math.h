@@ -1,11 +1,28 @@
 #ifndef SIO_MATH_H
 #define SIO_MATH_H
 
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include "sio/type.h"
+
 namespace sio {
 
 // M_LN10 from:
 //   https://github.com/kaldi-asr/kaldi/blob/dd107fd594ac58af962031c1689abfdc10f84452/src/base/kaldi-math.h#L67
 #define SIO_LN10 2.302585092994045684017991454684
 
+// log(exp(x) + exp(y)), -infinity stands for log(0)
+inline f32 LogAddExp(f32 x, f32 y) {
+    if (x < y) {
+        std::swap(x, y);
+    }
+    if (y == -std::numeric_limits<f32>::infinity()) {
+        return x;
+    }
+    return x + std::log1p(std::exp(y - x));
+}
+
 } // namespace sio
 #endif
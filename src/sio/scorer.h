@@ -4,7 +4,10 @@
 #include "torch/script.h"
 #include "torch/torch.h"
 
+#include "base/io-funcs.h"
+
 #include "sio/base.h"
+#include "sio/binary_io.h"
 #include "sio/tokenizer.h"
 
 namespace sio {
@@ -13,11 +16,15 @@ struct ScorerConfig {
     int chunk_size = -1;
     int num_left_chunks = -1;
     int num_threads = 1;
+    // "ctc_activation": frames of CTC log posteriors
+    // "encoder": encoder frames, for decoders scoring tokens with their own networks(transducer)
+    std::string output = "ctc_activation";
 
     Error Register(StructLoader* loader, const std::string module = "") {
         loader->AddEntry(module + ".chunk_size", &chunk_size);
         loader->AddEntry(module + ".num_left_chunks", &num_left_chunks);
         loader->AddEntry(module + ".num_threads", &num_threads);
+        loader->AddEntry(module + ".output", &output);
         return Error::OK;
     }
 };
@@ -27,7 +34,7 @@ class Scorer {
     ScorerConfig config_;
     torch::jit::script::Module* nnet_ = nullptr;
     int nnet_idim_ = 0;
-    int nnet_odim_ = 0;
+    int nnet_odim_ = 0; // encoder output: 0 until first chunk
 
     int subsampling_factor_ = 0;
     int right_context_ = 0;
@@ -48,9 +55,14 @@ class Scorer {
 
 public:
 
+    // nnet_odim: of CTC output, ignored for encoder output
     Error Load(const ScorerConfig& config, torch::jit::script::Module& nnet, int nnet_idim, int nnet_odim) { 
         SIO_CHECK(nnet_ == nullptr); // Can't reload
         config_ = config;
+        SIO_CHECK(config_.output == "ctc_activation" || config_.output == "encoder");
+        if (config_.output == "encoder") {
+            nnet_odim = 0;
+        }
         nnet_ = &nnet;
         nnet_idim_ = nnet_idim;
         nnet_odim_ = nnet_odim;
@@ -122,6 +134,83 @@ public:
     }
 
 
+    // Encoder caches are pickled by torch, they grow with session when whole history is cached.
+    // acoustic_encoding_cache_ is never read back, so it isn't carried over.
+    Error Snapshot(std::ostream& os) const {
+        using kaldi::WriteToken;
+        using kaldi::WriteBasicType;
+
+        bool binary = true;
+
+        WriteToken(os, binary, "<Scorer>");
+        WriteBasicType(os, binary, cur_feat_frame_);
+        WriteBasicType(os, binary, cur_score_frame_);
+
+        WriteBasicType(os, binary, static_cast<i32>(feat_cache_.size()));
+        for (const vec<f32>& feat : feat_cache_) {
+            WritePodVector(os, feat);
+        }
+
+        WritePodVector(os, torch::pickle_save(subsampling_cache_));
+        WritePodVector(os, torch::pickle_save(elayers_output_cache_));
+        WritePodVector(os, torch::pickle_save(conformer_cnn_cache_));
+
+        WriteBasicType(os, binary, static_cast<i32>(scores_cache_.size()));
+        vec<f32> score(nnet_odim_);
+        for (const torch::Tensor& s : scores_cache_) {
+            torch::Tensor c = s.contiguous();
+            std::copy(c.data_ptr<float>(), c.data_ptr<float>() + nnet_odim_, score.begin());
+            WritePodVector(os, score);
+        }
+
+        return os.good() ? Error::OK : Error::Unknown;
+    }
+
+
+    Error Restore(std::istream& is) {
+        using kaldi::ExpectToken;
+        using kaldi::ReadBasicType;
+
+        bool binary = true;
+
+        Clear();
+
+        ExpectToken(is, binary, "<Scorer>");
+        ReadBasicType(is, binary, &cur_feat_frame_);
+        ReadBasicType(is, binary, &cur_score_frame_);
+
+        i32 n = 0;
+        ReadBasicType(is, binary, &n);
+        for (int i = 0; i != n; i++) {
+            vec<f32> feat;
+            ReadPodVector(is, &feat);
+            SIO_CHECK_EQ(feat.size(), nnet_idim_);
+            feat_cache_.push_back(std::move(feat));
+        }
+
+        vec<char> pickle;
+        ReadPodVector(is, &pickle);
+        subsampling_cache_ = torch::pickle_load(pickle);
+        ReadPodVector(is, &pickle);
+        elayers_output_cache_ = torch::pickle_load(pickle);
+        ReadPodVector(is, &pickle);
+        conformer_cnn_cache_ = torch::pickle_load(pickle);
+
+        ReadBasicType(is, binary, &n);
+        vec<f32> score;
+        for (int i = 0; i != n; i++) {
+            ReadPodVector(is, &score);
+            if (nnet_odim_ == 0) { // encoder output of a fresh scorer
+                nnet_odim_ = score.size();
+            }
+            SIO_CHECK_EQ(score.size(), nnet_odim_);
+            scores_cache_.push_back(torch::from_blob(score.data(), {nnet_odim_}, torch::kFloat).clone());
+        }
+
+        return is.good() ? Error::OK : Error::Unknown;
+    }
+
+
     size_t Size() const {
         return scores_cache_.size();
     }
@@ -131,6 +220,12 @@ public:
         return nnet_odim_;
     }
 
+
+    // feature frames per score frame
+    int SubsamplingFactor() const {
+        return subsampling_factor_;
+    }
+
 private:
     Error Advance() {
         //dbg(cur_feat_frame_);
@@ -179,7 +274,13 @@ private:
         acoustic_encoding_cache_.push_back(acoustic_encoding);
 
         // Compute chunk scores: [frames, nnet_odim]
-        torch::Tensor scores = nnet_->run_method("ctc_activation", acoustic_encoding).toTensor()[0];
+        torch::Tensor scores;
+        if (config_.output == "encoder") {
+            scores = acoustic_encoding[0];
+            nnet_odim_ = scores.size(1);
+        } else {
+            scores = nnet_->run_method("ctc_activation", acoustic_encoding).toTensor()[0];
+        }
 
         // Add chunk score to caches
         for (int s = 0; s != scores.size(0); s++) {
@@ -0,0 +1,177 @@
+#ifndef SIO_SESSION_TEXT_H
+#define SIO_SESSION_TEXT_H
+
+#include <istream>
+#include <ostream>
+
+#include "base/io-funcs.h"
+
+#include "sio/base.h"
+#include "sio/binary_io.h"
+#include "sio/tokenizer.h"
+
+namespace sio {
+
+/*
+ * Text outputs of a recognition session: segments ended by endpointing, partial result of current segment,
+ * and final n-best of the session.
+ *
+ * Partial result = ended segments + committed tokens + uncommitted path of best hypothesis.
+ * The first two form a stable prefix of one persistent buffer, each segment & committed token is
+ * converted to text and appended only once, so a partial result only rewrites its uncommitted tail,
+ * and its cost stays proportional to the new frames instead of the whole session.
+ */
+class SessionText {
+    const Tokenizer* tokenizer_ = nullptr;
+
+    vec<str> segments_; // texts of segments ended by endpointing
+    size_t segments_size_ = 0; // text size of ended segments, where current segment begins in partial_
+
+    str partial_;
+    size_t stable_size_ = 0; // ended segments + committed tokens of current segment
+    size_t num_committed_ = 0; // tokens of current segment's committed path in stable prefix
+
+public:
+
+    Error Load(const Tokenizer& tokenizer) {
+        SIO_CHECK(tokenizer_ == nullptr);
+        tokenizer_ = &tokenizer;
+
+        return Error::OK;
+    }
+
+
+    // committed: committed path of current segment, it only grows during a segment.
+    // uncommitted: rest of best path, which is rewritten on every call.
+    const char* Partial(const vec<TokenId>& committed, const vec<TokenId>& uncommitted) {
+        SIO_CHECK_GE(committed.size(), num_committed_);
+
+        partial_.resize(stable_size_);
+        for (; num_committed_ < committed.size(); num_committed_++) {
+            partial_ += tokenizer_->Token(committed[num_committed_]);
+        }
+        stable_size_ = partial_.size();
+
+        for (TokenId t : uncommitted) {
+            partial_ += tokenizer_->Token(t);
+        }
+
+        return partial_.c_str();
+    }
+
+
+    // Ends current segment with its best path, whose text replaces committed tokens in stable prefix.
+    Error EndSegment(const vec<TokenId>& best) {
+        str text;
+        for (TokenId t : best) {
+            text += tokenizer_->Token(t);
+        }
+
+        partial_.resize(segments_size_);
+        partial_ += text;
+        segments_size_ = partial_.size();
+        stable_size_ = segments_size_;
+        num_committed_ = 0;
+
+        segments_.push_back(std::move(text));
+
+        return Error::OK;
+    }
+
+
+    // N-best of last segment after ended segments, tab separated. A last segment without tokens, e.g. when
+    // an endpoint falls on the final frames, adds nothing to ended segments.
+    str Final(const vec<vec<TokenId>>& nbest) const {
+        const str segments_text = SegmentsText();
+        if (!segments_.empty() && (nbest.empty() || !HasTokens(nbest[0]))) {
+            return segments_text + "\t";
+        }
+
+        str text;
+        for (const vec<TokenId>& path : nbest) {
+            text += segments_text;
+            for (TokenId t : path) {
+                text += tokenizer_->Token(t);
+            }
+            text += "\t";
+        }
+        return text;
+    }
+
+
+    // Whether a decoded path has any token besides bos & eos.
+    bool HasTokens(const vec<TokenId>& path) const {
+        for (TokenId t : path) {
+            if (t != tokenizer_->bos && t != tokenizer_->eos) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+
+    size_t NumSegments() const {
+        return segments_.size();
+    }
+
+
+    const str& Segment(size_t i) const {
+        SIO_CHECK_LT(i, segments_.size());
+        return segments_[i];
+    }
+
+
+    // Texts of all ended segments, concatenated.
+    str SegmentsText() const {
+        return partial_.substr(0, segments_size_);
+    }
+
+
+    // Size of partial result prefix that is not rewritten by next Partial() call.
+    size_t StableSize() const {
+        return stable_size_;
+    }
+
+
+    Error Clear() {
+        segments_.clear();
+        segments_size_ = 0;
+
+        partial_.clear();
+        stable_size_ = 0;
+        num_committed_ = 0;
+
+        return Error::OK;
+    }
+
+
+    // Only ended segments are written, committed text is rebuilt from beam search committed path by next Partial().
+    Error Snapshot(std::ostream& os) const {
+        kaldi::WriteBasicType(os, /*binary*/true, static_cast<i32>(segments_.size()));
+        for (const str& text : segments_) {
+            WriteString(os, text);
+        }
+
+        return os.good() ? Error::OK : Error::Unknown;
+    }
+
+
+    Error Restore(std::istream& is) {
+        Clear();
+
+        i32 num_segments = 0;
+        kaldi::ReadBasicType(is, /*binary*/true, &num_segments);
+        segments_.resize(num_segments);
+        for (str& text : segments_) {
+            ReadString(is, &text);
+            partial_ += text;
+        }
+        segments_size_ = partial_.size();
+        stable_size_ = segments_size_;
+
+        return is.good() ? Error::OK : Error::Unknown;
+    }
+
+}; // class SessionText
+}  // namespace sio
+#endif
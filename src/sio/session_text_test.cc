@@ -0,0 +1,113 @@
+#include "sio/session_text.h"
+
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+#include "sio/beam_search.h"
+
+namespace sio {
+
+// Committed tokens & ended segments are converted once, later calls only rewrite the uncommitted tail
+// in place, so neither the stable prefix nor its buffer is rebuilt.
+TEST(SessionText, StablePrefix) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+    TokenId x = tokenizer.Index("的");
+    TokenId y = tokenizer.Index("在");
+    const str& xs = tokenizer.Token(x);
+    const str& ys = tokenizer.Token(y);
+
+    SessionText text;
+    text.Load(tokenizer);
+
+    vec<TokenId> committed(8, x); // long enough to live out of small string buffer
+    str committed_text;
+    for (TokenId t : committed) {
+        committed_text += tokenizer.Token(t);
+    }
+    const char* p = text.Partial(committed, {y});
+    EXPECT_EQ(str(p), committed_text + ys);
+    EXPECT_EQ(text.StableSize(), committed_text.size());
+
+    // same committed path, different tail of same length: rewritten in place
+    const char* q = text.Partial(committed, {x});
+    EXPECT_EQ(q, p);
+    EXPECT_EQ(text.StableSize(), committed_text.size());
+    EXPECT_EQ(str(q).substr(text.StableSize()), xs);
+
+    // only the newly committed token is appended to stable prefix
+    committed.push_back(y);
+    text.Partial(committed, {});
+    EXPECT_EQ(text.StableSize(), committed_text.size() + ys.size());
+
+    // ended segment's text replaces its committed tokens
+    text.EndSegment({tokenizer.bos, x, tokenizer.eos});
+    const str segment = tokenizer.Token(tokenizer.bos) + xs + tokenizer.Token(tokenizer.eos);
+    EXPECT_EQ(text.NumSegments(), 1);
+    EXPECT_EQ(text.Segment(0), segment);
+    EXPECT_EQ(text.SegmentsText(), segment);
+    EXPECT_EQ(text.StableSize(), segment.size());
+    EXPECT_EQ(str(text.Partial({y}, {x})), segment + ys + xs);
+    EXPECT_EQ(text.StableSize(), segment.size() + ys.size());
+
+    // committed text of current segment is rebuilt from committed path after restore
+    std::stringstream blob;
+    ASSERT_EQ(text.Snapshot(blob), Error::OK);
+    SessionText restored;
+    restored.Load(tokenizer);
+    ASSERT_EQ(restored.Restore(blob), Error::OK);
+    EXPECT_EQ(restored.StableSize(), segment.size());
+    EXPECT_EQ(str(restored.Partial({y}, {x})), segment + ys + xs);
+}
+
+
+// An endpoint on the final frames ends the last segment with tokens, the empty segment left for
+// final n-best adds no "<s></s>", while a final segment with tokens is appended as usual.
+TEST(SessionText, EndpointOnFinalFrames) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+    TokenId x = tokenizer.Index("的");
+
+    auto frame = [&](TokenId t) {
+        vec<f32> score(tokenizer.Size(), -20.0);
+        score[t] = -0.1;
+        return torch::from_blob(score.data(), {(i64)score.size()}, torch::kFloat).clone();
+    };
+
+    BeamSearch search;
+    search.LoadCtcPrefixBeamSearch(CtcPrefixBeamSearchConfig(), tokenizer);
+
+    EndpointConfig endpoint;
+    endpoint.min_trailing_blank = 10;
+
+    const str segment = tokenizer.Token(tokenizer.bos) + tokenizer.Token(x) + tokenizer.Token(tokenizer.eos);
+    for (bool trailing_speech : {false, true}) {
+        SessionText text;
+        text.Load(tokenizer);
+
+        // same loop as SpeechToText::Advance()
+        vec<TokenId> frames = {x, x};
+        frames.resize(2 + endpoint.min_trailing_blank, tokenizer.blk);
+        if (trailing_speech) {
+            frames.push_back(x);
+        }
+        search.InitSession();
+        for (TokenId t : frames) {
+            search.Push(frame(t));
+            if (search.EndpointDetected(endpoint)) {
+                search.PushEos();
+                text.EndSegment(search.NBest()[0]);
+                search.ResetSegment();
+            }
+        }
+        search.PushEos();
+
+        ASSERT_EQ(text.NumSegments(), 1);
+        EXPECT_EQ(text.HasTokens(search.NBest()[0]), trailing_speech);
+        EXPECT_EQ(text.Final(search.NBest()), trailing_speech ? segment + segment + "\t" : segment + "\t");
+        search.DeinitSession();
+    }
+}
+
+} // namespace sio
@@ -2,15 +2,19 @@
 #define SIO_SPEECH_TO_TEXT_H
 
 #include <stddef.h>
+#include <chrono>
+#include <sstream>
 
 #include <torch/torch.h>
 #include <torch/script.h>
 
 #include "sio/base.h"
+#include "sio/binary_io.h"
 #include "sio/feature_extractor.h"
 #include "sio/tokenizer.h"
 #include "sio/scorer.h"
 #include "sio/beam_search.h"
+#include "sio/session_text.h"
 #include "sio/speech_to_text_module.h"
 
 namespace sio {
@@ -36,12 +40,66 @@ enum class SpeechToTextStatus : int {
 };
 
 
+// Degradation level change of a session under RTF budget.
+struct DegradationEvent {
+    f32 time = 0.0; // seconds of audio into session
+    i32 level = 0; // new level, 0: fully restored
+    f32 lag = 0.0; // seconds behind budget when level changed
+};
+
+
+// Output token of best path with its time span & scores, frames are beam search frames of session.
+// It is standard layout, so that C API exposes arrays of it as is(see sio_stt_token).
+struct TokenAlignment {
+    const char* text = nullptr; // owned by tokenizer
+    i32 token = kNoTokenId;
+    i32 begin_frame = 0;
+    i32 end_frame = 0; // exclusive
+    f32 begin_time = 0.0; // seconds
+    f32 end_time = 0.0;
+    f32 am_score = 0.0;
+    f32 lm_score = 0.0;
+    f32 confidence = 0.0;
+};
+
+
 class SpeechToText {
     const Tokenizer* tokenizer_ = nullptr;
     FeatureExtractor feature_extractor_;
     Scorer scorer_;
     BeamSearch beam_search_;
     str text_;
+
+    bool do_endpointing_ = false;
+    EndpointConfig endpoint_config_;
+
+    SessionText session_text_; // ended segments & partial result
+
+    // best path alignment of session: ended segments, then last segment after To()
+    vec<TokenAlignment> alignment_;
+    int alignment_segment_frame_ = 0; // session frame where current segment starts
+    f32 frame_shift_ = 0.0; // seconds per beam search frame
+
+    vec<TokenId> partial_path_; // uncommitted best path
+
+    // RTF budget
+    RtfBudgetConfig rtf_budget_;
+    f64 audio_time_ = 0.0; // seconds of audio pushed in session
+    f64 lag_ = 0.0; // seconds behind budget, being ahead of budget doesn't accumulate credit
+    int degradation_ = 0;
+    int chunks_since_change_ = 0;
+    int chunks_on_schedule_ = 0;
+    vec<DegradationEvent> degradations_;
+
+    str snapshot_; // blob of latest Snapshot(const str**)
+
+    // contextual biasing
+    bool context_biasing_ = false;
+    f32 context_bonus_ = 0.0;
+    const ContextGraph* module_context_ = nullptr;
+    ContextGraph session_context_; // phrases of SetContext(), replacing module's
+    bool use_session_context_ = false;
+
     SpeechToTextStatus status_ = SpeechToTextStatus::kUnconstructed;
 
 public:
@@ -50,6 +108,7 @@ public:
         SIO_CHECK(status_ == SpeechToTextStatus::kUnconstructed);
 
         tokenizer_ = &m.tokenizer;
+        session_text_.Load(m.tokenizer);
 
         SIO_INFO << "Loading feature extractor ...";
         feature_extractor_.Load(
@@ -65,12 +124,38 @@ public:
             tokenizer_->Size()
         );
 
-        SIO_INFO << "Loading beam search ...";
-        beam_search_.Load(
-            m.config.beam_search,
-            m.graph,
-            m.tokenizer
-        );
+        if (m.config.decoder == "ctc_prefix_beam_search") {
+            SIO_INFO << "Loading ctc prefix beam search ...";
+            beam_search_.LoadCtcPrefixBeamSearch(
+                m.config.ctc_prefix_beam_search,
+                m.tokenizer
+            );
+        } else if (m.config.decoder == "transducer_beam_search") {
+            SIO_INFO << "Loading transducer beam search ...";
+            beam_search_.LoadTransducerBeamSearch(
+                m.config.transducer_beam_search,
+                m.transducer,
+                m.tokenizer
+            );
+        } else {
+            SIO_CHECK_EQ(m.config.decoder, "beam_search");
+            SIO_INFO << "Loading beam search ...";
+            beam_search_.Load(
+                m.config.beam_search,
+                m.graph,
+                m.tokenizer
+            );
+        }
+
+        frame_shift_ = scorer_.SubsamplingFactor() / feature_extractor_.FrameRate();
+
+        context_biasing_ = m.config.decoder == "beam_search" && m.config.beam_search.context_biasing;
+        context_bonus_ = m.config.context_bonus;
+        module_context_ = &m.context;
+
+        do_endpointing_ = m.config.do_endpointing;
+        endpoint_config_ = m.config.endpoint;
+        rtf_budget_ = m.config.rtf_budget;
 
         status_ = SpeechToTextStatus::kIdle;
         return Error::OK;
@@ -80,10 +165,19 @@ public:
     Error Speech(const f32* samples, size_t num_samples, f32 sample_rate) {
         SIO_CHECK(status_ == SpeechToTextStatus::kIdle || status_ == SpeechToTextStatus::kBusy);
         if (status_ == SpeechToTextStatus::kIdle) {
+            AttachContext();
             beam_search_.InitSession();
             status_ = SpeechToTextStatus::kBusy;
         }
-        return Advance(samples, num_samples, sample_rate, /*eos*/false);
+
+        auto start = std::chrono::steady_clock::now();
+        Error err = Advance(samples, num_samples, sample_rate, /*eos*/false);
+        if (rtf_budget_.budget > 0.0 && num_samples != 0) {
+            std::chrono::duration<f64> elapsed = std::chrono::steady_clock::now() - start;
+            ChargeRtfBudget(elapsed.count(), num_samples / sample_rate);
+        }
+
+        return err;
     }
 
 
@@ -91,12 +185,8 @@ public:
         SIO_CHECK(status_ == SpeechToTextStatus::kBusy);
 
         Advance(nullptr, 0, /*dont care sample rate*/123.456, /*eos*/true);
-        for (const vec<TokenId>& path : beam_search_.NBest()) {
-            for (const auto& t : path) {
-                text_ += tokenizer_->Token(t);
-            }
-            text_ += "\t";
-        }
+        text_ = session_text_.Final(beam_search_.NBest());
+        AppendAlignment();
 
         status_ = SpeechToTextStatus::kDone;
         return Error::OK;
@@ -109,6 +199,73 @@ public:
     }
 
 
+    // Best hypothesis so far, available during Speech() calls.
+    const char* PartialText() {
+        SIO_CHECK(status_ == SpeechToTextStatus::kBusy);
+
+        // committed tokens are converted to text only once, see SessionText
+        beam_search_.PartialPath(&partial_path_);
+        return session_text_.Partial(beam_search_.CommittedPath(), partial_path_);
+    }
+
+
+    // Alignment of best path, i.e. outputs of Text()'s first hypothesis, available after To().
+    const vec<TokenAlignment>& Alignment() const {
+        SIO_CHECK(status_ == SpeechToTextStatus::kDone);
+        return alignment_;
+    }
+
+
+    // Segments ended by endpointing so far, available during Speech() calls and after To().
+    size_t NumSegments() const {
+        return session_text_.NumSegments();
+    }
+
+
+    const char* SegmentText(size_t i) const {
+        return session_text_.Segment(i).c_str();
+    }
+
+
+    // Degradation level changes of current session, available during Speech() calls and after To().
+    size_t NumDegradations() const {
+        return degradations_.size();
+    }
+
+
+    const DegradationEvent& Degradation(size_t i) const {
+        SIO_CHECK_LT(i, degradations_.size());
+        return degradations_[i];
+    }
+
+
+    int DegradationLevel() const {
+        return degradation_;
+    }
+
+
+    // Beam search counters of current session, available during Speech() calls and after To().
+    const SearchStats& FrameStats() const { return beam_search_.FrameStats(); }
+    const SearchStats& SessionStats() const { return beam_search_.SessionStats(); }
+    const vec<SearchStats>& FrameStatsHistogram() const { return beam_search_.FrameStatsHistogram(); }
+
+
+    // Hot phrases of following sessions in ContextGraph's text format, replacing module's context,
+    // nullptr reverts to module's. Needs beam search with context biasing.
+    Error SetContext(const char* phrases) {
+        SIO_CHECK(status_ == SpeechToTextStatus::kIdle);
+        SIO_CHECK(context_biasing_);
+
+        session_context_ = ContextGraph();
+        use_session_context_ = phrases != nullptr;
+        if (use_session_context_) {
+            std::istringstream is(phrases);
+            return session_context_.Load(is, *tokenizer_, context_bonus_);
+        }
+        return Error::OK;
+    }
+
+
     Error Clear() { 
         SIO_CHECK(status_ == SpeechToTextStatus::kDone);
 
@@ -117,12 +274,123 @@ public:
         beam_search_.DeinitSession();
         text_.clear();
 
+        session_text_.Clear();
+        alignment_.clear();
+        alignment_segment_frame_ = 0;
+
+        partial_path_.clear();
+
+        audio_time_ = 0.0; // beam search restores full search on next session itself
+        lag_ = 0.0;
+        degradation_ = 0;
+        chunks_since_change_ = 0;
+        chunks_on_schedule_ = 0;
+        degradations_.clear();
+
         status_ = SpeechToTextStatus::kIdle;
         return Error::OK; 
     }
 
+    // Serializes an in-flight session(between Speech() calls), so that another instance loaded from
+    // the same module, possibly in another process, resumes it via Restore(), e.g. when a node is drained.
+    // Hot phrases of SetContext() aren't carried, the resuming instance sets them before Restore().
+    Error Snapshot(std::ostream& os) {
+        SIO_CHECK(status_ == SpeechToTextStatus::kBusy);
+
+        using kaldi::WriteToken;
+        using kaldi::WriteBasicType;
+
+        bool binary = true;
+
+        WriteToken(os, binary, "<SpeechToText>");
+        session_text_.Snapshot(os);
+
+        vec<TokenAlignment> alignment = alignment_;
+        for (TokenAlignment& x : alignment) {
+            x.text = nullptr; // rebound to tokenizer on restore
+        }
+        WritePodVector(os, alignment);
+        WriteBasicType(os, binary, alignment_segment_frame_);
+
+        WriteBasicType(os, binary, audio_time_);
+        WriteBasicType(os, binary, lag_);
+        WriteBasicType(os, binary, degradation_);
+        WriteBasicType(os, binary, chunks_since_change_);
+        WriteBasicType(os, binary, chunks_on_schedule_);
+        WritePodVector(os, degradations_);
+
+        feature_extractor_.Snapshot(os);
+        scorer_.Snapshot(os);
+        beam_search_.Snapshot(os);
+
+        return os.good() ? Error::OK : Error::Unknown;
+    }
+
+
+    // Blob is owned by this instance, valid until next call.
+    Error Snapshot(const str** blob) {
+        SIO_CHECK(blob != nullptr);
+
+        std::ostringstream os(std::ios::binary);
+        Error err = Snapshot(os);
+        snapshot_ = os.str();
+
+        *blob = &snapshot_;
+        return err;
+    }
+
+
+    // Resumes a session from Snapshot(), on an idle instance: freshly loaded or cleared.
+    Error Restore(std::istream& is) {
+        SIO_CHECK(status_ == SpeechToTextStatus::kIdle);
+
+        using kaldi::ExpectToken;
+        using kaldi::ReadBasicType;
+
+        bool binary = true;
+
+        ExpectToken(is, binary, "<SpeechToText>");
+        session_text_.Restore(is);
+
+        ReadPodVector(is, &alignment_);
+        for (TokenAlignment& x : alignment_) {
+            x.text = tokenizer_->Token(x.token).c_str();
+        }
+        ReadBasicType(is, binary, &alignment_segment_frame_);
+
+        ReadBasicType(is, binary, &audio_time_);
+        ReadBasicType(is, binary, &lag_);
+        ReadBasicType(is, binary, &degradation_);
+        ReadBasicType(is, binary, &chunks_since_change_);
+        ReadBasicType(is, binary, &chunks_on_schedule_);
+        ReadPodVector(is, &degradations_);
+
+        feature_extractor_.Restore(is);
+        scorer_.Restore(is);
+        AttachContext();
+        beam_search_.Restore(is);
+
+        status_ = SpeechToTextStatus::kBusy;
+        return is.good() ? Error::OK : Error::Unknown;
+    }
+
+
+    Error Restore(const char* blob, size_t size) {
+        SIO_CHECK(blob != nullptr);
+
+        std::istringstream is(str(blob, size), std::ios::binary);
+        return Restore(is);
+    }
+
 private:
 
+    void AttachContext() {
+        if (context_biasing_) {
+            beam_search_.AttachContextGraph(use_session_context_ ? session_context_ : *module_context_);
+        }
+    }
+
+
     Error Advance(const f32* samples, size_t num_samples, f32 sample_rate, bool eos) {
         if (samples != nullptr && num_samples != 0) {
             feature_extractor_.Push(samples, num_samples, sample_rate);
@@ -140,6 +408,9 @@ private:
 
         while (scorer_.Size() > 0) {
             beam_search_.Push(scorer_.Pop());
+            if (do_endpointing_ && beam_search_.EndpointDetected(endpoint_config_)) {
+                EndSegment();
+            }
         }
         if (eos) {
             beam_search_.PushEos();
@@ -148,6 +419,77 @@ private:
         return Error::OK;
     }
 
+
+    // Appends alignment of current segment, whose frames follow those of ended segments.
+    Error AppendAlignment() {
+        int offset = alignment_segment_frame_;
+        for (const OutputAlignment& a : beam_search_.BestAlignment()) {
+            TokenAlignment x;
+            x.text = tokenizer_->Token(a.token).c_str();
+            x.token = a.token;
+            x.begin_frame = offset + a.begin_frame;
+            x.end_frame = offset + a.end_frame;
+            x.begin_time = x.begin_frame * frame_shift_;
+            x.end_time = x.end_frame * frame_shift_;
+            x.am_score = a.am_score;
+            x.lm_score = a.lm_score;
+            x.confidence = a.confidence;
+            alignment_.push_back(x);
+        }
+        alignment_segment_frame_ = beam_search_.NumFrames();
+
+        return Error::OK;
+    }
+
+
+    // Charges a chunk's wall time against budget, degrades search one level when session falls behind,
+    // and restores it one level after it has kept up with budget for a while, see RtfBudgetConfig.
+    Error ChargeRtfBudget(f64 elapsed, f64 duration) {
+        audio_time_ += duration;
+        lag_ = std::max(0.0, lag_ + elapsed - rtf_budget_.budget * duration);
+
+        chunks_since_change_++;
+        chunks_on_schedule_ = (lag_ == 0.0) ? chunks_on_schedule_ + 1 : 0;
+
+        int level = degradation_;
+        if (lag_ > rtf_budget_.max_lag) {
+            if (degradation_ < rtf_budget_.max_level && chunks_since_change_ >= rtf_budget_.hold_chunks) {
+                level++;
+            }
+        } else if (degradation_ > 0 && chunks_on_schedule_ >= rtf_budget_.restore_chunks) {
+            level--;
+        }
+
+        if (level != degradation_) {
+            degradation_ = level;
+            chunks_since_change_ = 0;
+            chunks_on_schedule_ = 0;
+            beam_search_.SetDegradation(level, rtf_budget_);
+
+            DegradationEvent e;
+            e.time = audio_time_;
+            e.level = level;
+            e.lag = lag_;
+            degradations_.push_back(e);
+        }
+
+        return Error::OK;
+    }
+
+
+    // Emits best path of current segment, then restarts beam search while feature & nnet states stay warm.
+    Error EndSegment() {
+        beam_search_.PushEos();
+
+        const vec<vec<TokenId>>& nbest = beam_search_.NBest();
+        session_text_.EndSegment(nbest.empty() ? vec<TokenId>() : nbest[0]);
+        AppendAlignment();
+
+        beam_search_.ResetSegment();
+
+        return Error::OK;
+    }
+
 }; // class SpeechToText
 }  // namespace sio
 #endif
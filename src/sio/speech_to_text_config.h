@@ -7,6 +7,7 @@
 #include "sio/struct_loader.h"
 #include "sio/feature_extractor.h"
 #include "sio/scorer.h"
+#include "sio/beam_search.h"
 
 namespace sio {
 struct SpeechToTextConfig {
@@ -22,10 +23,18 @@ struct SpeechToTextConfig {
     ScorerConfig scorer;
 
     std::string graph;
-    std::string context;
+    std::string context; // hot phrases for contextual biasing, see ContextGraph::Load()
+    f32 context_bonus = 2.0; // per token bonus of phrases without their own
     bool do_endpointing = false;
+    EndpointConfig endpoint;
+    RtfBudgetConfig rtf_budget;
 
+    // or "ctc_prefix_beam_search", graph-free and LM-free
+    // or "transducer_beam_search", graph-free, nnet is a transducer(see TorchTransducerModel)
+    std::string decoder = "beam_search";
     BeamSearchConfig beam_search;
+    CtcPrefixBeamSearchConfig ctc_prefix_beam_search;
+    TransducerBeamSearchConfig transducer_beam_search;
 
     Error Register(StructLoader* loader, const std::string module = "") {
         loader->AddEntry(module + ".online", &online);
@@ -41,9 +50,15 @@ struct SpeechToTextConfig {
 
         loader->AddEntry(module + ".graph", &graph);
         loader->AddEntry(module + ".context", &context);
+        loader->AddEntry(module + ".context_bonus", &context_bonus);
         loader->AddEntry(module + ".do_endpointing", &do_endpointing);
+        this->endpoint.Register(loader, module + ".endpoint");
+        this->rtf_budget.Register(loader, module + ".rtf_budget");
 
+        loader->AddEntry(module + ".decoder", &decoder);
         this->beam_search.Register(loader, module + ".beam_search");
+        this->ctc_prefix_beam_search.Register(loader, module + ".ctc_prefix_beam_search");
+        this->transducer_beam_search.Register(loader, module + ".transducer_beam_search");
 
         return Error::OK;
     }
@@ -9,6 +9,8 @@
 #include "sio/mean_var_norm.h"
 #include "sio/tokenizer.h"
 #include "sio/finite_state_transducer.h"
+#include "sio/context_graph.h"
+#include "sio/transducer_model.h"
 #include "sio/speech_to_text_config.h"
 
 namespace sio {
@@ -25,9 +27,12 @@ struct SpeechToTextModule {
     Tokenizer tokenizer;
 
     torch::jit::script::Module nnet;
+    TorchTransducerModel transducer; // predictor & joiner of nnet, loaded for transducer decoder only
 
     Fst graph;
 
+    ContextGraph context; // default hot phrases of sessions, empty without config.context
+
     Error Load(std::string config_file) { 
         config.Load(config_file);
 
@@ -44,6 +49,10 @@ struct SpeechToTextModule {
         SIO_CHECK(config.nnet != "");
         SIO_INFO << "Loading torchscript nnet from: " << config.nnet; 
         nnet = torch::jit::load(config.nnet);
+        if (config.decoder == "transducer_beam_search") {
+            transducer.Load(nnet, tokenizer);
+            config.scorer.output = "encoder"; // tokens are scored by joiner
+        }
 
         if (config.graph != "") {
             SIO_INFO << "Loading decoding graph from: " << config.graph;
@@ -52,7 +61,15 @@ struct SpeechToTextModule {
             graph.Load(is);
         } else {
             SIO_INFO << "Building decoding graph from: " << config.tokenizer_vocab;
-            graph.BuildTokenTopology(tokenizer);
+            graph.BuildImplicitTokenTopology(tokenizer);
+        }
+
+        if (config.context != "") {
+            SIO_INFO << "Loading context phrases from: " << config.context;
+            std::ifstream is(config.context);
+            SIO_CHECK(is.good());
+            context.Load(is, tokenizer, config.context_bonus);
+            config.beam_search.context_biasing = true; // tokens need a context LM slot
         }
 
         return Error::OK;
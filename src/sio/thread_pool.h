@@ -0,0 +1,108 @@
+#ifndef SIO_THREAD_POOL_H
+#define SIO_THREAD_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "sio/base.h"
+
+namespace sio {
+
+// Fixed-size pool running one parallel-for at a time: Run(f) calls f(0), ..., f(Size() - 1)
+// concurrently and returns after all of them finish. Caller's thread works as worker 0,
+// so a pool of size 1 spawns no thread at all.
+class ThreadPool {
+    vec<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+
+    const std::function<void(int)>* job_ = nullptr;
+    u64 generation_ = 0; // bumped by each Run(), wakes up workers
+    int pending_ = 0; // workers yet to finish current job
+    bool stop_ = false;
+
+public:
+
+    Error Load(int num_threads) {
+        SIO_CHECK_GT(num_threads, 0);
+        SIO_CHECK(threads_.empty());
+
+        for (int i = 1; i != num_threads; i++) {
+            threads_.emplace_back([this, i]() { WorkerLoop(i); });
+        }
+
+        return Error::OK;
+    }
+
+
+    int Size() const { return threads_.size() + 1; }
+
+
+    void Run(const std::function<void(int)>& f) {
+        if (threads_.empty()) {
+            f(0);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = &f;
+            pending_ = threads_.size();
+            generation_++;
+        }
+        work_cv_.notify_all();
+
+        f(0);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this]() { return pending_ == 0; });
+        job_ = nullptr;
+    }
+
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        work_cv_.notify_all();
+
+        for (std::thread& t : threads_) {
+            t.join();
+        }
+    }
+
+private:
+
+    void WorkerLoop(int i) {
+        u64 seen = 0;
+        while (true) {
+            const std::function<void(int)>* job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                work_cv_.wait(lock, [this, seen]() { return stop_ || generation_ != seen; });
+                if (stop_) {
+                    return;
+                }
+                seen = generation_;
+                job = job_;
+            }
+
+            (*job)(i);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--pending_ == 0) {
+                    done_cv_.notify_one();
+                }
+            }
+        }
+    }
+
+}; // class ThreadPool
+}  // namespace sio
+#endif
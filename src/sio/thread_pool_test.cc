@@ -0,0 +1,29 @@
+#include "sio/thread_pool.h"
+
+#include <atomic>
+
+#include <gtest/gtest.h>
+
+namespace sio {
+
+TEST(ThreadPool, Run) {
+    for (int n : {1, 2, 5}) {
+        ThreadPool pool;
+        pool.Load(n);
+        EXPECT_EQ(pool.Size(), n);
+
+        vec<int> hits(n, 0);
+        std::atomic<int> total(0);
+        std::function<void(int)> f = [&](int i) { hits[i]++; total++; };
+        for (int round = 0; round != 100; round++) {
+            pool.Run(f);
+        }
+
+        EXPECT_EQ(total, 100 * n);
+        for (int h : hits) {
+            EXPECT_EQ(h, 100);
+        }
+    }
+}
+
+} // namespace sio
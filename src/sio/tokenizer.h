@@ -73,6 +73,11 @@ public:
         return token_to_index_.at(token);
     }
 
+
+    bool Contains(const str& token) const {
+        return token_to_index_.find(token) != token_to_index_.end();
+    }
+
 }; // class Tokenizer
 }  // namespace sio
 #endif
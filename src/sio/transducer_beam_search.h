@@ -0,0 +1,723 @@
+#ifndef SIO_TRANSDUCER_BEAM_SEARCH_H
+#define SIO_TRANSDUCER_BEAM_SEARCH_H
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include <torch/torch.h>
+
+#include "sio/base.h"
+#include "sio/struct_loader.h"
+#include "sio/binary_io.h"
+#include "sio/tokenizer.h"
+#include "sio/language_model.h"
+#include "sio/beam_search_itf.h"
+#include "sio/ctc_prefix_beam_search.h"
+#include "sio/transducer_model.h"
+
+namespace sio {
+
+struct TransducerBeamSearchConfig {
+    i32 beam_size = 4; // prefixes kept after each frame
+    i32 token_topk = 4; // non-blank tokens expanded per hypothesis & frame
+    f32 token_beam = 10.0; // candidate tokens score within this of hypothesis's best token
+
+    i32 nbest = 1;
+
+    f32 insertion_penalty = 0.0;
+
+    Error Register(StructLoader* loader, const std::string module = "") {
+        loader->AddEntry(module + ".beam_size", &beam_size);
+        loader->AddEntry(module + ".token_topk", &token_topk);
+        loader->AddEntry(module + ".token_beam", &token_beam);
+
+        loader->AddEntry(module + ".nbest", &nbest);
+
+        loader->AddEntry(module + ".insertion_penalty", &insertion_penalty);
+
+        return Error::OK;
+    }
+};
+
+
+/*
+ * Transducer(RNN-T) beam search over encoder frames, each hypothesis emits at most one token per frame
+ * (modified beam search), so that the joint network runs once per frame over the whole beam:
+ *   1. predictor outputs of beam prefixes are joined with the frame in one batch
+ *   2. a hypothesis extends by blank(same prefix) or by one of its top tokens, same prefixes are merged
+ *   3. survivors of pruning that are new to beam get their predictor step in one batch
+ *
+ * Predictor outputs & states are cached by prefix: a prefix runs predictor once when it enters beam,
+ * and reuses it for all following frames while it stays, i.e. blank frames cost no predictor call.
+ *
+ * Prefixes are hash-consed into a trie and compacted like CtcPrefixBeamSearch, an optional LanguageModel is
+ * shallow-fused when a prefix is extended.
+ */
+class TransducerBeamSearch : public BeamSearchItf {
+    using NodeId = u32;
+    static constexpr NodeId kRoot = 0;
+    static constexpr NodeId kPending = std::numeric_limits<NodeId>::max(); // not interned yet
+    static constexpr f32 kLogZero = -std::numeric_limits<f32>::infinity();
+    static constexpr size_t kMinCompactSize = 1024;
+
+    struct PrefixNode {
+        NodeId parent = 0;
+        TokenId token = kNoTokenId; // last token of prefix, kNoTokenId for root
+        int depth = 0;
+        LmStateId lm_state = 0;
+        f32 lm_score = 0.0; // LM & insertion scores of whole prefix
+        int emit_frame = 0; // frame emitting prefix's last token
+        f32 emit_score = 0.0; // log posterior of last token at emit_frame
+    };
+
+    // A prefix hypothesis of current frame, not interned into trie before it survives pruning.
+    struct Hyp {
+        NodeId node = kPending;
+        NodeId parent = 0;
+        TokenId token = kNoTokenId;
+
+        LmStateId lm_state = 0;
+        f32 lm_score = 0.0;
+        f32 emit_score = 0.0; // of pending prefixes
+
+        f32 am_score = kLogZero;
+
+        inline f32 TotalScore() const { return am_score + lm_score; }
+    };
+
+    // Predictor output & state of a beam prefix.
+    struct PredictorEntry {
+        torch::Tensor out;
+        torch::Tensor state;
+    };
+
+    TransducerBeamSearchConfig config_;
+    TransducerModelItf* model_ = nullptr; // owned outside
+    const Tokenizer* tokenizer_ = nullptr;
+    LanguageModel* lm_ = nullptr; // optional, owned outside
+
+    PredictorEntry init_predictor_; // of empty prefix, same for all segments
+
+    SearchStats stats_; // stays empty
+    vec<SearchStats> stats_histogram_;
+
+    str session_key_;
+    int cur_time_ = 0;
+    int num_frames_ = 0;
+
+    vec<PrefixNode> nodes_;
+    hashtab<u64, NodeId> children_; // (parent, token) -> child node
+    size_t compact_size_ = kMinCompactSize; // trie size triggering next compaction
+    vec<NodeId> remap_; // old -> new node id during compaction
+
+    vec<Hyp> beam_; // sorted, best first
+    vec<Hyp> next_;
+    hashtab<u64, int> next_index_; // (parent, token) -> index in next_, parent of blank extension is node itself
+
+    hashtab<NodeId, PredictorEntry> predictor_cache_; // prefixes of beam
+    hashtab<NodeId, PredictorEntry> predictor_cache_swap_;
+
+    // batches of model calls
+    vec<torch::Tensor> preds_;
+    vec<TokenId> predict_tokens_;
+    vec<torch::Tensor> predict_states_;
+    vec<NodeId> predict_nodes_;
+    vec<torch::Tensor> predict_outs_;
+    vec<torch::Tensor> predict_next_states_;
+    vec<TokenId> candidates_;
+
+    NodeId committed_node_ = kRoot;
+    vec<TokenId> committed_;
+
+    i32 beam_size_ = 0; // effective under RTF budget degradation, see SetDegradation()
+
+    vec<vec<TokenId>> nbest_;
+    vec<OutputAlignment> alignment_;
+
+public:
+
+    Error Load(const TransducerBeamSearchConfig& config, TransducerModelItf& model, const Tokenizer& tokenizer,
+        LanguageModel* lm = nullptr)
+    {
+        config_ = config;
+        SIO_CHECK_GT(config_.beam_size, 0);
+        SIO_CHECK_GT(config_.token_topk, 0);
+
+        SIO_CHECK(model_ == nullptr);
+        model_ = &model;
+        model_->InitPredictor(&init_predictor_.out, &init_predictor_.state);
+
+        SIO_CHECK(tokenizer_ == nullptr);
+        tokenizer_ = &tokenizer;
+
+        lm_ = lm;
+
+        beam_size_ = config_.beam_size;
+
+        return Error::OK;
+    }
+
+
+    Error AttachClassGraph(FstLabel nonterminal, const Fst& graph) override {
+        SIO_CHECK(false); // transducer search works without decoding graph
+        return Error::AssertionFailure;
+    }
+
+
+    Error AttachContextGraph(const ContextGraph& graph) override {
+        SIO_CHECK(false); // transducer search takes its LM at load time
+        return Error::AssertionFailure;
+    }
+
+
+    Error InitSession(const char* session_key) override {
+        session_key_ = session_key;
+        num_frames_ = 0;
+
+        beam_size_ = config_.beam_size;
+
+        InitSegment();
+
+        return Error::OK;
+    }
+
+
+    // enc: one encoder frame, see ScorerConfig::output
+    Error Push(const torch::Tensor enc) override {
+        SIO_CHECK_EQ(enc.dim(), 1); // frame by frame
+
+        ExpandHyps(enc);
+        PruneHyps();
+        UpdatePredictor();
+        CommitPrefix();
+        CompactTrie();
+
+        cur_time_++;
+        num_frames_++;
+
+        return Error::OK;
+    }
+
+
+    Error PushEos() override {
+        SIO_CHECK(nbest_.empty());
+
+        if (lm_ != nullptr) {
+            for (Hyp& h : beam_) {
+                LmStateId s;
+                h.lm_score += lm_->GetScore(h.lm_state, tokenizer_->eos, &s);
+            }
+            std::sort(beam_.begin(), beam_.end(), [](const Hyp& x, const Hyp& y) {
+                return x.TotalScore() > y.TotalScore();
+            });
+        }
+
+        for (int k = 0; k < config_.nbest && k < beam_.size(); k++) {
+            vec<TokenId> path = {tokenizer_->eos}; // same convention as graph search outputs
+            for (NodeId n = beam_[k].node; n != kRoot; n = nodes_[n].parent) {
+                path.push_back(nodes_[n].token);
+            }
+            path.push_back(tokenizer_->bos);
+            std::reverse(path.begin(), path.end());
+            nbest_.push_back(std::move(path));
+        }
+
+        AlignBestPrefix();
+
+        return Error::OK;
+    }
+
+
+    const vec<vec<TokenId>>& NBest() override {
+        return nbest_;
+    }
+
+
+    // A token spans the single frame emitting it, with its log posterior there as acoustic score.
+    const vec<OutputAlignment>& BestAlignment() override {
+        return alignment_;
+    }
+
+
+    // Tokens shared by all surviving prefixes, they are stable and only grow during a segment.
+    const vec<TokenId>& CommittedPath() const override {
+        return committed_;
+    }
+
+
+    Error PartialPath(vec<TokenId>* path) const override {
+        SIO_CHECK(path != nullptr);
+        path->clear();
+
+        for (NodeId n = beam_[0].node; n != committed_node_; n = nodes_[n].parent) {
+            path->push_back(nodes_[n].token);
+        }
+        std::reverse(path->begin(), path->end());
+
+        return Error::OK;
+    }
+
+
+    // Every prefix can end at any frame, so only blank length rules apply(relative cost is always 0).
+    bool EndpointDetected(const EndpointConfig& config) const override {
+        if (cur_time_ >= config.max_segment_length) {
+            return true;
+        }
+
+        if (beam_[0].node == kRoot) {
+            return cur_time_ >= config.max_silence;
+        }
+
+        int trailing_blank = cur_time_ - (nodes_[beam_[0].node].emit_frame + 1);
+        return trailing_blank >= config.min_trailing_blank;
+    }
+
+
+    Error ResetSegment() override {
+        DeinitSegment();
+        InitSegment();
+
+        return Error::OK;
+    }
+
+
+    // Prefix beam maps to max_active, the only LM is never dropped.
+    Error SetDegradation(int level, const RtfBudgetConfig& config) override {
+        SIO_CHECK_GE(level, 0);
+        beam_size_ = std::max(1, static_cast<i32>(config_.beam_size * std::pow(config.max_active_scale, level)));
+
+        return Error::OK;
+    }
+
+
+    // Trie is written as is(with its compaction point), along with predictor entries of beam prefixes pickled by torch.
+    // LM states are written as is, so an external LM must have process independent states.
+    Error Snapshot(std::ostream& os) override {
+        SIO_CHECK(nbest_.empty()); // before PushEos()
+
+        using kaldi::WriteToken;
+        using kaldi::WriteBasicType;
+
+        bool binary = true;
+
+        WriteToken(os, binary, "<TransducerBeamSearch>");
+        WriteString(os, session_key_);
+        WriteBasicType(os, binary, num_frames_);
+        WriteBasicType(os, binary, beam_size_);
+
+        WriteBasicType(os, binary, cur_time_);
+        WritePodVector(os, nodes_);
+        WriteBasicType(os, binary, compact_size_);
+        WritePodVector(os, beam_);
+        WriteBasicType(os, binary, committed_node_);
+        WritePodVector(os, committed_);
+
+        for (const Hyp& h : beam_) {
+            const PredictorEntry& e = predictor_cache_.at(h.node);
+            WritePodVector(os, torch::pickle_save(e.out));
+            WritePodVector(os, torch::pickle_save(e.state));
+        }
+
+        return os.good() ? Error::OK : Error::Unknown;
+    }
+
+
+    Error Restore(std::istream& is) override {
+        using kaldi::ExpectToken;
+        using kaldi::ReadBasicType;
+
+        bool binary = true;
+
+        ExpectToken(is, binary, "<TransducerBeamSearch>");
+        str session_key;
+        ReadString(is, &session_key);
+
+        InitSession(session_key.c_str());
+        DeinitSegment();
+
+        ReadBasicType(is, binary, &num_frames_);
+        ReadBasicType(is, binary, &beam_size_);
+
+        ReadBasicType(is, binary, &cur_time_);
+        ReadPodVector(is, &nodes_);
+        ReadBasicType(is, binary, &compact_size_);
+        ReadPodVector(is, &beam_);
+        ReadBasicType(is, binary, &committed_node_);
+        ReadPodVector(is, &committed_);
+
+        for (NodeId n = 1; n < nodes_.size(); n++) {
+            children_[PrefixKey(nodes_[n].parent, nodes_[n].token)] = n;
+        }
+
+        vec<char> pickle;
+        for (const Hyp& h : beam_) {
+            PredictorEntry& e = predictor_cache_[h.node];
+            ReadPodVector(is, &pickle);
+            e.out = torch::pickle_load(pickle).toTensor();
+            ReadPodVector(is, &pickle);
+            e.state = torch::pickle_load(pickle).toTensor();
+        }
+
+        return is.good() ? Error::OK : Error::Unknown;
+    }
+
+
+    Error DeinitSession() override {
+        DeinitSegment();
+
+        return Error::OK;
+    }
+
+
+    int NumFrames() const override { return num_frames_; }
+    int NumSkippedFrames() const override { return 0; }
+    int NumEpsReexpansions() const override { return 0; }
+    f32 BeamTightening() const override { return 0.0; }
+
+    // num of interned prefixes
+    size_t TokenArenaSize() const override { return nodes_.size(); }
+    size_t NumLatticeFrames() const override { return 0; } // prefixes keep no per-frame state
+
+    // transducer search keeps no search counters
+    const SearchStats& FrameStats() const override { return stats_; }
+    const SearchStats& SessionStats() const override { return stats_; }
+    const vec<SearchStats>& FrameStatsHistogram() const override { return stats_histogram_; }
+
+private:
+
+    Error InitSegment() {
+        SIO_CHECK(nodes_.empty());
+
+        PrefixNode root;
+        if (lm_ != nullptr) {
+            root.lm_score = lm_->GetScore(lm_->NullState(), tokenizer_->bos, &root.lm_state);
+        }
+        nodes_.push_back(root);
+
+        Hyp h;
+        h.node = kRoot;
+        h.lm_state = root.lm_state;
+        h.lm_score = root.lm_score;
+        h.am_score = 0.0;
+        beam_.push_back(h);
+
+        predictor_cache_[static_cast<NodeId>(kRoot)] = init_predictor_; // copy, kRoot has no out-of-class definition
+
+        return Error::OK;
+    }
+
+
+    Error DeinitSegment() {
+        cur_time_ = 0;
+
+        nodes_.clear();
+        children_.clear();
+        compact_size_ = kMinCompactSize;
+
+        beam_.clear();
+        next_.clear();
+        next_index_.clear();
+
+        predictor_cache_.clear();
+        predictor_cache_swap_.clear();
+
+        committed_node_ = kRoot;
+        committed_.clear();
+
+        nbest_.clear();
+        alignment_.clear();
+
+        return Error::OK;
+    }
+
+
+    static inline u64 PrefixKey(NodeId parent, TokenId token) {
+        return (static_cast<u64>(static_cast<u32>(token)) << 32) | parent;
+    }
+
+
+    // Hypothesis of next frame extended from parent by token, created on first reach.
+    Hyp& NextHyp(NodeId parent, TokenId token, f32 emit_score) {
+        u64 key = PrefixKey(parent, token);
+        auto it = next_index_.find(key);
+        if (it != next_index_.end()) {
+            return next_[it->second];
+        }
+
+        next_index_[key] = next_.size();
+        next_.emplace_back();
+        Hyp& h = next_.back();
+        h.parent = parent;
+        h.token = token;
+        h.emit_score = emit_score;
+
+        auto c = children_.find(key);
+        if (c != children_.end()) { // interned earlier, LM scores are reused
+            const PrefixNode& node = nodes_[c->second];
+            h.node = c->second;
+            h.lm_state = node.lm_state;
+            h.lm_score = node.lm_score;
+        } else {
+            const PrefixNode& par = nodes_[parent];
+            h.lm_state = par.lm_state;
+            h.lm_score = par.lm_score - config_.insertion_penalty;
+            if (lm_ != nullptr) {
+                h.lm_score += lm_->GetScore(par.lm_state, token, &h.lm_state);
+            }
+        }
+
+        return h;
+    }
+
+
+    // Hypothesis of next frame with the same prefix as an interned node(blank extension).
+    Hyp& NextHyp(NodeId node) {
+        const PrefixNode& n = nodes_[node];
+        u64 key = PrefixKey(n.parent, n.token);
+        auto it = next_index_.find(key);
+        if (it != next_index_.end()) {
+            return next_[it->second];
+        }
+
+        next_index_[key] = next_.size();
+        next_.emplace_back();
+        Hyp& h = next_.back();
+        h.node = node;
+        h.parent = n.parent;
+        h.token = n.token;
+        h.lm_state = n.lm_state;
+        h.lm_score = n.lm_score;
+
+        return h;
+    }
+
+
+    // Top-k tokens of a hypothesis within token_beam of its best one, special tokens are excluded.
+    void SelectCandidates(const float* logp, int n) {
+        candidates_.clear();
+        FrameCandidates(logp, n, FrameMax(logp, n) - config_.token_beam, &candidates_);
+
+        const Tokenizer& tk = *tokenizer_;
+        candidates_.erase(
+            std::remove_if(candidates_.begin(), candidates_.end(), [&tk](TokenId t) {
+                return t == tk.blk || t == tk.unk || t == tk.bos || t == tk.eos;
+            }),
+            candidates_.end()
+        );
+
+        if (candidates_.size() > config_.token_topk) {
+            std::nth_element(candidates_.begin(), candidates_.begin() + config_.token_topk, candidates_.end(),
+                [logp](TokenId x, TokenId y) { return logp[x] > logp[y]; }
+            );
+            candidates_.resize(config_.token_topk);
+        }
+    }
+
+
+    void ExpandHyps(const torch::Tensor& enc) {
+        SIO_CHECK(next_.empty());
+        const TokenId blk = tokenizer_->blk;
+
+        // one joint network call over all beam hypotheses
+        preds_.clear();
+        for (const Hyp& h : beam_) {
+            preds_.push_back(predictor_cache_.at(h.node).out);
+        }
+        torch::Tensor logp;
+        model_->Join(enc, preds_, &logp);
+        SIO_CHECK_EQ(logp.size(0), beam_.size());
+        int dim = logp.size(1);
+
+        for (int i = 0; i != beam_.size(); i++) {
+            // copy, next_ grows while iterating
+            const NodeId node = beam_[i].node;
+            const f32 am_score = beam_[i].am_score;
+            const float* row = logp.data_ptr<float>() + static_cast<size_t>(i) * dim;
+
+            Hyp& h = NextHyp(node);
+            h.am_score = LogAddExp(h.am_score, am_score + row[blk]);
+
+            SelectCandidates(row, dim);
+            for (TokenId t : candidates_) {
+                Hyp& q = NextHyp(node, t, row[t]);
+                q.am_score = LogAddExp(q.am_score, am_score + row[t]);
+            }
+        }
+    }
+
+
+    // Keeps beam_size best hypotheses, interns survivors into trie.
+    void PruneHyps() {
+        auto better = [](const Hyp& x, const Hyp& y) {
+            return x.TotalScore() > y.TotalScore();
+        };
+        if (next_.size() > beam_size_) {
+            std::nth_element(next_.begin(), next_.begin() + beam_size_, next_.end(), better);
+            next_.resize(beam_size_);
+        }
+        std::sort(next_.begin(), next_.end(), better);
+        next_index_.clear();
+
+        // keep scores in a good dynamic range, ranking is unchanged
+        f32 offset = next_[0].am_score;
+
+        for (Hyp& h : next_) {
+            h.am_score -= offset;
+
+            if (h.node == kPending) {
+                h.node = nodes_.size();
+                children_[PrefixKey(h.parent, h.token)] = h.node;
+
+                PrefixNode n;
+                n.parent = h.parent;
+                n.token = h.token;
+                n.depth = nodes_[h.parent].depth + 1;
+                n.lm_state = h.lm_state;
+                n.lm_score = h.lm_score;
+                n.emit_frame = cur_time_;
+                n.emit_score = h.emit_score;
+                nodes_.push_back(n);
+            }
+        }
+
+        beam_.swap(next_);
+        next_.clear();
+    }
+
+
+    // Runs one batched predictor step over prefixes new to beam, entries of prefixes leaving beam are dropped.
+    // A new prefix extends a prefix of previous beam, so its parent's entry is still cached.
+    void UpdatePredictor() {
+        predict_tokens_.clear();
+        predict_states_.clear();
+        predict_nodes_.clear();
+
+        predictor_cache_swap_.clear();
+        for (const Hyp& h : beam_) {
+            auto it = predictor_cache_.find(h.node);
+            if (it != predictor_cache_.end()) {
+                predictor_cache_swap_[h.node] = it->second;
+            } else {
+                const PrefixNode& n = nodes_[h.node];
+                predict_tokens_.push_back(n.token);
+                predict_states_.push_back(predictor_cache_.at(n.parent).state);
+                predict_nodes_.push_back(h.node);
+            }
+        }
+
+        if (!predict_nodes_.empty()) {
+            model_->Predict(predict_tokens_, predict_states_, &predict_outs_, &predict_next_states_);
+            for (int i = 0; i != predict_nodes_.size(); i++) {
+                PredictorEntry& e = predictor_cache_swap_[predict_nodes_[i]];
+                e.out = predict_outs_[i];
+                e.state = predict_next_states_[i];
+            }
+        }
+
+        predictor_cache_.swap(predictor_cache_swap_);
+    }
+
+
+    void AlignBestPrefix() {
+        SIO_CHECK(alignment_.empty());
+        if (beam_.empty()) {
+            return;
+        }
+
+        for (NodeId n = beam_[0].node; n != kRoot; n = nodes_[n].parent) {
+            const PrefixNode& node = nodes_[n];
+
+            OutputAlignment a;
+            a.token = node.token;
+            a.begin_frame = node.emit_frame;
+            a.end_frame = node.emit_frame + 1;
+            a.am_score = node.emit_score;
+            a.lm_score = node.lm_score - nodes_[node.parent].lm_score;
+            a.confidence = std::exp(node.emit_score);
+            alignment_.push_back(a);
+        }
+        std::reverse(alignment_.begin(), alignment_.end());
+    }
+
+
+    // Advances committed node to the deepest common ancestor of surviving prefixes, see CtcPrefixBeamSearch.
+    void CommitPrefix() {
+        int depth = nodes_[beam_[0].node].depth;
+        for (const Hyp& h : beam_) {
+            depth = std::min(depth, nodes_[h.node].depth);
+        }
+
+        NodeId common = beam_[0].node;
+        while (nodes_[common].depth > depth) {
+            common = nodes_[common].parent;
+        }
+        for (const Hyp& h : beam_) {
+            NodeId n = h.node;
+            while (nodes_[n].depth > depth) {
+                n = nodes_[n].parent;
+            }
+            while (n != common) { // both are at same depth
+                n = nodes_[n].parent;
+                common = nodes_[common].parent;
+                depth--;
+            }
+        }
+
+        size_t k = committed_.size();
+        for (NodeId n = common; n != committed_node_; n = nodes_[n].parent) {
+            committed_.push_back(nodes_[n].token);
+        }
+        std::reverse(committed_.begin() + k, committed_.end());
+        committed_node_ = common;
+    }
+
+
+    // Drops nodes no surviving prefix descends from, see CtcPrefixBeamSearch, predictor entries follow renumbering.
+    void CompactTrie() {
+        if (nodes_.size() < compact_size_) {
+            return;
+        }
+
+        remap_.assign(nodes_.size(), static_cast<NodeId>(kPending)); // no ODR-use of constants in C++14
+        remap_[kRoot] = kRoot;
+        for (const Hyp& h : beam_) {
+            for (NodeId n = h.node; remap_[n] == kPending; n = nodes_[n].parent) {
+                remap_[n] = kRoot; // marked, renumbered below
+            }
+        }
+
+        NodeId live = 1;
+        for (NodeId n = 1; n != nodes_.size(); n++) {
+            if (remap_[n] == kPending) {
+                continue;
+            }
+            remap_[n] = live;
+            PrefixNode node = nodes_[n];
+            node.parent = remap_[node.parent];
+            nodes_[live++] = node;
+        }
+        nodes_.resize(live);
+
+        children_.clear();
+        for (NodeId n = 1; n != nodes_.size(); n++) {
+            children_[PrefixKey(nodes_[n].parent, nodes_[n].token)] = n;
+        }
+        for (Hyp& h : beam_) {
+            h.node = remap_[h.node];
+            h.parent = remap_[h.parent];
+        }
+        committed_node_ = remap_[committed_node_];
+
+        predictor_cache_swap_.clear();
+        for (auto& kv : predictor_cache_) {
+            predictor_cache_swap_[remap_[kv.first]] = kv.second;
+        }
+        predictor_cache_.swap(predictor_cache_swap_);
+
+        compact_size_ = std::max(static_cast<size_t>(kMinCompactSize), 2 * nodes_.size());
+    }
+
+}; // class TransducerBeamSearch
+}  // namespace sio
+#endif
@@ -0,0 +1,266 @@
+#include "sio/transducer_beam_search.h"
+
+#include <random>
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+#include "sio/beam_search.h"
+
+namespace sio {
+namespace { // seal test helpers in anonymous namespace
+
+// Encoder frames are token logits as is, predictor output is the last token of prefix,
+// joiner penalizes repeating it. Model calls are counted.
+class FakeTransducerModel : public TransducerModelItf {
+    int dim_;
+
+public:
+    int predict_calls = 0;
+    int predict_rows = 0;
+    int join_calls = 0;
+    int join_rows = 0;
+
+    explicit FakeTransducerModel(int dim) : dim_(dim) { }
+
+    Error InitPredictor(torch::Tensor* out, torch::Tensor* state) override {
+        *out = Scalar(-1.0);
+        *state = Scalar(0.0);
+        return Error::OK;
+    }
+
+
+    Error Predict(const vec<TokenId>& tokens, const vec<torch::Tensor>& states,
+        vec<torch::Tensor>* outs, vec<torch::Tensor>* next_states) override
+    {
+        predict_calls++;
+        predict_rows += tokens.size();
+
+        outs->clear();
+        next_states->clear();
+        for (int i = 0; i != tokens.size(); i++) {
+            outs->push_back(Scalar(tokens[i]));
+            next_states->push_back(Scalar(states[i].data_ptr<float>()[0] + 1.0)); // prefix length
+        }
+        return Error::OK;
+    }
+
+
+    Error Join(const torch::Tensor& enc, const vec<torch::Tensor>& preds, torch::Tensor* logp) override {
+        join_calls++;
+        join_rows += preds.size();
+
+        vec<f32> out(preds.size() * dim_);
+        for (int b = 0; b != preds.size(); b++) {
+            f32* row = out.data() + b * dim_;
+            std::copy(enc.data_ptr<float>(), enc.data_ptr<float>() + dim_, row);
+
+            int last = static_cast<int>(preds[b].data_ptr<float>()[0]);
+            if (last >= 0) {
+                row[last] -= 1.0;
+            }
+
+            f32 z = row[0];
+            for (int t = 1; t != dim_; t++) {
+                z = LogAddExp(z, row[t]);
+            }
+            for (int t = 0; t != dim_; t++) {
+                row[t] -= z;
+            }
+        }
+        *logp = torch::from_blob(out.data(), {(i64)preds.size(), (i64)dim_}, torch::kFloat).clone();
+        return Error::OK;
+    }
+
+private:
+
+    static torch::Tensor Scalar(f32 x) {
+        return torch::from_blob(&x, {1}, torch::kFloat).clone();
+    }
+};
+
+} // namespace
+
+
+// On peaky frames, best prefix emits the dominant token of each non-blank frame, repeats included.
+// Joiner runs once per frame over the beam, predictor only for prefixes entering beam.
+TEST(TransducerBeamSearch, PeakyFramesMatchGreedy) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+
+    std::mt19937 rng(777);
+    std::uniform_real_distribution<f32> noise(-12.0, -6.0);
+    vec<f32> score(tokenizer.Size());
+
+    FakeTransducerModel model(tokenizer.Size());
+    TransducerBeamSearchConfig config;
+    config.beam_size = 4;
+    config.token_topk = 4;
+    BeamSearch search;
+    search.LoadTransducerBeamSearch(config, model, tokenizer);
+
+    search.InitSession();
+    vec<TokenId> greedy = {tokenizer.bos};
+    const int num_frames = 500;
+    for (int t = 0; t != num_frames; t++) {
+        for (auto& s : score) {
+            s = noise(rng);
+        }
+        TokenId best = rng() % 3 == 0 ? 4 + rng() % 8 : tokenizer.blk; // few distinct tokens, so repeats occur
+        score[best] = 0.0;
+        if (best != tokenizer.blk) {
+            greedy.push_back(best);
+        }
+
+        search.Push(torch::from_blob(score.data(), {(i64)score.size()}, torch::kFloat).clone());
+
+        const vec<TokenId>& committed = search.CommittedPath();
+        EXPECT_TRUE(std::equal(committed.begin(), committed.end(), greedy.begin() + 1));
+    }
+    greedy.push_back(tokenizer.eos);
+
+    search.PushEos();
+    EXPECT_EQ(search.NBest()[0], greedy);
+    search.DeinitSession();
+
+    EXPECT_EQ(model.join_calls, num_frames);
+    EXPECT_GT(model.join_rows, num_frames); // batched over beam
+    EXPECT_LE(model.predict_calls, num_frames);
+    EXPECT_LT(model.predict_rows, model.join_rows / 2); // blank extensions reuse cached predictor outputs
+}
+
+
+// Pruned branches are compacted away, so trie is bounded by committed tokens instead of frames.
+TEST(TransducerBeamSearch, LongSessionTrie) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+
+    std::mt19937 rng(777);
+    std::uniform_real_distribution<f32> noise(-16.0, -10.0);
+    vec<f32> score(tokenizer.Size());
+
+    FakeTransducerModel model(tokenizer.Size());
+    TransducerBeamSearchConfig config;
+    config.beam_size = 8;
+    config.token_topk = 8;
+    BeamSearch search;
+    search.LoadTransducerBeamSearch(config, model, tokenizer);
+
+    search.InitSession();
+    vec<TokenId> greedy = {tokenizer.bos};
+    for (int t = 0; t != 5000; t++) {
+        for (auto& s : score) {
+            s = noise(rng) + t * 1e-3; // rising noise, so older alternatives fall out of beam
+        }
+        TokenId best = rng() % 3 == 0 ? 4 + rng() % 8 : tokenizer.blk;
+        score[best] = 0.0;
+        if (best != tokenizer.blk) {
+            greedy.push_back(best);
+        }
+
+        search.Push(torch::from_blob(score.data(), {(i64)score.size()}, torch::kFloat).clone());
+        EXPECT_LT(search.TokenArenaSize(), 2 * search.CommittedPath().size() + 2048);
+    }
+    greedy.push_back(tokenizer.eos);
+
+    search.PushEos();
+    EXPECT_EQ(search.NBest()[0], greedy);
+    ASSERT_EQ(search.BestAlignment().size(), greedy.size() - 2);
+    for (int i = 1; i != search.BestAlignment().size(); i++) {
+        EXPECT_LT(search.BestAlignment()[i - 1].begin_frame, search.BestAlignment()[i].begin_frame);
+    }
+    search.DeinitSession();
+}
+
+
+TEST(TransducerBeamSearch, LmFusion) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+    TokenId x = tokenizer.Index("的");
+    TokenId y = tokenizer.Index("在");
+
+    auto frame = [&](TokenId t, TokenId runner_up) {
+        vec<f32> score(tokenizer.Size(), -20.0);
+        score[tokenizer.blk] = -5.0;
+        score[t] = 0.0;
+        if (runner_up != kNoTokenId) {
+            score[runner_up] = -0.5;
+        }
+        return torch::from_blob(score.data(), {(i64)score.size()}, torch::kFloat).clone();
+    };
+
+    ContextGraph phrases;
+    phrases.Load({{y}}, {2.0}, tokenizer.Size());
+    LanguageModel lm;
+    lm.LoadContextLm();
+    lm.SetContextGraph(&phrases);
+
+    FakeTransducerModel model(tokenizer.Size());
+    for (bool fusion : {false, true}) {
+        BeamSearch search;
+        search.LoadTransducerBeamSearch(TransducerBeamSearchConfig(), model, tokenizer, fusion ? &lm : nullptr);
+
+        search.InitSession();
+        search.Push(frame(x, y));
+        for (int t = 0; t != 3; t++) {
+            search.Push(frame(tokenizer.blk, kNoTokenId));
+        }
+        search.PushEos();
+        EXPECT_EQ(search.NBest()[0], vec<TokenId>({tokenizer.bos, fusion ? y : x, tokenizer.eos}));
+
+        const vec<OutputAlignment>& alignment = search.BestAlignment();
+        ASSERT_EQ(alignment.size(), 1);
+        EXPECT_EQ(alignment[0].begin_frame, 0);
+        EXPECT_EQ(alignment[0].end_frame, 1);
+        EXPECT_GT(alignment[0].lm_score, fusion ? 0.0 : -1.0);
+        search.DeinitSession();
+    }
+}
+
+
+TEST(TransducerBeamSearch, Snapshot) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+
+    std::mt19937 rng(777);
+    std::uniform_real_distribution<f32> noise(-8.0, -2.0); // flat enough to keep competing prefixes
+    vec<torch::Tensor> frames;
+    vec<f32> score(tokenizer.Size());
+    for (int t = 0; t != 400; t++) {
+        for (auto& s : score) {
+            s = noise(rng);
+        }
+        score[rng() % 3 == 0 ? 4 + rng() % 8 : tokenizer.blk] = -0.5;
+        frames.push_back(torch::from_blob(score.data(), {(i64)score.size()}, torch::kFloat).clone());
+    }
+
+    FakeTransducerModel model(tokenizer.Size());
+    TransducerBeamSearchConfig config;
+    config.nbest = 4;
+    BeamSearch search;
+    search.LoadTransducerBeamSearch(config, model, tokenizer);
+    BeamSearch migrated;
+    migrated.LoadTransducerBeamSearch(config, model, tokenizer);
+
+    search.InitSession();
+    for (int t = 0; t != 200; t++) {
+        search.Push(frames[t]);
+    }
+    std::stringstream blob;
+    ASSERT_EQ(search.Snapshot(blob), Error::OK);
+    ASSERT_EQ(migrated.Restore(blob), Error::OK);
+
+    for (int t = 200; t != frames.size(); t++) {
+        search.Push(frames[t]);
+        migrated.Push(frames[t]);
+    }
+    search.PushEos();
+    migrated.PushEos();
+    EXPECT_EQ(migrated.NBest(), search.NBest());
+    EXPECT_EQ(migrated.NumFrames(), search.NumFrames());
+
+    search.DeinitSession();
+    migrated.DeinitSession();
+}
+
+} // namespace sio
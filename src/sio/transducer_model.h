@@ -0,0 +1,128 @@
+#ifndef SIO_TRANSDUCER_MODEL_H
+#define SIO_TRANSDUCER_MODEL_H
+
+#include <torch/torch.h>
+#include <torch/script.h>
+
+#include "sio/base.h"
+#include "sio/tokenizer.h"
+
+namespace sio {
+
+// Predictor & joiner of a transducer(RNN-T) model, batched over hypotheses.
+// Predictor outputs & states are opaque per-hypothesis tensors to decoders,
+// so that a decoder caches them by prefix while batching is left to the model.
+class TransducerModelItf {
+public:
+    // Predictor output & state of the empty prefix.
+    virtual Error InitPredictor(torch::Tensor* out, torch::Tensor* state) = 0;
+
+    // One predictor step of each hypothesis: feeds tokens[b] into states[b].
+    virtual Error Predict(const vec<TokenId>& tokens, const vec<torch::Tensor>& states,
+        vec<torch::Tensor>* outs, vec<torch::Tensor>* next_states) = 0;
+
+    // Joint network of one encoder frame & predictor outputs of B hypotheses,
+    // logp: token log posteriors, contiguous float [B, vocab size].
+    virtual Error Join(const torch::Tensor& enc, const vec<torch::Tensor>& preds, torch::Tensor* logp) = 0;
+
+    virtual ~TransducerModelItf() { }
+};
+
+
+// Transducer of a TorchScript nnet exporting WeNet style methods:
+//   forward_predictor_init_state() -> List[Tensor], each [layers, 1, H]
+//   forward_predictor_step(xs: [B, 1], cache: List[Tensor]) -> ([B, 1, P], List[Tensor])
+//   forward_joint_step(enc_out: [B, 1, E], pred_out: [B, 1, P]) -> logits [B, 1, 1, V]
+// Predictor cache tensors of a hypothesis are packed into one state tensor: [num caches, layers, H].
+// The nnet is shared with Scorer(encoder), it is owned outside.
+class TorchTransducerModel : public TransducerModelItf {
+    torch::jit::script::Module* nnet_ = nullptr;
+    TokenId blk_ = kNoTokenId; // predictor input of the empty prefix
+
+public:
+
+    Error Load(torch::jit::script::Module& nnet, const Tokenizer& tokenizer) {
+        SIO_CHECK(nnet_ == nullptr);
+        nnet_ = &nnet;
+        blk_ = tokenizer.blk;
+
+        return Error::OK;
+    }
+
+
+    Error InitPredictor(torch::Tensor* out, torch::Tensor* state) override {
+        torch::NoGradGuard no_grad;
+
+        torch::Tensor init = Pack(nnet_->run_method("forward_predictor_init_state").toTensorList());
+
+        vec<torch::Tensor> outs, states;
+        Predict({blk_}, {init[0]}, &outs, &states);
+        *out = outs[0];
+        *state = states[0];
+
+        return Error::OK;
+    }
+
+
+    Error Predict(const vec<TokenId>& tokens, const vec<torch::Tensor>& states,
+        vec<torch::Tensor>* outs, vec<torch::Tensor>* next_states) override
+    {
+        SIO_CHECK_EQ(tokens.size(), states.size());
+        torch::NoGradGuard no_grad;
+
+        i64 b = tokens.size();
+        vec<i64> ids(tokens.begin(), tokens.end());
+        torch::Tensor xs = torch::from_blob(ids.data(), {b, 1}, torch::kLong).clone();
+
+        auto r = nnet_->run_method("forward_predictor_step", xs, Unpack(torch::stack(states))).toTuple()->elements();
+        SIO_CHECK_EQ(r.size(), 2);
+        torch::Tensor out = r[0].toTensor().reshape({b, -1});
+        torch::Tensor next = Pack(r[1].toTensorList());
+
+        outs->clear();
+        next_states->clear();
+        for (i64 i = 0; i != b; i++) {
+            outs->push_back(out[i]);
+            next_states->push_back(next[i]);
+        }
+
+        return Error::OK;
+    }
+
+
+    Error Join(const torch::Tensor& enc, const vec<torch::Tensor>& preds, torch::Tensor* logp) override {
+        torch::NoGradGuard no_grad;
+
+        i64 b = preds.size();
+        torch::Tensor enc_out = enc.reshape({1, 1, -1}).expand({b, 1, enc.size(0)});
+        torch::Tensor pred_out = torch::stack(preds).unsqueeze(1);
+
+        torch::Tensor logits = nnet_->run_method("forward_joint_step", enc_out, pred_out).toTensor();
+        *logp = torch::log_softmax(logits.reshape({b, -1}), 1).contiguous();
+
+        return Error::OK;
+    }
+
+private:
+
+    // [layers, B, H] x num caches -> [B, num caches, layers, H]
+    static torch::Tensor Pack(const c10::List<torch::Tensor>& cache) {
+        vec<torch::Tensor> v;
+        for (const torch::Tensor& c : cache) {
+            v.push_back(c.transpose(0, 1));
+        }
+        return torch::stack(v, 1);
+    }
+
+
+    static c10::List<torch::Tensor> Unpack(const torch::Tensor& states) {
+        c10::List<torch::Tensor> cache;
+        for (i64 i = 0; i != states.size(1); i++) {
+            cache.push_back(states.select(1, i).transpose(0, 1).contiguous());
+        }
+        return cache;
+    }
+
+}; // class TorchTransducerModel
+}  // namespace sio
+#endif